@@ -0,0 +1,157 @@
+#include "components/ble/DfuDecompressor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <nrf_log.h>
+
+using namespace Pinetime::Controllers;
+
+namespace {
+  constexpr char compressedMagic[4] = {'I', 'T', 'D', 'Z'};
+}
+
+DfuDecompressor::DfuDecompressor(size_t maxImageSize) : maxImageSize {maxImageSize} {
+}
+
+bool DfuDecompressor::IsCompressed(const uint8_t* data, size_t size) {
+  return size >= sizeof(compressedMagic) && memcmp(data, compressedMagic, sizeof(compressedMagic)) == 0;
+}
+
+void DfuDecompressor::Begin() {
+  phase = Phase::Header;
+  filled = 0;
+  produced = 0;
+}
+
+bool DfuDecompressor::Next(const uint8_t*& data, size_t& size, Part& part) {
+  while (size > 0) {
+    switch (phase) {
+      case Phase::Header: {
+        const size_t count = std::min(sizeof(Header) - filled, size);
+        memcpy(reinterpret_cast<uint8_t*>(&header) + filled, data, count);
+        filled += count;
+        data += count;
+        size -= count;
+        if (filled == sizeof(Header) && !ProcessHeader()) {
+          phase = Phase::Failed;
+        }
+        break;
+      }
+      case Phase::Token:
+        token = *data++;
+        size--;
+        length = token >> 4U;
+        if (length == 15) {
+          phase = Phase::LiteralLength;
+        } else {
+          StartLiterals();
+        }
+        break;
+      case Phase::LiteralLength: {
+        const uint8_t value = *data++;
+        size--;
+        length += value;
+        if (value != 255) {
+          StartLiterals();
+        }
+        break;
+      }
+      case Phase::Literals: {
+        const size_t count = std::min(length, size);
+        if (!Produce(count)) {
+          break;
+        }
+        part = {data, count, 0};
+        data += count;
+        size -= count;
+        length -= count;
+        if (length == 0) {
+          StartLiterals();
+        }
+        return true;
+      }
+      case Phase::Offset:
+        offset |= static_cast<uint16_t>(*data++ << (8 * filled));
+        size--;
+        if (++filled < 2) {
+          break;
+        }
+        if (offset == 0 || offset > produced) {
+          NRF_LOG_WARNING("[DfuDecompressor] Invalid match offset");
+          phase = Phase::Failed;
+          break;
+        }
+        length = token & 0x0FU;
+        if (length < 15) {
+          length += minMatchLength;
+          if (!Produce(length)) {
+            break;
+          }
+          part = {nullptr, length, offset};
+          phase = (produced == header.imageSize) ? Phase::Done : Phase::Token;
+          return true;
+        }
+        phase = Phase::MatchLength;
+        break;
+      case Phase::MatchLength: {
+        const uint8_t value = *data++;
+        size--;
+        length += value;
+        if (value != 255) {
+          length += minMatchLength;
+          if (!Produce(length)) {
+            break;
+          }
+          part = {nullptr, length, offset};
+          phase = (produced == header.imageSize) ? Phase::Done : Phase::Token;
+          return true;
+        }
+        break;
+      }
+      case Phase::Done:
+        // Nothing is expected after the last sequence
+        NRF_LOG_WARNING("[DfuDecompressor] Unexpected data after the end of the image");
+        phase = Phase::Failed;
+        [[fallthrough]];
+      case Phase::Failed:
+        data += size;
+        size = 0;
+        break;
+    }
+  }
+  return false;
+}
+
+bool DfuDecompressor::ProcessHeader() {
+  if (memcmp(header.magic, compressedMagic, sizeof(compressedMagic)) != 0 || header.version != formatVersion ||
+      header.imageSize > maxImageSize) {
+    NRF_LOG_WARNING("[DfuDecompressor] Invalid header");
+    return false;
+  }
+  phase = (header.imageSize == 0) ? Phase::Done : Phase::Token;
+  return true;
+}
+
+// Continues with the literals of the sequence, or with its match once they are all there. The last sequence of the
+// image has no match.
+void DfuDecompressor::StartLiterals() {
+  if (length > 0) {
+    phase = Phase::Literals;
+  } else if (produced == header.imageSize) {
+    phase = Phase::Done;
+  } else {
+    phase = Phase::Offset;
+    filled = 0;
+    offset = 0;
+  }
+}
+
+bool DfuDecompressor::Produce(size_t count) {
+  if (count > header.imageSize - produced) {
+    NRF_LOG_WARNING("[DfuDecompressor] The data is larger than the image");
+    phase = Phase::Failed;
+    return false;
+  }
+  produced += count;
+  return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Pinetime {
+  namespace Controllers {
+    // Decodes a compressed firmware image (see doc/CompressedFirmwareUpdate.md) received by the DFU service instead of
+    // the image itself.
+    //
+    // The compressed image is a header followed by the image compressed in the LZ4 block format: sequences of literals
+    // followed by a match, a copy of the image from up to 64KB before. The decoder does not keep any history: the
+    // literals are read directly from the received packets, and the DFU service copies the matches from the part of the
+    // image already written (page buffer or SPI flash). It only buffers the header.
+    class DfuDecompressor {
+    public:
+      explicit DfuDecompressor(size_t maxImageSize);
+
+      static constexpr uint8_t formatVersion = 1;
+
+      // Part of the image: `length` bytes at `literals` (in the received data), or, if literals is nullptr, a copy of
+      // `length` bytes of the image from `distance` bytes before the end of the image produced so far
+      struct Part {
+        const uint8_t* literals = nullptr;
+        size_t length = 0;
+        uint16_t distance = 0;
+      };
+
+      // Whether the data received at the beginning of the image is the beginning of a compressed image
+      static bool IsCompressed(const uint8_t* data, size_t size);
+
+      void Begin();
+      // Consumes the received data until the next part of the image is known. Returns false once all the data is used
+      // (or on error).
+      bool Next(const uint8_t*& data, size_t& size, Part& part);
+
+      bool HasFailed() const {
+        return phase == Phase::Failed;
+      }
+
+      bool IsComplete() const {
+        return phase == Phase::Done;
+      }
+
+      // Size of the image, 0 until the header is received
+      uint32_t ImageSize() const {
+        return (phase == Phase::Header || phase == Phase::Failed) ? 0 : header.imageSize;
+      }
+
+      uint32_t ImageCrc() const {
+        return header.imageCrc;
+      }
+
+    private:
+      enum class Phase : uint8_t { Header, Token, LiteralLength, Literals, Offset, MatchLength, Done, Failed };
+
+      struct __attribute__((packed)) Header {
+        char magic[4];
+        uint8_t version;
+        uint8_t reserved[3];
+        uint32_t imageSize;
+        uint32_t imageCrc;
+      };
+
+      static_assert(sizeof(Header) == 16, "The header is stored as-is in the compressed image");
+
+      static constexpr size_t minMatchLength = 4;
+
+      bool ProcessHeader();
+      void StartLiterals();
+      bool Produce(size_t length);
+
+      size_t maxImageSize;
+      Phase phase = Phase::Header;
+      Header header;
+      // Number of bytes of the header or of the offset received so far
+      size_t filled = 0;
+      uint8_t token = 0;
+      // Length of the literals or of the match being decoded
+      size_t length = 0;
+      uint16_t offset = 0;
+      uint32_t produced = 0;
+    };
+  }
+}
@@ -0,0 +1,131 @@
+#include "components/ble/DfuPatch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <nrf_log.h>
+
+#include "utility/Crc32.h"
+
+using namespace Pinetime::Controllers;
+
+namespace {
+  constexpr char patchMagic[4] = {'I', 'T', 'D', 'P'};
+}
+
+DfuPatch::DfuPatch(const uint8_t* base, size_t maxBaseSize, size_t maxImageSize)
+  : base {base}, maxBaseSize {maxBaseSize}, maxImageSize {maxImageSize} {
+}
+
+bool DfuPatch::IsPatch(const uint8_t* data, size_t size) {
+  return size >= sizeof(patchMagic) && memcmp(data, patchMagic, sizeof(patchMagic)) == 0;
+}
+
+void DfuPatch::Begin() {
+  phase = Phase::Header;
+  filled = 0;
+  produced = 0;
+  remaining = 0;
+}
+
+const uint8_t* DfuPatch::Next(const uint8_t*& data, size_t& size, size_t& length) {
+  length = 0;
+  while (size > 0) {
+    switch (phase) {
+      case Phase::Header:
+        if (Fill(&header, sizeof(Header), data, size) && !ProcessHeader()) {
+          phase = Phase::Failed;
+        }
+        break;
+      case Phase::Operation:
+        if (Fill(&operation, sizeof(Operation), data, size)) {
+          const uint8_t* part = ProcessOperation(length);
+          if (part != nullptr) {
+            return part;
+          }
+        }
+        break;
+      case Phase::Insert: {
+        const uint8_t* part = data;
+        length = std::min<size_t>(remaining, size);
+        data += length;
+        size -= length;
+        remaining -= length;
+        if (remaining == 0) {
+          phase = Phase::Operation;
+        }
+        Produced(length);
+        return part;
+      }
+      case Phase::Done:
+        // Nothing is expected after the last operation
+        NRF_LOG_WARNING("[DfuPatch] Unexpected data after the end of the patch");
+        phase = Phase::Failed;
+        [[fallthrough]];
+      case Phase::Failed:
+        data += size;
+        size = 0;
+        break;
+    }
+  }
+  return nullptr;
+}
+
+// Copies the data to destination until `length` bytes were received. Returns true once they are all there.
+bool DfuPatch::Fill(void* destination, size_t length, const uint8_t*& data, size_t& size) {
+  const size_t count = std::min(length - filled, size);
+  memcpy(static_cast<uint8_t*>(destination) + filled, data, count);
+  filled += count;
+  data += count;
+  size -= count;
+  if (filled < length) {
+    return false;
+  }
+  filled = 0;
+  return true;
+}
+
+bool DfuPatch::ProcessHeader() {
+  if (memcmp(header.magic, patchMagic, sizeof(patchMagic)) != 0 || header.version != formatVersion || header.flags != 0 ||
+      header.imageSize > maxImageSize) {
+    NRF_LOG_WARNING("[DfuPatch] Invalid patch header");
+    return false;
+  }
+  // The patch only applies to the firmware it was generated from
+  if (header.baseSize > maxBaseSize || Utility::Crc32(base, header.baseSize) != header.baseCrc) {
+    NRF_LOG_WARNING("[DfuPatch] The patch does not apply to the running firmware");
+    return false;
+  }
+  phase = (header.imageSize == 0) ? Phase::Done : Phase::Operation;
+  return true;
+}
+
+const uint8_t* DfuPatch::ProcessOperation(size_t& length) {
+  if (operation.length == 0 || operation.length > header.imageSize - produced) {
+    phase = Phase::Failed;
+    return nullptr;
+  }
+  switch (operation.type) {
+    case OperationType::Copy:
+      if (operation.offset > header.baseSize || operation.length > header.baseSize - operation.offset) {
+        phase = Phase::Failed;
+        return nullptr;
+      }
+      length = operation.length;
+      Produced(length);
+      return base + operation.offset;
+    case OperationType::Insert:
+      remaining = operation.length;
+      phase = Phase::Insert;
+      return nullptr;
+    default:
+      phase = Phase::Failed;
+      return nullptr;
+  }
+}
+
+void DfuPatch::Produced(size_t length) {
+  produced += length;
+  if (produced == header.imageSize) {
+    phase = Phase::Done;
+  }
+}
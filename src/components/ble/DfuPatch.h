@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Pinetime {
+  namespace Controllers {
+    // Decodes a firmware patch (see doc/DeltaFirmwareUpdate.md) received by the DFU service instead of a full image.
+    //
+    // The patch is a header followed by operations that produce the new image from the beginning to the end: copy a
+    // range of the running image (the base), or insert the data that follows the operation in the patch.
+    // The base is read directly from the internal flash, and the inserted data directly from the received packets:
+    // the decoder only buffers the headers.
+    //
+    // The header holds the size and CRC32 of the base, checked before decoding anything else, and the size and CRC32
+    // of the new image, checked by the DFU service once the image is written.
+    class DfuPatch {
+    public:
+      DfuPatch(const uint8_t* base, size_t maxBaseSize, size_t maxImageSize);
+
+      static constexpr uint8_t formatVersion = 1;
+
+      // Whether the data received at the beginning of the image is the beginning of a patch
+      static bool IsPatch(const uint8_t* data, size_t size);
+
+      void Begin();
+      // Consumes the received data until the next part of the image is known, and returns its address, in the received
+      // data or in the base. `length` is the size of the part. Returns nullptr once all the data is used (or on error).
+      const uint8_t* Next(const uint8_t*& data, size_t& size, size_t& length);
+
+      bool HasFailed() const {
+        return phase == Phase::Failed;
+      }
+
+      bool IsComplete() const {
+        return phase == Phase::Done;
+      }
+
+      // Size of the new image, 0 until the header is received
+      uint32_t ImageSize() const {
+        return (phase == Phase::Header || phase == Phase::Failed) ? 0 : header.imageSize;
+      }
+
+      uint32_t ImageCrc() const {
+        return header.imageCrc;
+      }
+
+    private:
+      enum class Phase : uint8_t { Header, Operation, Insert, Done, Failed };
+      enum class OperationType : uint8_t { Copy = 0, Insert = 1 };
+
+      struct __attribute__((packed)) Header {
+        char magic[4];
+        uint8_t version;
+        uint8_t flags;
+        uint16_t reserved;
+        uint32_t baseSize;
+        uint32_t baseCrc;
+        uint32_t imageSize;
+        uint32_t imageCrc;
+      };
+
+      struct __attribute__((packed)) Operation {
+        OperationType type;
+        uint8_t reserved[3];
+        uint32_t length;
+        uint32_t offset; // in the base, for a copy
+      };
+
+      static_assert(sizeof(Header) == 24, "The header is stored as-is in the patch");
+      static_assert(sizeof(Operation) == 12, "Operations are stored as-is in the patch");
+
+      bool Fill(void* destination, size_t length, const uint8_t*& data, size_t& size);
+      bool ProcessHeader();
+      const uint8_t* ProcessOperation(size_t& length);
+      void Produced(size_t length);
+
+      const uint8_t* base;
+      size_t maxBaseSize;
+      size_t maxImageSize;
+      Phase phase = Phase::Header;
+      Header header;
+      Operation operation;
+      // Number of bytes of the current header received so far
+      size_t filled = 0;
+      // Bytes of the image produced so far, and bytes of the current insert left
+      uint32_t produced = 0;
+      uint32_t remaining = 0;
+    };
+  }
+}
@@ -1,8 +1,11 @@
 #include "components/ble/DfuService.h"
+#include <algorithm>
 #include <cstring>
 #include "components/ble/BleController.h"
+#include "components/firmwarevalidator/FirmwareValidator.h"
 #include "drivers/SpiNorFlash.h"
 #include "systemtask/SystemTask.h"
+#include "utility/Crc32.h"
 #include <nrf_log.h>
 
 using namespace Pinetime::Controllers;
@@ -77,6 +80,13 @@ void DfuService::Init() {
   ASSERT(res == 0);
 }
 
+void DfuService::PreErase() {
+  if (!Pinetime::Controllers::FirmwareValidator().IsValidated()) {
+    return;
+  }
+  dfuImage.PreErase();
+}
+
 int DfuService::OnServiceData(uint16_t connectionHandle, uint16_t attributeHandle, ble_gatt_access_ctxt* context) {
   if (bleController.IsFirmwareUpdating()) {
     xTimerStart(timeoutTimer, 0);
@@ -163,8 +173,11 @@ int DfuService::WritePacketHandler(uint16_t connectionHandle, os_mbuf* om) {
 
     case States::Data: {
       nbPacketReceived++;
-      dfuImage.Append(om->om_data, om->om_len);
-      bytesReceived += om->om_len;
+      // With a large MTU, a packet can be split over several mbufs
+      for (auto* buffer = om; buffer != nullptr; buffer = SLIST_NEXT(buffer, om_next)) {
+        dfuImage.Append(buffer->om_data, buffer->om_len);
+      }
+      bytesReceived += OS_MBUF_PKTLEN(om);
       bleController.FirmwareUpdateCurrentBytes(bytesReceived);
 
       if ((nbPacketReceived % nbPacketsToNotify) == 0 && bytesReceived != applicationSize) {
@@ -216,6 +229,7 @@ int DfuService::ControlPointHandler(uint16_t connectionHandle, os_mbuf* om) {
         bleController.FirmwareUpdateTotalBytes(0xffffffffu);
         bleController.FirmwareUpdateCurrentBytes(0);
         systemTask.PushMessage(Pinetime::System::Messages::BleFirmwareUpdateStarted);
+        RequestFastConnection(connectionHandle);
         return 0;
       } else {
         NRF_LOG_INFO("[DFU] -> Start DFU, mode %d not supported!", imageType);
@@ -248,8 +262,7 @@ int DfuService::ControlPointHandler(uint16_t connectionHandle, os_mbuf* om) {
         NRF_LOG_INFO("[DFU] -> Receive firmware image requested, but we are not in Start Init");
         return 0;
       }
-      // TODO the chunk size is dependent of the implementation of the host application...
-      dfuImage.Init(20, applicationSize, expectedCrc);
+      dfuImage.Init(applicationSize, expectedCrc);
       NRF_LOG_INFO("[DFU] -> Starting receive firmware");
       state = States::Data;
       return 0;
@@ -297,6 +310,20 @@ int DfuService::ControlPointHandler(uint16_t connectionHandle, os_mbuf* om) {
   }
 }
 
+// The central chooses the connection parameters, and can change them at any time during the transfer: this only asks
+// for a short interval, the transfer works with any interval
+void DfuService::RequestFastConnection(uint16_t connectionHandle) {
+  ble_gap_upd_params params {};
+  params.itvl_min = transferMinInterval;
+  params.itvl_max = transferMaxInterval;
+  params.latency = 0;
+  params.supervision_timeout = transferSupervisionTimeout;
+  const int res = ble_gap_update_params(connectionHandle, &params);
+  if (res != 0) {
+    NRF_LOG_INFO("[DFU] -> Connection parameters update request failed: %d", res);
+  }
+}
+
 void DfuService::OnTimeout() {
   bleController.State(Pinetime::Controllers::Ble::FirmwareUpdateStates::Error);
   Reset();
@@ -312,6 +339,10 @@ void DfuService::Reset() {
   applicationSize = 0;
   expectedCrc = 0;
   notificationManager.Reset();
+  // A validated image is activated by the reset that follows: it must not be pre-erased in the meantime
+  if (bleController.State() != Pinetime::Controllers::Ble::FirmwareUpdateStates::Validated) {
+    dfuImage.EndUpdate();
+  }
   bleController.StopFirmwareUpdate();
   systemTask.PushMessage(Pinetime::System::Messages::BleFirmwareUpdateFinished);
 }
@@ -352,39 +383,164 @@ void DfuService::NotificationManager::Reset() {
   xTimerStop(timer, 0);
 }
 
-void DfuService::DfuImage::Init(size_t chunkSize, size_t totalSize, uint16_t expectedCrc) {
-  if (chunkSize != 20)
+DfuService::DfuImage::DfuImage(Pinetime::Drivers::SpiNorFlash& spiNorFlash) : spiNorFlash {spiNorFlash} {
+  mutex = xSemaphoreCreateMutex();
+  ASSERT(mutex != nullptr);
+}
+
+void DfuService::DfuImage::Init(size_t totalSize, uint16_t expectedCrc) {
+  this->ready = false;
+  if (totalSize > maxSize)
     return;
-  this->chunkSize = chunkSize;
   this->totalSize = totalSize;
   this->expectedCrc = expectedCrc;
   this->ready = true;
+  receivedSize = 0;
+  imageSize = totalSize;
   totalWriteIndex = 0;
   bufferWriteIndex = 0;
+  receivedCrc = 0xFFFF;
+  encoding = Encoding::Image;
+  imageCrc = 0;
+#ifdef DFU_VERIFY_WRITES
+  pageSize = 0;
+  writeFailed = false;
+#endif
 }
 
-void DfuService::DfuImage::Append(uint8_t* data, size_t size) {
-  if (!ready)
+void DfuService::DfuImage::Append(const uint8_t* data, size_t size) {
+  if (!ready || receivedSize == totalSize)
+    return;
+  size = std::min(size, totalSize - receivedSize);
+  if (receivedSize == 0) {
+    if (DfuPatch::IsPatch(data, size)) {
+      NRF_LOG_INFO("[DFU] Receiving a patch");
+      encoding = Encoding::Patch;
+      patch.Begin();
+      imageSize = 0;
+    } else if (DfuDecompressor::IsCompressed(data, size)) {
+      NRF_LOG_INFO("[DFU] Receiving a compressed image");
+      encoding = Encoding::Compressed;
+      decompressor.Begin();
+      imageSize = 0;
+    }
+  }
+  receivedCrc = ComputeCrc(data, size, &receivedCrc);
+  receivedSize += size;
+
+  switch (encoding) {
+    case Encoding::Image:
+      Write(data, size);
+      break;
+    case Encoding::Patch:
+      // Each part of the image is either in the packet or in the running image
+      while (size > 0) {
+        size_t length = 0;
+        const uint8_t* part = patch.Next(data, size, length);
+        imageSize = patch.ImageSize();
+        if (part != nullptr) {
+          Write(part, length);
+        }
+      }
+      break;
+    case Encoding::Compressed:
+      // Each part of the image is either in the packet or earlier in the image
+      while (size > 0) {
+        DfuDecompressor::Part part;
+        const bool produced = decompressor.Next(data, size, part);
+        imageSize = decompressor.ImageSize();
+        if (produced && part.literals != nullptr) {
+          Write(part.literals, part.length);
+        } else if (produced) {
+          Repeat(part.distance, part.length);
+        }
+      }
+      break;
+  }
+}
+
+void DfuService::DfuImage::Write(const uint8_t* data, size_t size) {
+  if (totalWriteIndex == imageSize)
     return;
-  ASSERT(size <= 20);
+  size = std::min(size, imageSize - (totalWriteIndex + bufferWriteIndex));
 
-  std::memcpy(tempBuffer + bufferWriteIndex, data, size);
-  bufferWriteIndex += size;
+  while (size > 0) {
+    const size_t count = std::min(size, bufferSize - bufferWriteIndex);
+    std::memcpy(tempBuffer + bufferWriteIndex, data, count);
+    bufferWriteIndex += count;
+    data += count;
+    size -= count;
 
-  if (bufferWriteIndex == bufferSize) {
-    spiNorFlash.Write(writeOffset + totalWriteIndex, tempBuffer, bufferWriteIndex);
-    totalWriteIndex += bufferWriteIndex;
-    bufferWriteIndex = 0;
+    if (bufferWriteIndex == bufferSize || totalWriteIndex + bufferWriteIndex == imageSize) {
+      WritePage();
+    }
   }
 
-  if (bufferWriteIndex > 0 && totalWriteIndex + bufferWriteIndex == totalSize) {
-    spiNorFlash.Write(writeOffset + totalWriteIndex, tempBuffer, bufferWriteIndex);
-    totalWriteIndex += bufferWriteIndex;
-    if (totalSize < maxSize)
+  if (totalWriteIndex == imageSize) {
+#ifdef DFU_VERIFY_WRITES
+    VerifyPage();
+#endif
+    if (imageSize < maxSize)
       WriteMagicNumber();
   }
 }
 
+// Copies `length` bytes of the image from `distance` bytes before the end of the data written so far. The source is
+// in the page buffer or already in the flash. When the distance is shorter than the length, the bytes copied are
+// copied again.
+void DfuService::DfuImage::Repeat(size_t distance, size_t length) {
+  uint8_t chunk[32];
+  while (length > 0 && totalWriteIndex + bufferWriteIndex < imageSize) {
+    const size_t source = totalWriteIndex + bufferWriteIndex - distance;
+    size_t count = std::min({length, distance, sizeof(chunk)});
+    if (source >= totalWriteIndex) {
+      std::memcpy(chunk, tempBuffer + (source - totalWriteIndex), count);
+    } else {
+      count = std::min(count, totalWriteIndex - source);
+      spiNorFlash.Read(writeOffset + source, chunk, count);
+    }
+    Write(chunk, count);
+    length -= count;
+  }
+}
+
+// The flash programs the page while the next packets are received
+void DfuService::DfuImage::WritePage() {
+  if (encoding != Encoding::Image) {
+    imageCrc = Utility::Crc32(tempBuffer, bufferWriteIndex, imageCrc);
+  }
+#ifdef DFU_VERIFY_WRITES
+  VerifyPage();
+  pageCrc = ComputeCrc(tempBuffer, bufferWriteIndex, nullptr);
+  pageAddress = writeOffset + totalWriteIndex;
+  pageSize = bufferWriteIndex;
+#endif
+  spiNorFlash.WriteAsync(writeOffset + totalWriteIndex, tempBuffer, bufferWriteIndex);
+  totalWriteIndex += bufferWriteIndex;
+  bufferWriteIndex = 0;
+}
+
+#ifdef DFU_VERIFY_WRITES
+// Reads back the previous page (its program is usually over by now), without touching tempBuffer that holds the next one
+void DfuService::DfuImage::VerifyPage() {
+  if (pageSize == 0) {
+    return;
+  }
+  uint16_t readCrc = 0xFFFF;
+  uint8_t data[16];
+  for (size_t offset = 0; offset < pageSize; offset += sizeof(data)) {
+    const size_t size = std::min(sizeof(data), pageSize - offset);
+    spiNorFlash.Read(pageAddress + offset, data, size);
+    readCrc = ComputeCrc(data, size, &readCrc);
+  }
+  if (readCrc != pageCrc) {
+    NRF_LOG_INFO("[DFU] Verification of the page at 0x%x failed", pageAddress);
+    writeFailed = true;
+  }
+  pageSize = 0;
+}
+#endif
+
 void DfuService::DfuImage::WriteMagicNumber() {
   uint32_t magic[4] = {
     // TODO When this variable is a static constexpr, the values written to the memory are not correct. Why?
@@ -399,30 +555,156 @@ void DfuService::DfuImage::WriteMagicNumber() {
 }
 
 void DfuService::DfuImage::Erase() {
-  for (size_t erased = 0; erased < maxSize; erased += 0x1000) {
-    spiNorFlash.SectorErase(writeOffset + erased);
+  // Waits for the pre-erase step in progress, if any. No other one starts until EndUpdate().
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  updating = true;
+
+  // Up to 7 64KB blocks and 4 sectors, if nothing was pre-erased
+  for (size_t sector = 0; sector < sectorCount;) {
+    if (IsErased(sector)) {
+      sector++;
+      continue;
+    }
+    size_t count = 1;
+    while (sector + count < sectorCount && !IsErased(sector + count)) {
+      count++;
+    }
+    spiNorFlash.EraseRange(writeOffset + sector * sectorSize, count * sectorSize);
+    sector += count;
   }
+  spiNorFlash.WaitForCompletion();
+
+  // The image is written to the slot
+  std::memset(erasedSectors, 0, sizeof(erasedSectors));
+  preEraseSector = 0;
+  xSemaphoreGive(mutex);
 }
 
-bool DfuService::DfuImage::Validate() {
-  uint32_t chunkSize = 200;
-  size_t currentOffset = 0;
-  uint16_t crc = 0;
+void DfuService::DfuImage::EndUpdate() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  updating = false;
+  xSemaphoreGive(mutex);
+}
+
+bool DfuService::DfuImage::PreErase() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  const bool pending = PreEraseStep();
+  xSemaphoreGive(mutex);
+  return pending;
+}
 
-  bool first = true;
-  while (currentOffset < totalSize) {
-    uint32_t readSize = (totalSize - currentOffset) > chunkSize ? chunkSize : (totalSize - currentOffset);
+bool DfuService::DfuImage::PreEraseStep() {
+  if (updating) {
+    return false;
+  }
+  while (preEraseSector < sectorCount && IsErased(preEraseSector)) {
+    preEraseSector++;
+  }
+  if (preEraseSector == sectorCount) {
+    return false;
+  }
+  // Font loads and other reads suspend the erase, the next step starts once it is over
+  if (spiNorFlash.IsBusy()) {
+    return true;
+  }
 
-    spiNorFlash.Read(writeOffset + currentOffset, tempBuffer, readSize);
-    if (first) {
-      crc = ComputeCrc(tempBuffer, readSize, NULL);
-      first = false;
-    } else
-      crc = ComputeCrc(tempBuffer, readSize, &crc);
-    currentOffset += readSize;
+  // The end of the slot is usually blank (the previous firmware is smaller than the slot): checking it is faster than
+  // erasing it, and does not wear the flash
+  if (IsBlank(writeOffset + preEraseSector * sectorSize)) {
+    MarkErased(preEraseSector, 1);
+    return true;
+  }
+  size_t count = 1;
+  while (preEraseSector + count < sectorCount && !IsErased(preEraseSector + count)) {
+    count++;
   }
+  const size_t erased = spiNorFlash.EraseAsync(writeOffset + preEraseSector * sectorSize, count * sectorSize);
+  MarkErased(preEraseSector, erased / sectorSize);
+  return true;
+}
+
+bool DfuService::DfuImage::IsErased(size_t sector) const {
+  return (erasedSectors[sector / 8] & (1U << (sector % 8))) != 0;
+}
+
+void DfuService::DfuImage::MarkErased(size_t sector, size_t count) {
+  for (size_t i = sector; i < sector + count && i < sectorCount; i++) {
+    erasedSectors[i / 8] |= static_cast<uint8_t>(1U << (i % 8));
+  }
+}
+
+// Reads into its own buffer (on the stack of SystemTask): tempBuffer belongs to the NimBLE task
+bool DfuService::DfuImage::IsBlank(uint32_t address) {
+  uint8_t buffer[64];
+  for (size_t offset = 0; offset < sectorSize; offset += sizeof(buffer)) {
+    spiNorFlash.Read(address + offset, buffer, sizeof(buffer));
+    for (const uint8_t value : buffer) {
+      if (value != 0xFF) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
-  return (crc == expectedCrc);
+bool DfuService::DfuImage::Validate() {
+  // The last page and the magic number may still be programming
+  spiNorFlash.WaitForCompletion();
+  if (spiNorFlash.ProgramFailed()) {
+    NRF_LOG_INFO("[DFU] Programming the image failed");
+    return false;
+  }
+#ifdef DFU_VERIFY_WRITES
+  if (writeFailed) {
+    return false;
+  }
+#endif
+  if (!IsComplete() || receivedCrc != expectedCrc) {
+    return false;
+  }
+  switch (encoding) {
+    case Encoding::Patch:
+      if (!patch.IsComplete() || totalWriteIndex != imageSize || imageCrc != patch.ImageCrc()) {
+        return false;
+      }
+      break;
+    case Encoding::Compressed:
+      if (!decompressor.IsComplete() || totalWriteIndex != imageSize || imageCrc != decompressor.ImageCrc()) {
+        return false;
+      }
+      break;
+    default:
+      break;
+  }
+  if (!IsSlotValid()) {
+    NRF_LOG_INFO("[DFU] The image in the flash does not match the image received");
+    return false;
+  }
+  return true;
+}
+
+// Reads the image back from the slot: the CRCs above only cover the data received and produced in RAM. tempBuffer is
+// free once the last page is written.
+bool DfuService::DfuImage::IsSlotValid() {
+  uint16_t crc16 = 0xFFFF;
+  uint32_t crc32 = 0;
+  for (size_t offset = 0; offset < imageSize; offset += bufferSize) {
+    const size_t size = std::min(bufferSize, imageSize - offset);
+    spiNorFlash.Read(writeOffset + offset, tempBuffer, size);
+    if (encoding == Encoding::Image) {
+      crc16 = ComputeCrc(tempBuffer, size, &crc16);
+    } else {
+      crc32 = Utility::Crc32(tempBuffer, size, crc32);
+    }
+  }
+  switch (encoding) {
+    case Encoding::Patch:
+      return crc32 == patch.ImageCrc();
+    case Encoding::Compressed:
+      return crc32 == decompressor.ImageCrc();
+    default:
+      return crc16 == expectedCrc;
+  }
 }
 
 uint16_t DfuService::DfuImage::ComputeCrc(uint8_t const* p_data, uint32_t size, uint16_t const* p_crc) {
@@ -442,5 +724,5 @@ uint16_t DfuService::DfuImage::ComputeCrc(uint8_t const* p_data, uint32_t size,
 bool DfuService::DfuImage::IsComplete() {
   if (!ready)
     return false;
-  return totalWriteIndex == totalSize;
+  return receivedSize == totalSize;
 }
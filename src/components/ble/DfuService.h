@@ -2,6 +2,10 @@
 
 #include <cstdint>
 #include <array>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "components/ble/DfuDecompressor.h"
+#include "components/ble/DfuPatch.h"
 
 #define min // workaround: nimble's min/max macros conflict with libstdc++
 #define max
@@ -27,6 +31,10 @@ namespace Pinetime {
                  Pinetime::Controllers::Ble& bleController,
                  Pinetime::Drivers::SpiNorFlash& spiNorFlash);
       void Init();
+      // Erases the next part of the OTA slot in the background, once the running firmware is validated (the slot then
+      // holds the previous firmware, that is not needed anymore), so that the next update does not wait for the erase.
+      // Does nothing while an update is in progress or while the flash is busy.
+      void PreErase();
       int OnServiceData(uint16_t connectionHandle, uint16_t attributeHandle, ble_gatt_access_ctxt* context);
       void OnTimeout();
       void Reset();
@@ -49,31 +57,84 @@ namespace Pinetime {
         void Reset();
       };
 
+      // Erase() and EndUpdate() run in the NimBLE task, PreErase() in SystemTask: they are serialized by a mutex, and
+      // PreErase() does nothing from the beginning of an update (Erase()) to its end (EndUpdate()).
       class DfuImage {
       public:
-        DfuImage(Pinetime::Drivers::SpiNorFlash& spiNorFlash) : spiNorFlash {spiNorFlash} {
-        }
+        DfuImage(Pinetime::Drivers::SpiNorFlash& spiNorFlash);
 
-        void Init(size_t chunkSize, size_t totalSize, uint16_t expectedCrc);
+        void Init(size_t totalSize, uint16_t expectedCrc);
+        // Starts an update: erases the parts of the slot that were not pre-erased
         void Erase();
-        void Append(uint8_t* data, size_t size);
+        // Ends the update (validated, failed or aborted): the slot can be pre-erased again for the next one
+        void EndUpdate();
+        // Checks or erases the next sector(s) of the slot not known to be erased. Returns false once they all are, or
+        // during an update.
+        bool PreErase();
+        // Packets can have any size: the data is written to the flash one page at a time. The data is either the image,
+        // a patch to the running image (DfuPatch) or the compressed image (DfuDecompressor), detected from its first bytes.
+        void Append(const uint8_t* data, size_t size);
+        // Checks that the flash programmed every page, the CRC of the data received, computed by Append(), the CRC of the
+        // image produced by a patch or decompressed, and the CRC of the image read back from the slot
         bool Validate();
         bool IsComplete();
 
       private:
         Pinetime::Drivers::SpiNorFlash& spiNorFlash;
-        static constexpr size_t bufferSize = 200;
+        // One page of the flash: the slot starts on a page boundary, so that each write programs a whole page
+        static constexpr size_t bufferSize = 256;
         bool ready = false;
-        size_t chunkSize = 0;
         size_t totalSize = 0;
-        size_t maxSize = 475136;
+        size_t receivedSize = 0;
+        static constexpr size_t maxSize = 475136;
+        // Size of the image written to the slot: totalSize, or the size given by the patch or the compressed image
+        size_t imageSize = 0;
         size_t bufferWriteIndex = 0;
         size_t totalWriteIndex = 0;
         static constexpr size_t writeOffset = 0x40000;
         uint8_t tempBuffer[bufferSize];
         uint16_t expectedCrc = 0;
-
+        uint16_t receivedCrc = 0xFFFF;
+
+        // The running image, base of the patches: MCUBoot header, application and TLVs, up to the scratch partition
+        static constexpr uint32_t runningImageAddress = 0x8000;
+        static constexpr size_t runningImageMaxSize = 0x7C000 - runningImageAddress;
+        DfuPatch patch {reinterpret_cast<const uint8_t*>(runningImageAddress), runningImageMaxSize, maxSize};
+        DfuDecompressor decompressor {maxSize};
+        enum class Encoding : uint8_t { Image, Patch, Compressed };
+        Encoding encoding = Encoding::Image;
+        // CRC32 of the image produced by the patch or decompressed
+        uint32_t imageCrc = 0;
+#ifdef DFU_VERIFY_WRITES
+        // CRC of the last page written, checked against the flash before the next one is written
+        uint16_t pageCrc = 0xFFFF;
+        uint32_t pageAddress = 0;
+        size_t pageSize = 0;
+        bool writeFailed = false;
+#endif
+
+        static constexpr size_t sectorSize = 0x1000;
+        static constexpr size_t sectorCount = maxSize / sectorSize;
+        // Sectors of the slot known to be erased (1 bit per sector), filled by PreErase() and cleared when an image is received
+        uint8_t erasedSectors[(sectorCount + 7) / 8] = {};
+        // Sectors before this one are known to be erased
+        size_t preEraseSector = 0;
+        // Between Erase() and EndUpdate(): the slot receives an image, and must not be pre-erased
+        bool updating = false;
+        SemaphoreHandle_t mutex;
+
+        bool PreEraseStep();
+        bool IsErased(size_t sector) const;
+        void MarkErased(size_t sector, size_t count);
+        bool IsBlank(uint32_t address);
+        void Write(const uint8_t* data, size_t size);
+        void Repeat(size_t distance, size_t length);
+        void WritePage();
+#ifdef DFU_VERIFY_WRITES
+        void VerifyPage();
+#endif
         void WriteMagicNumber();
+        bool IsSlotValid();
         uint16_t ComputeCrc(uint8_t const* p_data, uint32_t size, uint16_t const* p_crc);
       };
 
@@ -94,6 +155,11 @@ namespace Pinetime {
 
       uint16_t revision {0x0008};
 
+      // Connection interval requested during a transfer (1.25ms units): 7.5-15ms, several packets per interval
+      static constexpr uint16_t transferMinInterval = 6;
+      static constexpr uint16_t transferMaxInterval = 12;
+      static constexpr uint16_t transferSupervisionTimeout = 400; // 10ms units
+
       static constexpr ble_uuid128_t packetCharacteristicUuid {
         .u {.type = BLE_UUID_TYPE_128},
         .value = {0x23, 0xD1, 0xBC, 0xEA, 0x5F, 0x78, 0x23, 0x15, 0xDE, 0xEF, 0x12, 0x12, 0x32, 0x15, 0x00, 0x00}};
@@ -155,6 +221,7 @@ namespace Pinetime {
       int SendDfuRevision(os_mbuf* om) const;
       int WritePacketHandler(uint16_t connectionHandle, os_mbuf* om);
       int ControlPointHandler(uint16_t connectionHandle, os_mbuf* om);
+      void RequestFastConnection(uint16_t connectionHandle);
 
       TimerHandle_t timeoutTimer;
     };
@@ -14,6 +14,12 @@ int FSServiceCallback(uint16_t conn_handle, uint16_t attr_handle, struct ble_gat
   return fsService->OnFSServiceRequested(conn_handle, attr_handle, ctxt);
 }
 
+// Closing the file flushes it to the flash, which is too much work for the timer task: SystemTask closes it
+void SessionTimerCallback(TimerHandle_t xTimer) {
+  auto* systemTask = static_cast<Pinetime::System::SystemTask*>(pvTimerGetTimerID(xTimer));
+  systemTask->PushMessage(Pinetime::System::Messages::FileTransferSessionTimeout);
+}
+
 FSService::FSService(Pinetime::System::SystemTask& systemTask, Pinetime::Controllers::FS& fs)
   : systemTask {systemTask},
     fs {fs},
@@ -36,7 +42,11 @@ FSService::FSService(Pinetime::System::SystemTask& systemTask, Pinetime::Control
        .uuid = &fsServiceUuid.u,
        .characteristics = characteristicDefinition},
       {0},
-    } {
+    },
+    installer {fs} {
+  sessionTimer = xTimerCreate("fsSession", sessionTimeout, pdFALSE, &systemTask, SessionTimerCallback);
+  sessionMutex = xSemaphoreCreateMutex();
+  ASSERT(sessionMutex != nullptr);
 }
 
 void FSService::Init() {
@@ -55,7 +65,10 @@ int FSService::OnFSServiceRequested(uint16_t connectionHandle, uint16_t attribut
     return (res == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
   }
   if (attributeHandle == transferCharacteristicHandle) {
-    return FSCommandHandler(connectionHandle, context->om);
+    xSemaphoreTake(sessionMutex, portMAX_DELAY);
+    int res = FSCommandHandler(connectionHandle, context->om);
+    xSemaphoreGive(sessionMutex);
+    return res;
   }
   return 0;
 }
@@ -71,98 +84,63 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
   }
   lfs_dir_t dir = {0};
   lfs_info info = {0};
-  lfs_file f = {0};
   switch (command) {
     case commands::READ: {
       NRF_LOG_INFO("[FS_S] -> Read");
       auto* header = (ReadHeader*) om->om_data;
-      uint16_t plen = header->pathlen;
-      if (plen > maxpathlen) { //> counts for null term
+      if (!CopyPath(filepath, header->pathstr, header->pathlen)) {
         return -1;
       }
-      memcpy(filepath, header->pathstr, plen);
-      filepath[plen] = 0; // Copy and null terminate string
-      ReadResponse resp;
-      os_mbuf* om;
-      resp.command = commands::READ_DATA;
-      resp.status = 0x01;
-      resp.chunkoff = header->chunkoff;
-      int res = fs.Stat(filepath, &info);
-      if (res == LFS_ERR_NOENT && info.type != LFS_TYPE_DIR) {
-        resp.status = (int8_t) res;
-        resp.chunklen = 0;
-        resp.totallen = 0;
-        om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
-      } else {
-        resp.chunklen = std::min(header->chunksize, info.size); // TODO add mtu somehow
-        resp.totallen = info.size;
-        fs.FileOpen(&f, filepath, LFS_O_RDONLY);
-        fs.FileSeek(&f, header->chunkoff);
-        uint8_t fileData[resp.chunklen] = {0};
-        resp.chunklen = fs.FileRead(&f, fileData, resp.chunklen);
-        om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
-        os_mbuf_append(om, fileData, resp.chunklen);
-        fs.FileClose(&f);
+      int res = OpenSession(FSState::READ);
+      if (res < 0) {
+        NotifyReadError(connectionHandle, header->chunkoff, res);
+        break;
       }
-
-      ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
+      SendReadData(connectionHandle, header->chunkoff, header->chunksize);
       break;
     }
     case commands::READ_PACING: {
       NRF_LOG_INFO("[FS_S] -> Readpacing");
-      auto* header = (ReadHeader*) om->om_data;
-      ReadResponse resp;
-      resp.command = commands::READ_DATA;
-      resp.status = 0x01;
-      resp.chunkoff = header->chunkoff;
-      int res = fs.Stat(filepath, &info);
-      if (res == LFS_ERR_NOENT && info.type != LFS_TYPE_DIR) {
-        resp.status = (int8_t) res;
-        resp.chunklen = 0;
-        resp.totallen = 0;
-      } else {
-        resp.chunklen = std::min(header->chunksize, info.size); // TODO add mtu somehow
-        resp.totallen = info.size;
-        fs.FileOpen(&f, filepath, LFS_O_RDONLY);
-        fs.FileSeek(&f, header->chunkoff);
+      auto* header = (ReadPacing*) om->om_data;
+      int res = 0;
+      if (state != FSState::READ) {
+        // The session timed out, resume the transfer
+        res = OpenSession(FSState::READ);
       }
-      os_mbuf* om;
-      if (resp.chunklen > 0) {
-        uint8_t fileData[resp.chunklen] = {0};
-        resp.chunklen = fs.FileRead(&f, fileData, resp.chunklen);
-        om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
-        os_mbuf_append(om, fileData, resp.chunklen);
-      } else {
-        resp.chunklen = 0;
-        om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
+      if (res < 0) {
+        NotifyReadError(connectionHandle, header->chunkoff, res);
+        break;
       }
-      fs.FileClose(&f);
-      ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
+      SendReadData(connectionHandle, header->chunkoff, header->chunksize);
       break;
     }
     case commands::WRITE: {
       NRF_LOG_INFO("[FS_S] -> Write");
       auto* header = (WriteHeader*) om->om_data;
-      uint16_t plen = header->pathlen;
-      if (plen > maxpathlen) { //> counts for null term
-        return -1;             // TODO make this actually return a BLE notif
+      if (!CopyPath(filepath, header->pathstr, header->pathlen)) {
+        return -1; // TODO make this actually return a BLE notif
       }
-      memcpy(filepath, header->pathstr, plen);
-      filepath[plen] = 0; // Copy and null terminate string
       fileSize = header->totalSize;
       WriteResponse resp;
       resp.command = commands::WRITE_PACING;
       resp.offset = header->offset;
       resp.modTime = 0;
 
-      int res = fs.FileOpen(&f, filepath, LFS_O_RDWR | LFS_O_CREAT);
-      if (res == 0) {
-        fs.FileClose(&f);
-        resp.status = (res == 0) ? 0x01 : (int8_t) res;
+      const FSState writeState = WriteState();
+      int res = OpenSession(writeState);
+      resp.status = (res == 0) ? 0x01 : (int8_t) res;
+      resp.freespace = std::min(sessionFreeSpace, fileSize - header->offset);
+      if (writeState == FSState::INSTALL) {
+        // The package is always received from its start, the entries already installed are skipped
+        resp.offset = installer.Position();
+        resp.freespace = fileSize - installer.Position();
       }
-      resp.freespace = std::min(fs.getSize() - (fs.GetFSSize() * fs.getBlockSize()), fileSize - header->offset);
       auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(WriteResponse));
       ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
+      if (res == 0 && header->offset >= static_cast<uint32_t>(fileSize)) {
+        // Nothing to write
+        CloseSession();
+      }
       break;
     }
     case commands::WRITE_DATA: {
@@ -171,32 +149,55 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
       WriteResponse resp;
       resp.command = commands::WRITE_PACING;
       resp.offset = header->offset;
+      resp.modTime = 0;
       int res = 0;
+      bool done = false;
 
-      if (!(res = fs.FileOpen(&f, filepath, LFS_O_RDWR | LFS_O_CREAT))) {
-        if ((res = fs.FileSeek(&f, header->offset)) >= 0) {
-          res = fs.FileWrite(&f, header->data, header->dataSize);
+      const FSState writeState = WriteState();
+      if (state != writeState) {
+        // The session timed out, resume the transfer
+        res = OpenSession(writeState);
+      }
+      if (writeState == FSState::INSTALL) {
+        if (res >= 0) {
+          res = installer.Write(header->offset, header->data, header->dataSize);
         }
-        fs.FileClose(&f);
+        // Tells the client where to continue: after this chunk, or after the entries installed before a resume
+        resp.offset = installer.Position();
+        resp.freespace = installer.IsComplete() ? 0 : fileSize - installer.Position();
+        done = installer.IsComplete();
+      } else {
+        if (res >= 0 && (res = SessionSeek(header->offset)) >= 0) {
+          res = fs.FileWrite(&sessionFile, header->data, header->dataSize);
+          if (res >= 0) {
+            sessionPosition += res;
+          }
+        }
+        resp.freespace = std::min(sessionFreeSpace, fileSize - header->offset);
+        done = header->offset + header->dataSize >= static_cast<uint32_t>(fileSize);
       }
-      if (res < 0) {
-        resp.status = (int8_t) res;
+      resp.status = (res < 0) ? (int8_t) res : 0x01;
+      if (res < 0 || done) {
+        // Flush the file before acknowledging the last chunk
+        CloseSession();
+      } else {
+        RestartSessionTimer();
       }
-      resp.freespace = std::min(fs.getSize() - (fs.GetFSSize() * fs.getBlockSize()), fileSize - header->offset);
       auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(WriteResponse));
       ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
       break;
     }
     case commands::DELETE: {
       NRF_LOG_INFO("[FS_S] -> Delete");
+      CloseSession();
       auto* header = (DelHeader*) om->om_data;
-      uint16_t plen = header->pathlen;
-      char path[plen + 1] = {0};
-      memcpy(path, header->pathstr, plen);
-      path[plen] = 0; // Copy and null terminate string
+      char path[maxpathlen];
       DelResponse resp {};
       resp.command = commands::DELETE_STATUS;
-      int res = fs.FileDelete(path);
+      int res = CopyPath(path, header->pathstr, header->pathlen) ? fs.FileDelete(path) : LFS_ERR_NAMETOOLONG;
+      if (res == 0) {
+        fs.ForgetResource(path);
+      }
       resp.status = (res == 0) ? 0x01 : (int8_t) res;
       auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(DelResponse));
       ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
@@ -204,15 +205,13 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
     }
     case commands::MKDIR: {
       NRF_LOG_INFO("[FS_S] -> MKDir");
+      CloseSession();
       auto* header = (MKDirHeader*) om->om_data;
-      uint16_t plen = header->pathlen;
-      char path[plen + 1] = {0};
-      memcpy(path, header->pathstr, plen);
-      path[plen] = 0; // Copy and null terminate string
+      char path[maxpathlen];
       MKDirResponse resp {};
       resp.command = commands::MKDIR_STATUS;
       resp.modification_time = 0;
-      int res = fs.DirCreate(path);
+      int res = CopyPath(path, header->pathstr, header->pathlen) ? fs.DirCreate(path) : LFS_ERR_NAMETOOLONG;
       resp.status = (res == 0) ? 0x01 : (int8_t) res;
       auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(MKDirResponse));
       ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
@@ -220,11 +219,9 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
     }
     case commands::LISTDIR: {
       NRF_LOG_INFO("[FS_S] -> ListDir");
+      CloseSession();
       ListDirHeader* header = (ListDirHeader*) om->om_data;
-      uint16_t plen = header->pathlen;
-      char path[plen + 1] = {0};
-      path[plen] = 0; // Copy and null terminate string
-      memcpy(path, header->pathstr, plen);
+      char path[maxpathlen];
 
       ListDirResponse resp {};
 
@@ -233,7 +230,7 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
       resp.totalentries = 0;
       resp.entry = 0;
       resp.modification_time = 0;
-      int res = fs.DirOpen(path, &dir);
+      int res = CopyPath(path, header->pathstr, header->pathlen) ? fs.DirOpen(path, &dir) : LFS_ERR_NAMETOOLONG;
       if (res != 0) {
         resp.status = (int8_t) res;
         auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(ListDirResponse));
@@ -284,16 +281,22 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
     }
     case commands::MOVE: {
       NRF_LOG_INFO("[FS_S] -> Move");
+      CloseSession();
       MoveHeader* header = (MoveHeader*) om->om_data;
       uint16_t plen = header->OldPathLength;
       // Null Terminate string
       header->pathstr[plen] = 0;
-      char path[header->NewPathLength + 1] = {0};
-      memcpy(path, &header->pathstr[plen + 1], header->NewPathLength);
-      path[header->NewPathLength] = 0; // Copy and null terminate string
+      char path[maxpathlen];
       MoveResponse resp {};
       resp.command = commands::MOVE_STATUS;
-      int8_t res = (int8_t) fs.Rename(header->pathstr, path);
+      int8_t res = LFS_ERR_NAMETOOLONG;
+      if (CopyPath(path, &header->pathstr[plen + 1], header->NewPathLength)) {
+        res = (int8_t) fs.Rename(header->pathstr, path);
+        if (res == 0) {
+          fs.ForgetResource(header->pathstr);
+          fs.ForgetResource(path);
+        }
+      }
       resp.status = (res == 0) ? 1 : res;
       auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(MoveResponse));
       ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
@@ -306,25 +309,195 @@ int FSService::FSCommandHandler(uint16_t connectionHandle, os_mbuf* om) {
   return 0;
 }
 
-// Loads resp with file data given a valid filepath header and resp
-void FSService::prepareReadDataResp(ReadHeader* header, ReadResponse* resp) {
-  // uint16_t plen = header->pathlen;
-  resp->command = commands::READ_DATA;
-  resp->chunkoff = header->chunkoff;
-  resp->status = 0x01;
-  struct lfs_info info = {};
-  int res = fs.Stat(filepath, &info);
-  if (res == LFS_ERR_NOENT && info.type != LFS_TYPE_DIR) {
-    resp->status = 0x03;
-    resp->chunklen = 0;
-    resp->totallen = 0;
+// Copies and null terminates a path of the request. Returns false if it does not fit in maxpathlen.
+bool FSService::CopyPath(char* path, const char* source, uint16_t length) {
+  if (length >= maxpathlen) {
+    return false;
+  }
+  memcpy(path, source, length);
+  path[length] = 0;
+  return true;
+}
+
+void FSService::OnSessionTimeout() {
+  // A command is being handled, it will restart the timer if needed
+  if (xSemaphoreTake(sessionMutex, 0) != pdTRUE) {
+    return;
+  }
+  // The timer may have expired just before a command restarted it
+  if (state != FSState::IDLE && xTaskGetTickCount() - sessionLastCommand >= sessionTimeout) {
+    NRF_LOG_INFO("[FS_S] -> session timeout");
+    CloseSession();
+  }
+  xSemaphoreGive(sessionMutex);
+}
+
+// Writes to the package path install a resource package
+FSService::FSState FSService::WriteState() const {
+  return (strcmp(filepath, ResourceInstaller::packagePath) == 0) ? FSState::INSTALL : FSState::WRITE;
+}
+
+// Opens filepath for a transfer, closing the previous session if any
+int FSService::OpenSession(FSState newState) {
+  CloseSession();
+  int res = 0;
+  if (newState == FSState::INSTALL) {
+    res = installer.Begin(fileSize);
+  } else {
+    int flags = (newState == FSState::READ) ? LFS_O_RDONLY : (LFS_O_RDWR | LFS_O_CREAT);
+    res = fs.FileOpen(&sessionFile, filepath, flags);
+  }
+  if (res < 0) {
+    return res;
+  }
+  state = newState;
+  sessionPosition = 0;
+  if (newState == FSState::WRITE) {
+    // The content of the file may not match the resource index anymore
+    fs.ForgetResource(filepath);
+    // Traverses the whole file system, only done once per transfer
+    sessionFreeSpace = fs.getSize() - (fs.GetFSSize() * fs.getBlockSize());
+  }
+  // Keep the flash awake until the file is closed
+  systemTask.PushMessage(Pinetime::System::Messages::StartFileTransfer);
+  RestartSessionTimer();
+  return 0;
+}
+
+void FSService::RestartSessionTimer() {
+  sessionLastCommand = xTaskGetTickCount();
+  xTimerReset(sessionTimer, 0);
+}
+
+void FSService::CloseSession() {
+  if (state == FSState::IDLE) {
+    return;
+  }
+  xTimerStop(sessionTimer, 0);
+  if (state == FSState::INSTALL) {
+    installer.Suspend();
+  } else {
+    fs.FileClose(&sessionFile);
+  }
+  state = FSState::IDLE;
+  systemTask.PushMessage(Pinetime::System::Messages::StopFileTransfer);
+}
+
+int FSService::SessionSeek(uint32_t offset) {
+  if (offset == sessionPosition) {
+    return 0;
+  }
+  int res = fs.FileSeek(&sessionFile, offset);
+  if (res >= 0) {
+    sessionPosition = offset;
+  }
+  return res;
+}
+
+void FSService::NotifyReadError(uint16_t connectionHandle, uint32_t offset, int error) {
+  ReadResponse resp {};
+  resp.command = commands::READ_DATA;
+  resp.status = (int8_t) error;
+  resp.chunkoff = offset;
+  auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
+  ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om);
+}
+
+// Size of the chunks that fit in a notification with the MTU of the connection
+size_t FSService::ReadChunkSize(uint16_t connectionHandle) const {
+  uint16_t mtu = ble_att_mtu(connectionHandle);
+  if (mtu <= 3 + sizeof(ReadResponse)) {
+    return maxReadChunkSize;
+  }
+  return std::min<size_t>(mtu - 3 - sizeof(ReadResponse), maxReadChunkSize);
+}
+
+// Appends up to length bytes of the session file to om, reading them directly into the mbufs of the chain.
+// Returns the number of bytes read, or an error.
+int FSService::ReadIntoMbuf(os_mbuf* om, uint32_t length) {
+  os_mbuf* last = om;
+  uint32_t total = 0;
+  while (total < length) {
+    while (SLIST_NEXT(last, om_next) != nullptr) {
+      last = SLIST_NEXT(last, om_next);
+    }
+    // Fill the last mbuf, then whole new ones
+    uint16_t space = OS_MBUF_TRAILINGSPACE(last);
+    if (space == 0) {
+      space = om->om_omp->omp_databuf_len;
+    }
+    const uint16_t step = std::min<uint32_t>(space, length - total);
+    auto* data = static_cast<uint8_t*>(os_mbuf_extend(om, step));
+    if (data == nullptr) {
+      return (total > 0) ? static_cast<int>(total) : LFS_ERR_NOMEM;
+    }
+    const int read = fs.FileRead(&sessionFile, data, step);
+    if (read < step) {
+      os_mbuf_adj(om, -(step - std::max(read, 0)));
+    }
+    if (read < 0) {
+      return read;
+    }
+    total += read;
+    if (read < step) {
+      break;
+    }
+  }
+  return static_cast<int>(total);
+}
+
+// Sends [offset, offset + size) of the session file. The data is split in as many READ_DATA notifications as needed
+// to fit in the MTU and in the free mbufs, so that a client can request several chunks at once. The session ends
+// with the end of the file.
+void FSService::SendReadData(uint16_t connectionHandle, uint32_t offset, uint32_t size) {
+  ReadResponse resp {};
+  resp.command = commands::READ_DATA;
+  resp.status = 0x01;
+  const uint32_t totalSize = static_cast<uint32_t>(std::max(fs.FileSize(&sessionFile), 0));
+  resp.totallen = totalSize;
+  const uint32_t end = (offset < totalSize) ? offset + std::min(size, totalSize - offset) : offset;
+  const size_t mtuChunkSize = ReadChunkSize(connectionHandle);
+
+  int res = SessionSeek(offset);
+  do {
+    // Wait for the previous notifications to be sent rather than dropping this one
+    int freeBuffers = os_msys_num_free();
+    for (int retries = 0; freeBuffers <= reservedBuffers && retries < maxBufferRetries; retries++) {
+      vTaskDelay(pdMS_TO_TICKS(10));
+      freeBuffers = os_msys_num_free();
+    }
+
+    resp.chunkoff = offset;
+    resp.chunklen = 0;
+    auto* om = ble_hs_mbuf_from_flat(&resp, sizeof(ReadResponse));
+    if (om == nullptr) {
+      res = LFS_ERR_NOMEM;
+      break;
+    }
+    if (res >= 0 && offset < end) {
+      const uint32_t bufferSpace = (freeBuffers > reservedBuffers) ? (freeBuffers - reservedBuffers) * om->om_omp->omp_databuf_len : 0;
+      const uint32_t chunkSize = std::min<uint32_t>(std::min<uint32_t>(mtuChunkSize, bufferSpace), end - offset);
+      res = ReadIntoMbuf(om, chunkSize);
+      if (res > 0) {
+        resp.chunklen = res;
+        sessionPosition += res;
+        offset += res;
+      }
+    }
+    if (res < 0) {
+      resp.status = (int8_t) res;
+    }
+    // Update the header with the result of the read
+    os_mbuf_copyinto(om, 0, &resp, sizeof(ReadResponse));
+    if (ble_gattc_notify_custom(connectionHandle, transferCharacteristicHandle, om) != 0) {
+      res = LFS_ERR_IO;
+      break;
+    }
+  } while (res > 0 && offset < end);
+
+  if (res < 0 || offset >= totalSize) {
+    CloseSession();
   } else {
-    lfs_file f;
-    resp->chunklen = std::min(header->chunksize, info.size);
-    resp->totallen = info.size;
-    fs.FileOpen(&f, filepath, LFS_O_RDONLY);
-    fs.FileSeek(&f, header->chunkoff);
-    resp->chunklen = fs.FileRead(&f, resp->chunk, resp->chunklen);
-    fs.FileClose(&f);
+    RestartSessionTimer();
   }
 }
@@ -5,7 +5,12 @@
 #undef max
 #undef min
 
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <timers.h>
+
 #include "components/fs/FS.h"
+#include "components/fs/ResourceInstaller.h"
 
 namespace Pinetime {
   namespace System {
@@ -22,6 +27,9 @@ namespace Pinetime {
 
       int OnFSServiceRequested(uint16_t connectionHandle, uint16_t attributeHandle, ble_gatt_access_ctxt* context);
       void NotifyFSRaw(uint16_t connectionHandle);
+      // Closes the transfer file if no command was received for sessionTimeout. Called by SystemTask when the session
+      // timer expires.
+      void OnSessionTimeout();
 
     private:
       Pinetime::System::SystemTask& systemTask;
@@ -69,11 +77,26 @@ namespace Pinetime {
         IDLE = 0x00,
         READ = 0x01,
         WRITE = 0x02,
+        INSTALL = 0x03,
       };
-      FSState state;
+      FSState state = FSState::IDLE;
       char filepath[maxpathlen]; // TODO ..ugh fixed filepath len
       int fileSize;
 
+      // The file being read or written (filepath) stays open between the chunks of a transfer, so that littlefs
+      // does not look for the position of each chunk from the beginning of the file. The session ends with the
+      // last chunk, with any other command, or after sessionTimeout without any command.
+      static constexpr TickType_t sessionTimeout = pdMS_TO_TICKS(10000);
+      lfs_file_t sessionFile;
+      uint32_t sessionPosition = 0;
+      size_t sessionFreeSpace = 0;
+      TimerHandle_t sessionTimer;
+      TickType_t sessionLastCommand = 0;
+      // Serializes the commands (BLE host task) and the session timeout (SystemTask)
+      SemaphoreHandle_t sessionMutex;
+      // A resource package written to ResourceInstaller::packagePath is installed on the fly instead of being stored
+      ResourceInstaller installer;
+
       using ReadHeader = struct __attribute__((packed)) {
         commands command;
         uint8_t padding;
@@ -190,8 +213,24 @@ namespace Pinetime {
         uint8_t status;
       };
 
+      // Largest chunk of file sent in a single READ_DATA notification, with the preferred ATT MTU
+      static constexpr size_t maxReadChunkSize = MYNEWT_VAL(BLE_ATT_PREFERRED_MTU) - 3 - sizeof(ReadResponse);
+      // Number of mbufs left to the rest of the BLE stack when sending READ_DATA notifications, and how long
+      // (10ms steps) to wait for the previous notifications to free some buffers
+      static constexpr int reservedBuffers = 3;
+      static constexpr int maxBufferRetries = 100;
+
       int FSCommandHandler(uint16_t connectionHandle, os_mbuf* om);
-      void prepareReadDataResp(ReadHeader* header, ReadResponse* resp);
+      static bool CopyPath(char* path, const char* source, uint16_t length);
+      FSState WriteState() const;
+      int OpenSession(FSState newState);
+      void CloseSession();
+      void RestartSessionTimer();
+      int SessionSeek(uint32_t offset);
+      size_t ReadChunkSize(uint16_t connectionHandle) const;
+      int ReadIntoMbuf(os_mbuf* om, uint32_t length);
+      void SendReadData(uint16_t connectionHandle, uint32_t offset, uint32_t size);
+      void NotifyReadError(uint16_t connectionHandle, uint32_t offset, int error);
     };
   }
 }
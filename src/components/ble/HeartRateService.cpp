@@ -56,12 +56,25 @@ int HeartRateService::OnHeartRateRequested(uint16_t attributeHandle, ble_gatt_ac
   return 0;
 }
 
-void HeartRateService::OnNewHeartRateValue(uint8_t heartRateValue) {
+void HeartRateService::OnNewHeartRateValue(uint8_t heartRateValue, const uint16_t* rrIntervals, size_t nbRrIntervals) {
   if (!heartRateMeasurementNotificationEnable)
     return;
 
-  uint8_t buffer[2] = {0, heartRateValue}; // [0] = flags, [1] = hr value
-  auto* om = ble_hs_mbuf_from_flat(buffer, 2);
+  // [0] = flags, [1] = hr value, then the RR intervals (uint16, 1/1024s)
+  uint8_t buffer[2 + 2 * maxRrIntervals] = {0, heartRateValue};
+  size_t length = 2;
+  if (nbRrIntervals > maxRrIntervals) {
+    nbRrIntervals = maxRrIntervals;
+  }
+  if (nbRrIntervals > 0) {
+    buffer[0] |= rrIntervalsPresent;
+  }
+  for (size_t i = 0; i < nbRrIntervals; i++) {
+    uint16_t interval = static_cast<uint16_t>((static_cast<uint32_t>(rrIntervals[i]) * 1024 + 500) / 1000);
+    buffer[length++] = interval & 0xff;
+    buffer[length++] = interval >> 8;
+  }
+  auto* om = ble_hs_mbuf_from_flat(buffer, length);
 
   uint16_t connectionHandle = nimble.connHandle();
 
@@ -5,6 +5,8 @@
 #undef max
 #undef min
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 
 namespace Pinetime {
   namespace Controllers {
@@ -16,7 +18,8 @@ namespace Pinetime {
       HeartRateService(NimbleController& nimble, Controllers::HeartRateController& heartRateController);
       void Init();
       int OnHeartRateRequested(uint16_t attributeHandle, ble_gatt_access_ctxt* context);
-      void OnNewHeartRateValue(uint8_t hearRateValue);
+      // rrIntervals in ms
+      void OnNewHeartRateValue(uint8_t hearRateValue, const uint16_t* rrIntervals, size_t nbRrIntervals);
 
       void SubscribeNotification(uint16_t attributeHandle);
       void UnsubscribeNotification(uint16_t attributeHandle);
@@ -28,6 +31,10 @@ namespace Pinetime {
       NimbleController& nimble;
       Controllers::HeartRateController& heartRateController;
       static constexpr uint16_t heartRateMeasurementId {0x2A37};
+      // Flags of the heart rate measurement
+      static constexpr uint8_t rrIntervalsPresent = 0x10;
+      // An ATT notification of the default MTU holds 20 bytes: flags, heart rate and up to 9 RR intervals
+      static constexpr size_t maxRrIntervals = 9;
 
       static constexpr ble_uuid16_t heartRateMeasurementUuid {.u {.type = BLE_UUID_TYPE_16}, .value = heartRateMeasurementId};
 
@@ -71,6 +71,14 @@ namespace Pinetime {
         return weatherService;
       };
 
+      Pinetime::Controllers::DfuService& dfu() {
+        return dfuService;
+      };
+
+      Pinetime::Controllers::FSService& fs() {
+        return fsService;
+      };
+
       uint16_t connHandle();
       void NotifyBatteryLevel(uint8_t level);
 
@@ -1,10 +1,37 @@
 #include "components/fs/FS.h"
+#include <algorithm>
 #include <cstring>
 #include <littlefs/lfs.h>
 #include <lvgl/lvgl.h>
+#include <libraries/log/nrf_log.h>
+#include "utility/Crc32.h"
 
 using namespace Pinetime::Controllers;
 
+namespace {
+  // Holds the mutex of the file system for the current scope. Recursive, as the resource index uses the file API.
+  class Lock {
+  public:
+    explicit Lock(SemaphoreHandle_t mutex) : mutex {mutex} {
+      if (mutex != nullptr) {
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+      }
+    }
+
+    ~Lock() {
+      if (mutex != nullptr) {
+        xSemaphoreGiveRecursive(mutex);
+      }
+    }
+
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+  private:
+    SemaphoreHandle_t mutex;
+  };
+}
+
 FS::FS(Pinetime::Drivers::SpiNorFlash& driver)
   : flashDriver {driver},
     lfsConfig {
@@ -14,14 +41,14 @@ FS::FS(Pinetime::Drivers::SpiNorFlash& driver)
       .erase = SectorErase,
       .sync = SectorSync,
 
-      .read_size = 16,
-      .prog_size = 8,
+      .read_size = readSize,
+      .prog_size = progSize,
       .block_size = blockSize,
       .block_count = size / blockSize,
       .block_cycles = 1000u,
 
-      .cache_size = 16,
-      .lookahead_size = 16,
+      .cache_size = cacheSize,
+      .lookahead_size = lookaheadSize,
 
       .name_max = 50,
       .attr_max = 50,
@@ -29,6 +56,10 @@ FS::FS(Pinetime::Drivers::SpiNorFlash& driver)
 }
 
 void FS::Init() {
+  if (mutex == nullptr) {
+    mutex = xSemaphoreCreateRecursiveMutex();
+  }
+  Lock lock {mutex};
 
   // try mount
   int err = lfs_mount(&lfs, &lfsConfig);
@@ -43,69 +74,309 @@ void FS::Init() {
     }
   }
 
-#ifndef PINETIME_IS_RECOVERY
+  // Only loads the index, the recovery firmware can install resources too
   VerifyResource();
-#endif
 }
 
 void FS::VerifyResource() {
-  // validate the resource metadata
-  resourcesValid = true;
+  Lock lock {mutex};
+  // Load the resource index, the content of the resources is verified later by VerifyNextResource()
+  lfs_file_t file;
+  if (FileOpen(&file, resourceIndexPath, LFS_O_RDONLY) != LFS_ERR_OK) {
+    // No resources installed from a package
+    return;
+  }
+  ResourceIndexHeader header;
+  const int read = FileRead(&file, reinterpret_cast<uint8_t*>(&header), sizeof(header));
+  if (read != static_cast<int>(sizeof(header)) || header.version != resourceIndexVersion || header.recordSize != sizeof(ResourceRecord)) {
+    // Unknown format, the index is rebuilt by the next package install
+    FileClose(&file);
+    FileDelete(resourceIndexPath);
+    return;
+  }
+  ResourceRecord record;
+  for (uint8_t i = 0; i < maxResources; i++) {
+    if (FileRead(&file, reinterpret_cast<uint8_t*>(&record), sizeof(record)) != static_cast<int>(sizeof(record))) {
+      break;
+    }
+    if (record.used != 0) {
+      record.path[maxResourcePathLength] = 0;
+      resources[i] = {Utility::Crc32(reinterpret_cast<const uint8_t*>(record.path), strlen(record.path)), ResourceState::Unverified};
+    }
+  }
+  FileClose(&file);
+}
+
+bool FS::VerifyNextResource() {
+  {
+    Lock lock {mutex};
+    if (verifiedIndex == maxResources || resources[verifiedIndex].state != ResourceState::Unverified) {
+      // Start with the next resource
+      verifiedIndex = 0;
+      while (verifiedIndex < maxResources && resources[verifiedIndex].state != ResourceState::Unverified) {
+        verifiedIndex++;
+      }
+      if (verifiedIndex == maxResources) {
+        return false;
+      }
+      verifiedOffset = 0;
+      verifiedCrc = 0;
+      if (ReadResourceRecord(verifiedIndex, verifiedRecord) != LFS_ERR_OK) {
+        resources[verifiedIndex].state = ResourceState::Invalid;
+        NRF_LOG_WARNING("[FS] Resource %u is not in the index", verifiedIndex);
+        return true;
+      }
+    }
+  }
+
+  // The lock is not held for the whole step: DisplayApp and the FS service only wait for one read at a time
+  uint32_t crc = verifiedCrc;
+  const int read = UpdateResourceCrc(verifiedRecord.path, verifiedOffset, verifyStepSize, crc);
+
+  Lock lock {mutex};
+  // The resource may have been checked by IsResourceAvailable(), installed again or removed in the meantime, its state
+  // is then already up to date
+  if (resources[verifiedIndex].state != ResourceState::Unverified) {
+    return true;
+  }
+  if (read == static_cast<int>(verifyStepSize) && verifiedOffset + read <= verifiedRecord.size) {
+    verifiedOffset += read;
+    verifiedCrc = crc;
+    return true;
+  }
+  const bool valid = read >= 0 && verifiedOffset + read == verifiedRecord.size && crc == verifiedRecord.crc;
+  resources[verifiedIndex].state = valid ? ResourceState::Valid : ResourceState::Invalid;
+  if (!valid) {
+    NRF_LOG_WARNING("[FS] Resource %u does not match the index", verifiedIndex);
+  }
+  return true;
+}
+
+bool FS::IsResourceAvailable(const char* path) {
+  ResourceRecord record;
+  uint8_t index;
+  {
+    Lock lock {mutex};
+    Resource* resource = FindResource(path);
+    if (resource == nullptr) {
+      lfs_file_t file;
+      if (FileOpen(&file, path, LFS_O_RDONLY) < 0) {
+        return false;
+      }
+      FileClose(&file);
+      return true;
+    }
+    if (resource->state != ResourceState::Unverified) {
+      return resource->state == ResourceState::Valid;
+    }
+    // Not verified in the background yet: the resource is checked now, before it is used
+    index = resource - resources;
+    if (ReadResourceRecord(index, record) != LFS_ERR_OK) {
+      resource->state = ResourceState::Invalid;
+      return false;
+    }
+  }
+
+  const bool valid = CheckResource(record);
+
+  Lock lock {mutex};
+  if (resources[index].state == ResourceState::Unverified) {
+    resources[index].state = valid ? ResourceState::Valid : ResourceState::Invalid;
+    if (!valid) {
+      NRF_LOG_WARNING("[FS] Resource %u does not match the index", index);
+    }
+  }
+  return resources[index].state == ResourceState::Valid;
+}
+
+void FS::AddResource(const char* path, uint32_t size, uint32_t crc, uint32_t version) {
+  Lock lock {mutex};
+  const size_t length = strlen(path);
+  if (length > maxResourcePathLength) {
+    return;
+  }
+  Resource* resource = FindResource(path);
+  if (resource == nullptr) {
+    for (auto& candidate : resources) {
+      if (candidate.state == ResourceState::None) {
+        resource = &candidate;
+        break;
+      }
+    }
+  }
+  if (resource == nullptr) {
+    NRF_LOG_WARNING("[FS] Resource index full");
+    return;
+  }
+
+  ResourceRecord record {};
+  record.used = 1;
+  record.size = size;
+  record.crc = crc;
+  record.version = version;
+  memcpy(record.path, path, length);
+  if (WriteResourceRecord(resource - resources, record) == LFS_ERR_OK) {
+    *resource = {Utility::Crc32(reinterpret_cast<const uint8_t*>(path), length), ResourceState::Valid};
+  }
+}
+
+void FS::ForgetResource(const char* path) {
+  Lock lock {mutex};
+  Resource* resource = FindResource(path);
+  if (resource == nullptr) {
+    return;
+  }
+  resource->state = ResourceState::None;
+  ResourceRecord record {};
+  WriteResourceRecord(resource - resources, record);
+}
+
+FS::Resource* FS::FindResource(const char* path) {
+  const uint32_t hash = Utility::Crc32(reinterpret_cast<const uint8_t*>(path), strlen(path));
+  for (auto& resource : resources) {
+    if (resource.state != ResourceState::None && resource.pathHash == hash) {
+      return &resource;
+    }
+  }
+  return nullptr;
+}
+
+int FS::ReadResourceRecord(uint8_t index, ResourceRecord& record) {
+  lfs_file_t file;
+  int res = FileOpen(&file, resourceIndexPath, LFS_O_RDONLY);
+  if (res < 0) {
+    return res;
+  }
+  res = FileSeek(&file, sizeof(ResourceIndexHeader) + index * sizeof(ResourceRecord));
+  if (res >= 0) {
+    res = FileRead(&file, reinterpret_cast<uint8_t*>(&record), sizeof(record));
+    res = (res == static_cast<int>(sizeof(record))) ? LFS_ERR_OK : LFS_ERR_CORRUPT;
+  }
+  FileClose(&file);
+  record.path[maxResourcePathLength] = 0;
+  return res;
+}
+
+int FS::WriteResourceRecord(uint8_t index, const ResourceRecord& record) {
+  lfs_file_t file;
+  int res = FileOpen(&file, resourceIndexPath, LFS_O_RDWR | LFS_O_CREAT);
+  if (res < 0) {
+    return res;
+  }
+  if (FileSize(&file) < static_cast<int>(sizeof(ResourceIndexHeader))) {
+    const ResourceIndexHeader header {resourceIndexVersion, sizeof(ResourceRecord), 0};
+    FileWrite(&file, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+  }
+  // Free records are reused before new ones are appended, so the index never has holes
+  res = FileSeek(&file, sizeof(ResourceIndexHeader) + index * sizeof(ResourceRecord));
+  if (res >= 0) {
+    res = FileWrite(&file, reinterpret_cast<const uint8_t*>(&record), sizeof(record));
+    res = (res == static_cast<int>(sizeof(record))) ? LFS_ERR_OK : LFS_ERR_NOSPC;
+  }
+  const int closeResult = FileClose(&file);
+  return (res < 0) ? res : closeResult;
+}
+
+bool FS::CheckResource(const ResourceRecord& record) {
+  uint32_t crc = 0;
+  // One byte more than the size in the index, to tell a longer file
+  const int read = UpdateResourceCrc(record.path, 0, record.size + 1, crc);
+  return read == static_cast<int>(record.size) && crc == record.crc;
+}
+
+int FS::UpdateResourceCrc(const char* path, uint32_t offset, uint32_t maxSize, uint32_t& crc) {
+  lfs_file_t file;
+  int res = FileOpen(&file, path, LFS_O_RDONLY);
+  if (res < 0) {
+    return res;
+  }
+  res = FileSeek(&file, offset);
+  uint8_t buffer[64];
+  uint32_t size = 0;
+  while (res >= 0 && size < maxSize) {
+    res = FileRead(&file, buffer, std::min<uint32_t>(sizeof(buffer), maxSize - size));
+    if (res <= 0) {
+      break;
+    }
+    crc = Utility::Crc32(buffer, res, crc);
+    size += res;
+  }
+  FileClose(&file);
+  return res < 0 ? res : static_cast<int>(size);
 }
 
 int FS::FileOpen(lfs_file_t* file_p, const char* fileName, const int flags) {
+  Lock lock {mutex};
   return lfs_file_open(&lfs, file_p, fileName, flags);
 }
 
 int FS::FileClose(lfs_file_t* file_p) {
+  Lock lock {mutex};
   return lfs_file_close(&lfs, file_p);
 }
 
 int FS::FileRead(lfs_file_t* file_p, uint8_t* buff, uint32_t size) {
+  Lock lock {mutex};
   return lfs_file_read(&lfs, file_p, buff, size);
 }
 
 int FS::FileWrite(lfs_file_t* file_p, const uint8_t* buff, uint32_t size) {
+  Lock lock {mutex};
   return lfs_file_write(&lfs, file_p, buff, size);
 }
 
 int FS::FileSeek(lfs_file_t* file_p, uint32_t pos) {
+  Lock lock {mutex};
   return lfs_file_seek(&lfs, file_p, pos, LFS_SEEK_SET);
 }
 
+int FS::FileSize(lfs_file_t* file_p) {
+  Lock lock {mutex};
+  return lfs_file_size(&lfs, file_p);
+}
+
 int FS::FileDelete(const char* fileName) {
+  Lock lock {mutex};
   return lfs_remove(&lfs, fileName);
 }
 
 int FS::DirOpen(const char* path, lfs_dir_t* lfs_dir) {
+  Lock lock {mutex};
   return lfs_dir_open(&lfs, lfs_dir, path);
 }
 
 int FS::DirClose(lfs_dir_t* lfs_dir) {
+  Lock lock {mutex};
   return lfs_dir_close(&lfs, lfs_dir);
 }
 
 int FS::DirRead(lfs_dir_t* dir, lfs_info* info) {
+  Lock lock {mutex};
   return lfs_dir_read(&lfs, dir, info);
 }
 
 int FS::DirRewind(lfs_dir_t* dir) {
+  Lock lock {mutex};
   return lfs_dir_rewind(&lfs, dir);
 }
 
 int FS::DirCreate(const char* path) {
+  Lock lock {mutex};
   return lfs_mkdir(&lfs, path);
 }
 
 int FS::Rename(const char* oldPath, const char* newPath) {
+  Lock lock {mutex};
   return lfs_rename(&lfs, oldPath, newPath);
 }
 
 int FS::Stat(const char* path, lfs_info* info) {
+  Lock lock {mutex};
   return lfs_stat(&lfs, path, info);
 }
 
 lfs_ssize_t FS::GetFSSize() {
+  Lock lock {mutex};
   return lfs_fs_size(&lfs);
 }
 
@@ -114,27 +385,38 @@ lfs_ssize_t FS::GetFSSize() {
     ----------- Interface between littlefs and SpiNorFlash -----------
 
 */
-int FS::SectorSync(const struct lfs_config* /*c*/) {
-  return 0;
+// The pages are programmed asynchronously by SectorProg(): a failure is reported by the next operation, as a bad block
+// (LFS_ERR_CORRUPT) that littlefs relocates
+int FS::SectorSync(const struct lfs_config* c) {
+  Pinetime::Controllers::FS& lfs = *(static_cast<Pinetime::Controllers::FS*>(c->context));
+  return lfs.flashDriver.ProgramFailed() ? LFS_ERR_CORRUPT : LFS_ERR_OK;
 }
 
 int FS::SectorErase(const struct lfs_config* c, lfs_block_t block) {
   Pinetime::Controllers::FS& lfs = *(static_cast<Pinetime::Controllers::FS*>(c->context));
+  if (lfs.flashDriver.ProgramFailed()) {
+    return LFS_ERR_CORRUPT;
+  }
   const size_t address = startAddress + (block * blockSize);
   lfs.flashDriver.SectorErase(address);
-  return lfs.flashDriver.EraseFailed() ? -1 : 0;
+  return lfs.flashDriver.EraseFailed() ? LFS_ERR_CORRUPT : LFS_ERR_OK;
 }
 
 int FS::SectorProg(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
   Pinetime::Controllers::FS& lfs = *(static_cast<Pinetime::Controllers::FS*>(c->context));
+  // Waits for the previous page, usually of the same block: littlefs programs the blocks in sequence
+  if (lfs.flashDriver.ProgramFailed()) {
+    return LFS_ERR_CORRUPT;
+  }
   const size_t address = startAddress + (block * blockSize) + off;
-  lfs.flashDriver.Write(address, (uint8_t*) buffer, size);
-  return lfs.flashDriver.ProgramFailed() ? -1 : 0;
+  // Returns while the flash programs the last page
+  lfs.flashDriver.WriteAsync(address, static_cast<const uint8_t*>(buffer), size);
+  return LFS_ERR_OK;
 }
 
 int FS::SectorRead(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
   Pinetime::Controllers::FS& lfs = *(static_cast<Pinetime::Controllers::FS*>(c->context));
   const size_t address = startAddress + (block * blockSize) + off;
   lfs.flashDriver.Read(address, static_cast<uint8_t*>(buffer), size);
-  return 0;
+  return LFS_ERR_OK;
 }
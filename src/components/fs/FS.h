@@ -1,11 +1,19 @@
 #pragma once
 
 #include <cstdint>
+#include <FreeRTOS.h>
+#include <semphr.h>
 #include "drivers/SpiNorFlash.h"
 #include <littlefs/lfs.h>
 
+#if !defined(FS_PROFILE_COMPACT) && !defined(FS_PROFILE_BALANCED) && !defined(FS_PROFILE_THROUGHPUT)
+  #define FS_PROFILE_COMPACT
+#endif
+
 namespace Pinetime {
   namespace Controllers {
+    // The file system is shared by several tasks (DisplayApp, NimBLE, SystemTask...): every method takes a recursive
+    // mutex, so each call to littlefs, and each access to the resource index, runs without interruption by another task.
     class FS {
     public:
       FS(Pinetime::Drivers::SpiNorFlash&);
@@ -17,6 +25,7 @@ namespace Pinetime {
       int FileRead(lfs_file_t* file_p, uint8_t* buff, uint32_t size);
       int FileWrite(lfs_file_t* file_p, const uint8_t* buff, uint32_t size);
       int FileSeek(lfs_file_t* file_p, uint32_t pos);
+      int FileSize(lfs_file_t* file_p);
 
       int FileDelete(const char* fileName);
 
@@ -29,7 +38,49 @@ namespace Pinetime {
       lfs_ssize_t GetFSSize();
       int Rename(const char* oldPath, const char* newPath);
       int Stat(const char* path, lfs_info* info);
+
+      // Index of the resources installed from a resource package (/.system/resources.idx): path, size, CRC and
+      // version (CRC of the package) of each resource. The index is loaded in RAM at boot, and the content of the
+      // resources is checked against it later, a few KB at a time, by VerifyNextResource().
       void VerifyResource();
+      // Continues the CRC of the resources that were not verified yet, verifyStepSize bytes per call. Returns false when
+      // all of them are verified.
+      bool VerifyNextResource();
+      // Returns false if the resource is missing, or if its content does not match the index.
+      // Resources in the index are looked up in RAM, and verified first if VerifyNextResource() did not get to them yet.
+      // The others (installed without a package) are opened.
+      bool IsResourceAvailable(const char* path);
+      // Records a resource installed from a package, whose CRC was just checked
+      void AddResource(const char* path, uint32_t size, uint32_t crc, uint32_t version);
+      // Removes a resource from the index, once it is deleted or modified by other means than a package
+      void ForgetResource(const char* path);
+
+      static constexpr uint8_t maxResources = 24;
+      static constexpr uint16_t maxResourcePathLength = 64;
+
+      // Buffers of littlefs, selected at build time (FS_PROFILE, see doc/FsBenchmark.md).
+      // littlefs allocates a read and a program cache when mounting the file system, 1 more cache per open file,
+      // and the lookahead bitmap of the block allocator (1 bit per block).
+#if defined(FS_PROFILE_COMPACT)
+      // Smallest footprint: each read of metadata is a separate SPI transaction of 16 bytes, and the allocator
+      // scans the file system again every 128 blocks
+      static constexpr lfs_size_t cacheSize = 16;
+      static constexpr lfs_size_t lookaheadSize = 16;
+#elif defined(FS_PROFILE_BALANCED)
+      // One flash page per cache, and a lookahead bitmap that covers all the blocks
+      static constexpr lfs_size_t cacheSize = 256;
+      static constexpr lfs_size_t lookaheadSize = 112;
+#elif defined(FS_PROFILE_THROUGHPUT)
+      // Fewer transactions for large files, at the cost of 1KB of RAM per open file
+      static constexpr lfs_size_t cacheSize = 1024;
+      static constexpr lfs_size_t lookaheadSize = 112;
+#else
+  #error "Unsupported FS_PROFILE"
+#endif
+      // Smallest read and program units: the flash can read and program any number of bytes, a larger unit would
+      // only pad the small writes of metadata
+      static constexpr lfs_size_t readSize = 16;
+      static constexpr lfs_size_t progSize = 8;
 
       static size_t getSize() {
         return size;
@@ -68,7 +119,51 @@ namespace Pinetime {
       static constexpr size_t size = 0x34C000;
       static constexpr size_t blockSize = 4096;
 
-      bool resourcesValid = false;
+      static_assert(blockSize % cacheSize == 0 && cacheSize % readSize == 0 && cacheSize % progSize == 0,
+                    "The cache must be a multiple of the read and program sizes, and a factor of the block size");
+      static_assert(lookaheadSize % 8 == 0, "littlefs requires a multiple of 8 bytes");
+
+      static constexpr const char* resourceIndexPath = "/.system/resources.idx";
+      static constexpr uint8_t resourceIndexVersion = 1;
+
+      enum class ResourceState : uint8_t { None, Unverified, Valid, Invalid };
+
+      struct __attribute__((packed)) ResourceIndexHeader {
+        uint8_t version;
+        uint8_t recordSize;
+        uint16_t reserved;
+      };
+
+      struct __attribute__((packed)) ResourceRecord {
+        uint8_t used;
+        uint8_t reserved[3];
+        uint32_t size;
+        uint32_t crc;
+        uint32_t version;
+        char path[maxResourcePathLength + 1];
+      };
+
+      // Resource i of the table is record i of the index
+      struct Resource {
+        uint32_t pathHash;
+        ResourceState state;
+      };
+
+      Resource resources[maxResources] = {};
+      // Resource verified by VerifyNextResource() (maxResources when none), the CRC of its first verifiedOffset bytes
+      static constexpr uint32_t verifyStepSize = 2048;
+      uint8_t verifiedIndex = maxResources;
+      ResourceRecord verifiedRecord;
+      uint32_t verifiedOffset = 0;
+      uint32_t verifiedCrc = 0;
+      SemaphoreHandle_t mutex = nullptr;
+
+      Resource* FindResource(const char* path);
+      int ReadResourceRecord(uint8_t index, ResourceRecord& record);
+      int WriteResourceRecord(uint8_t index, const ResourceRecord& record);
+      bool CheckResource(const ResourceRecord& record);
+      // Adds up to maxSize bytes of the file, from offset, to crc. Returns the number of bytes read or an error.
+      int UpdateResourceCrc(const char* path, uint32_t offset, uint32_t maxSize, uint32_t& crc);
       const struct lfs_config lfsConfig;
 
       lfs_t lfs;
@@ -0,0 +1,256 @@
+#include "components/fs/ResourceInstaller.h"
+
+#include <algorithm>
+#include <cstring>
+#include <libraries/log/nrf_log.h>
+
+#include "utility/Crc32.h"
+
+using namespace Pinetime::Controllers;
+
+ResourceInstaller::ResourceInstaller(Controllers::FS& fs) : fs {fs} {
+}
+
+int ResourceInstaller::Begin(uint32_t totalSize) {
+  Suspend();
+  this->totalSize = totalSize;
+  phase = Phase::Header;
+  filled = 0;
+  position = 0;
+  entryStart = 0;
+  fs.DirCreate("/.system");
+  return 0;
+}
+
+int ResourceInstaller::Write(uint32_t offset, const uint8_t* data, uint32_t size) {
+  if (phase == Phase::Idle || phase == Phase::Failed || offset > position) {
+    return LFS_ERR_INVAL;
+  }
+  while (size > 0 && phase != Phase::Done) {
+    // Skip the data that was already processed: chunks sent again, or the entries installed before a resume
+    if (offset < position) {
+      const uint32_t skip = std::min(position - offset, size);
+      data += skip;
+      size -= skip;
+      offset += skip;
+      continue;
+    }
+
+    const uint32_t available = size;
+    int res = 0;
+    switch (phase) {
+      case Phase::Header:
+        if (Fill(&header, sizeof(Header), data, size)) {
+          res = ProcessHeader();
+        }
+        break;
+      case Phase::EntryHeader:
+        if (Fill(&entry, sizeof(EntryHeader), data, size)) {
+          res = ProcessEntryHeader();
+        }
+        break;
+      case Phase::EntryPath:
+        if (Fill(path, entry.pathLength, data, size)) {
+          res = ProcessEntryPath();
+        }
+        break;
+      case Phase::EntryData:
+        res = ProcessEntryData(data, size);
+        break;
+      default:
+        break;
+    }
+    offset += available - size;
+    if (res < 0) {
+      return Fail(res);
+    }
+  }
+  return 0;
+}
+
+void ResourceInstaller::Suspend() {
+  if (fileOpen) {
+    fs.FileClose(&file);
+    fileOpen = false;
+  }
+  if (phase == Phase::EntryData) {
+    fs.FileDelete(temporaryPath);
+  }
+  phase = Phase::Idle;
+}
+
+// Copies the data to destination until `length` bytes were received. Returns true once they are all there.
+bool ResourceInstaller::Fill(void* destination, size_t length, const uint8_t*& data, uint32_t& size) {
+  const size_t count = std::min<size_t>(length - filled, size);
+  memcpy(static_cast<uint8_t*>(destination) + filled, data, count);
+  filled += count;
+  data += count;
+  size -= count;
+  position += count;
+  if (filled < length) {
+    return false;
+  }
+  filled = 0;
+  return true;
+}
+
+int ResourceInstaller::ProcessHeader() {
+  if (memcmp(header.magic, "ITRP", sizeof(header.magic)) != 0 || header.version != formatVersion || header.size != totalSize) {
+    NRF_LOG_WARNING("[ResourceInstaller] Invalid package header");
+    return LFS_ERR_INVAL;
+  }
+  entryIndex = 0;
+
+  // Skip the entries installed by a previous attempt to install the same package
+  Progress progress;
+  if (fs.FileOpen(&file, progressPath, LFS_O_RDONLY) == LFS_ERR_OK) {
+    const int read = fs.FileRead(&file, reinterpret_cast<uint8_t*>(&progress), sizeof(progress));
+    fs.FileClose(&file);
+    if (read == static_cast<int>(sizeof(progress)) && progress.packageSize == header.size && progress.packageCrc == header.crc &&
+        progress.entry <= header.entryCount && progress.offset >= sizeof(Header) && progress.offset <= header.size) {
+      NRF_LOG_INFO("[ResourceInstaller] Resuming at entry %u", progress.entry);
+      position = progress.offset;
+      entryIndex = progress.entry;
+    }
+  }
+
+  entryStart = position;
+  phase = Phase::EntryHeader;
+  if (entryIndex == header.entryCount) {
+    return Finish();
+  }
+  return 0;
+}
+
+int ResourceInstaller::ProcessEntryHeader() {
+  if (entry.type != EntryType::File && entry.type != EntryType::Delete) {
+    return LFS_ERR_INVAL;
+  }
+  if (entry.pathLength > maxPathLength) {
+    return LFS_ERR_NAMETOOLONG;
+  }
+  // Each subtraction is checked before the next one: a size close to UINT32_MAX must not wrap around
+  if (position > header.size || entry.pathLength > header.size - position || entry.size > header.size - position - entry.pathLength) {
+    return LFS_ERR_CORRUPT;
+  }
+  // The data of a file to delete would be parsed as the header of the next entry
+  if (entry.type == EntryType::Delete && entry.size != 0) {
+    return LFS_ERR_CORRUPT;
+  }
+  phase = Phase::EntryPath;
+  return 0;
+}
+
+int ResourceInstaller::ProcessEntryPath() {
+  path[entry.pathLength] = 0;
+  if (path[0] != '/') {
+    return LFS_ERR_INVAL;
+  }
+
+  if (entry.type == EntryType::Delete) {
+    // Obsolete file, that may never have been installed
+    const int res = fs.FileDelete(path);
+    if (res < 0 && res != LFS_ERR_NOENT) {
+      NRF_LOG_WARNING("[ResourceInstaller] Failed to delete %s (%d)", path, res);
+    }
+    fs.ForgetResource(path);
+    return FinishEntry();
+  }
+
+  const int res = fs.FileOpen(&file, temporaryPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+  if (res < 0) {
+    return res;
+  }
+  fileOpen = true;
+  remaining = entry.size;
+  crc = 0;
+  phase = Phase::EntryData;
+  if (remaining == 0) {
+    return FinishFile();
+  }
+  return 0;
+}
+
+int ResourceInstaller::ProcessEntryData(const uint8_t*& data, uint32_t& size) {
+  const uint32_t count = std::min(remaining, size);
+  const int written = fs.FileWrite(&file, data, count);
+  if (written != static_cast<int>(count)) {
+    return (written < 0) ? written : LFS_ERR_NOSPC;
+  }
+  crc = Utility::Crc32(data, count, crc);
+  data += count;
+  size -= count;
+  position += count;
+  remaining -= count;
+  if (remaining == 0) {
+    return FinishFile();
+  }
+  return 0;
+}
+
+// Replaces the previous version of the resource with the temporary file, if its CRC matches
+int ResourceInstaller::FinishFile() {
+  fileOpen = false;
+  int res = fs.FileClose(&file);
+  if (res < 0) {
+    return res;
+  }
+  if (crc != entry.crc) {
+    NRF_LOG_WARNING("[ResourceInstaller] CRC mismatch for %s", path);
+    return LFS_ERR_CORRUPT;
+  }
+  CreateParentDirectories();
+  res = fs.Rename(temporaryPath, path);
+  if (res < 0) {
+    return res;
+  }
+  fs.AddResource(path, entry.size, entry.crc, header.crc);
+  return FinishEntry();
+}
+
+int ResourceInstaller::FinishEntry() {
+  entryIndex++;
+  entryStart = position;
+  phase = Phase::EntryHeader;
+  if (entryIndex == header.entryCount) {
+    return Finish();
+  }
+  SaveProgress();
+  return 0;
+}
+
+int ResourceInstaller::Finish() {
+  if (position != header.size) {
+    return LFS_ERR_CORRUPT;
+  }
+  fs.FileDelete(progressPath);
+  phase = Phase::Done;
+  NRF_LOG_INFO("[ResourceInstaller] Installed %u entries", header.entryCount);
+  return 0;
+}
+
+int ResourceInstaller::Fail(int error) {
+  Suspend();
+  phase = Phase::Failed;
+  // The client can send the package again from the start, the installed entries are skipped
+  position = 0;
+  NRF_LOG_WARNING("[ResourceInstaller] Install failed at entry %u (%d)", entryIndex, error);
+  return error;
+}
+
+void ResourceInstaller::CreateParentDirectories() {
+  for (char* separator = strchr(path + 1, '/'); separator != nullptr; separator = strchr(separator + 1, '/')) {
+    *separator = 0;
+    fs.DirCreate(path); // LFS_ERR_EXIST if it was already there
+    *separator = '/';
+  }
+}
+
+void ResourceInstaller::SaveProgress() {
+  Progress progress {header.size, header.crc, entryStart, entryIndex, 0};
+  if (fs.FileOpen(&file, progressPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+    return;
+  }
+  fs.FileWrite(&file, reinterpret_cast<const uint8_t*>(&progress), sizeof(progress));
+  fs.FileClose(&file);
+}
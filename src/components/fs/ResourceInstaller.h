@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "components/fs/FS.h"
+
+namespace Pinetime {
+  namespace Controllers {
+    // Installs a resource package (fonts, images, see doc/ExternalResources.md) streamed by the FS service, writing
+    // each resource directly to its final path in littlefs.
+    //
+    // The package is a header followed by one entry per resource to install or obsolete file to delete. Each entry
+    // is made of a header (type, size, CRC of the data, path) followed by the data. A resource is first written to
+    // a temporary file, and only replaces the previous version once its CRC has been checked.
+    //
+    // The progress is saved after each entry, so that an interrupted install (disconnection, reboot) resumes at the
+    // first entry that was not installed when the same package is sent again.
+    // The installed resources are recorded in the resource index of FS.
+    class ResourceInstaller {
+    public:
+      explicit ResourceInstaller(Controllers::FS& fs);
+
+      // Path the package must be written to with the FS service. Nothing is stored at this path.
+      static constexpr const char* packagePath = "/.system/resources.pkg";
+
+      // Starts receiving a package of `totalSize` bytes, from its first byte
+      int Begin(uint32_t totalSize);
+      // Processes the data at `offset` of the package. Data before Position() was already processed and is
+      // ignored, data after Position() is rejected (LFS_ERR_INVAL). Returns 0, or a negative littlefs error.
+      // After an error, the package must be sent again from the start: the entries already installed are skipped.
+      int Write(uint32_t offset, const uint8_t* data, uint32_t size);
+      // Stops receiving the package. The entry being received is discarded.
+      void Suspend();
+
+      // Offset of the next byte expected
+      uint32_t Position() const {
+        return position;
+      }
+
+      bool IsComplete() const {
+        return phase == Phase::Done;
+      }
+
+      static constexpr uint8_t formatVersion = 1;
+      static constexpr uint16_t maxPathLength = FS::maxResourcePathLength;
+
+    private:
+      static constexpr const char* temporaryPath = "/.system/resources.tmp";
+      static constexpr const char* progressPath = "/.system/resources.progress";
+
+      enum class Phase : uint8_t { Idle, Header, EntryHeader, EntryPath, EntryData, Done, Failed };
+      enum class EntryType : uint8_t { File = 0, Delete = 1 };
+
+      struct __attribute__((packed)) Header {
+        char magic[4];
+        uint8_t version;
+        uint8_t reserved;
+        uint16_t entryCount;
+        uint32_t size; // size of the whole package, header included
+        uint32_t crc;  // CRC32 of the package after the header, identifies the package
+      };
+
+      struct __attribute__((packed)) EntryHeader {
+        EntryType type;
+        uint8_t pathLength;
+        uint16_t reserved;
+        uint32_t size; // size of the data, 0 for a file to delete
+        uint32_t crc;  // CRC32 of the data
+      };
+
+      // Saved after each entry
+      struct __attribute__((packed)) Progress {
+        uint32_t packageSize;
+        uint32_t packageCrc;
+        uint32_t offset; // start of the next entry
+        uint16_t entry;  // index of the next entry
+        uint16_t reserved;
+      };
+
+      static_assert(sizeof(Header) == 16, "The header is stored as-is in the package");
+      static_assert(sizeof(EntryHeader) == 12, "Entry headers are stored as-is in the package");
+
+      bool Fill(void* destination, size_t length, const uint8_t*& data, uint32_t& size);
+      int ProcessHeader();
+      int ProcessEntryHeader();
+      int ProcessEntryPath();
+      int ProcessEntryData(const uint8_t*& data, uint32_t& size);
+      int FinishFile();
+      int FinishEntry();
+      int Finish();
+      int Fail(int error);
+      void CreateParentDirectories();
+      void SaveProgress();
+
+      Controllers::FS& fs;
+      Phase phase = Phase::Idle;
+      Header header;
+      EntryHeader entry;
+      char path[maxPathLength + 1];
+      lfs_file_t file;
+      bool fileOpen = false;
+      // Number of bytes of the current header or path received so far
+      size_t filled = 0;
+      uint32_t totalSize = 0;
+      uint32_t position = 0;
+      uint32_t entryStart = 0;
+      uint16_t entryIndex = 0;
+      uint32_t remaining = 0;
+      uint32_t crc = 0;
+    };
+  }
+}
@@ -0,0 +1,110 @@
+#include "components/heartrate/BeatDetector.h"
+
+using namespace Pinetime::Controllers;
+
+namespace {
+  template <uint16_t SampleRate>
+  constexpr Pinetime::Utility::Biquad::Coefficients bandPass30to240 =
+    Pinetime::Utility::Biquad::BandPass(SampleRate, 30.0 / 60.0, 240.0 / 60.0);
+
+  // Samples are filtered with 8 fractional bits
+  constexpr int fractionBits = 8;
+}
+
+template <uint16_t SampleRate>
+BeatDetector<SampleRate>::BeatDetector() : filter {bandPass30to240<SampleRate>} {
+}
+
+template <uint16_t SampleRate>
+void BeatDetector<SampleRate>::Reset() {
+  primed = false;
+  sampleIndex = 0;
+  previous = 0;
+  beforePrevious = 0;
+  hasCandidate = false;
+  hasBeat = false;
+  amplitude = 0;
+  averageInterval = 0;
+  nbRejected = 0;
+}
+
+template <uint16_t SampleRate>
+uint16_t BeatDetector<SampleRate>::Process(uint16_t hrs) {
+  int32_t input = static_cast<int32_t>(hrs) << fractionBits;
+  if (!primed) {
+    filter.Prime(input);
+    primed = true;
+  }
+  // The light reflected to the sensor drops when the blood volume increases: detect the minima of the signal
+  int32_t current = -filter.Process(input);
+  sampleIndex++;
+
+  // Let the amplitude decay (halves in ~1.4s) so that the detection recovers from a drop of the signal
+  amplitude -= amplitude / (2 * SampleRate);
+
+  uint16_t interval = 0;
+  if (hasCandidate && sampleIndex - candidateIndex > refractorySamples) {
+    interval = Confirm();
+  }
+
+  // Local maximum at the previous sample
+  if (sampleIndex >= 3 && previous > beforePrevious && previous >= current && previous > amplitude / 2) {
+    if (!hasCandidate || previous > candidateValue) {
+      // Parabolic interpolation of the location of the maximum
+      float curvature = static_cast<float>(beforePrevious) - 2.0f * static_cast<float>(previous) + static_cast<float>(current);
+      float offset = 0.0f;
+      if (curvature < 0.0f) {
+        offset = 0.5f * static_cast<float>(beforePrevious - current) / curvature;
+      }
+      hasCandidate = true;
+      candidateIndex = sampleIndex - 1;
+      candidateOffset = offset;
+      candidateValue = previous;
+    }
+  }
+
+  beforePrevious = previous;
+  previous = current;
+  return interval;
+}
+
+template <uint16_t SampleRate>
+uint16_t BeatDetector<SampleRate>::Confirm() {
+  hasCandidate = false;
+  amplitude += (candidateValue - amplitude) / 8;
+
+  float beat = static_cast<float>(candidateIndex) + candidateOffset;
+  bool hadBeat = hasBeat;
+  float previousBeat = lastBeat;
+  hasBeat = true;
+  lastBeat = beat;
+  if (!hadBeat) {
+    return 0;
+  }
+
+  float elapsed = (beat - previousBeat) * 1000.0f / SampleRate;
+  if (elapsed < minInterval || elapsed > maxInterval) {
+    return 0;
+  }
+  auto interval = static_cast<uint16_t>(elapsed + 0.5f);
+
+  if (averageInterval == 0) {
+    averageInterval = interval;
+  }
+  uint16_t deviation = interval > averageInterval ? interval - averageInterval : averageInterval - interval;
+  if (deviation > averageInterval / maxDeviation) {
+    // Most likely a missed or a spurious beat. If the rhythm really changed, start over from the new one.
+    nbRejected++;
+    if (nbRejected >= maxRejected) {
+      averageInterval = 0;
+      nbRejected = 0;
+    }
+    return 0;
+  }
+  nbRejected = 0;
+  averageInterval = static_cast<uint16_t>((averageInterval * 3 + interval) / 4);
+  return interval;
+}
+
+template class Pinetime::Controllers::BeatDetector<10>;
+template class Pinetime::Controllers::BeatDetector<25>;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+#include "utility/Biquad.h"
+
+namespace Pinetime {
+  namespace Controllers {
+    // Time domain beat detection on the HRS samples (sampled at SampleRate Hz), running alongside the spectral
+    // estimation of Ppg to measure the interval between consecutive beats (RR interval).
+    //
+    // The samples are band-passed (30-240 BPM) and inverted, and a beat is a local maximum above an adaptive threshold
+    // (half of the average amplitude of the previous beats). The highest maximum within the refractory period wins,
+    // and its time is refined with a parabolic interpolation, so that the intervals are not limited to the sampling
+    // period.
+    template <uint16_t SampleRate>
+    class BeatDetector {
+    public:
+      BeatDetector();
+
+      // Processes a raw HRS sample. Returns the interval (ms) between the beat confirmed with this sample and the
+      // previous one, or 0 if no beat was confirmed or the interval is irregular (artifact, missed beat).
+      uint16_t Process(uint16_t hrs);
+      void Reset();
+
+      // Shortest and longest valid intervals (230 and 30 BPM)
+      static constexpr uint16_t minInterval = 60000 / 230;
+      static constexpr uint16_t maxInterval = 60000 / 30;
+
+    private:
+      // Refractory period, in samples
+      static constexpr uint32_t refractorySamples = (minInterval * SampleRate) / 1000;
+      // An interval that differs by more than 1/maxDeviation from the average interval is rejected
+      static constexpr uint16_t maxDeviation = 3;
+      // Number of consecutive rejected intervals after which the average interval is reset
+      static constexpr uint8_t maxRejected = 3;
+
+      uint16_t Confirm();
+
+      Utility::Biquad filter;
+      bool primed = false;
+      uint32_t sampleIndex = 0;
+      int32_t previous = 0;
+      int32_t beforePrevious = 0;
+
+      // Candidate beat, confirmed when no higher maximum is found within the refractory period
+      bool hasCandidate = false;
+      uint32_t candidateIndex = 0;
+      float candidateOffset = 0.0f;
+      int32_t candidateValue = 0;
+
+      // Time of the previous confirmed beat, in samples
+      bool hasBeat = false;
+      float lastBeat = 0.0f;
+
+      int32_t amplitude = 0;
+      uint16_t averageInterval = 0;
+      uint8_t nbRejected = 0;
+    };
+  }
+}
@@ -1,15 +1,111 @@
 #include "components/heartrate/HeartRateController.h"
 #include <heartratetask/HeartRateTask.h>
 #include <systemtask/SystemTask.h>
+#include <algorithm>
+#include <FreeRTOS.h>
+#include <task.h>
+#include "utility/Math.h"
 
 using namespace Pinetime::Controllers;
 
 void HeartRateController::Update(HeartRateController::States newState, uint8_t heartRate) {
   this->state = newState;
+  if (this->heartRate != heartRate || nbPendingRrIntervals > 0) {
+    this->heartRate = heartRate;
+    service->OnNewHeartRateValue(heartRate, pendingRrIntervals.data(), nbPendingRrIntervals);
+    nbPendingRrIntervals = 0;
+  }
+
+  if (newState == States::Running && heartRate > 0) {
+    AddToSummary(heartRate);
+  }
+}
+
+void HeartRateController::UpdateBackground(uint8_t heartRate) {
   if (this->heartRate != heartRate) {
     this->heartRate = heartRate;
-    service->OnNewHeartRateValue(heartRate);
+    service->OnNewHeartRateValue(heartRate, nullptr, 0);
+  }
+  AddToSummary(heartRate);
+}
+
+// The summary is updated by the heart rate task and taken by SystemTask
+void HeartRateController::AddToSummary(uint8_t heartRate) {
+  taskENTER_CRITICAL();
+  summarySum += heartRate;
+  summaryCount++;
+  summaryMax = std::max(summaryMax, heartRate);
+  taskEXIT_CRITICAL();
+}
+
+HeartRateController::Summary HeartRateController::TakeSummary() {
+  taskENTER_CRITICAL();
+  const uint32_t sum = summarySum;
+  const uint32_t count = summaryCount;
+  Summary summary {0, summaryMax};
+  summarySum = 0;
+  summaryCount = 0;
+  summaryMax = 0;
+  taskEXIT_CRITICAL();
+
+  if (count > 0) {
+    summary.average = static_cast<uint8_t>(sum / count);
+  }
+  return summary;
+}
+
+// The intervals are added by the heart rate task and read by the apps
+void HeartRateController::AddRrInterval(uint16_t interval) {
+  taskENTER_CRITICAL();
+  rrIntervals++;
+  rrIntervals[0] = interval;
+  taskEXIT_CRITICAL();
+  if (nbPendingRrIntervals < maxPendingRrIntervals) {
+    pendingRrIntervals[nbPendingRrIntervals++] = interval;
+  }
+}
+
+void HeartRateController::InterruptRrIntervals() {
+  taskENTER_CRITICAL();
+  if (rrIntervals[0] != 0) {
+    rrIntervals++;
+    rrIntervals[0] = 0;
+  }
+  taskEXIT_CRITICAL();
+}
+
+HeartRateController::Variability HeartRateController::HeartRateVariability() const {
+  taskENTER_CRITICAL();
+  const auto rrIntervals = this->rrIntervals;
+  taskEXIT_CRITICAL();
+
+  // Most recent interval first, stop at the first interruption
+  size_t count = 0;
+  uint32_t sum = 0;
+  uint32_t sumSquaredDifferences = 0;
+  while (count < rrHistoryLength && rrIntervals[rrHistoryLength - count] != 0) {
+    uint16_t interval = rrIntervals[rrHistoryLength - count];
+    sum += interval;
+    if (count > 0) {
+      int32_t difference = static_cast<int32_t>(interval) - rrIntervals[rrHistoryLength - count + 1];
+      sumSquaredDifferences += static_cast<uint32_t>(difference * difference);
+    }
+    count++;
+  }
+
+  Variability variability {0, 0, static_cast<uint8_t>(count)};
+  if (count < 2) {
+    return variability;
+  }
+  uint32_t mean = sum / count;
+  uint32_t sumSquaredDeviations = 0;
+  for (size_t i = 0; i < count; i++) {
+    int32_t deviation = static_cast<int32_t>(rrIntervals[rrHistoryLength - i]) - static_cast<int32_t>(mean);
+    sumSquaredDeviations += static_cast<uint32_t>(deviation * deviation);
   }
+  variability.rmssd = Utility::Sqrt(sumSquaredDifferences / (count - 1));
+  variability.sdnn = Utility::Sqrt(sumSquaredDeviations / (count - 1));
+  return variability;
 }
 
 void HeartRateController::Start() {
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <components/ble/HeartRateService.h>
+#include "utility/CircularBuffer.h"
 
 namespace Pinetime {
   namespace Applications {
@@ -17,10 +19,24 @@ namespace Pinetime {
     public:
       enum class States { Stopped, NotEnoughData, NoTouch, Running };
 
+      struct Summary {
+        uint8_t average;
+        uint8_t max;
+      };
+
+      // Heart rate variability (ms) over the last uninterrupted sequence of RR intervals
+      struct Variability {
+        uint16_t rmssd;
+        uint16_t sdnn;
+        uint8_t nbIntervals;
+      };
+
       HeartRateController() = default;
       void Start();
       void Stop();
       void Update(States newState, uint8_t heartRate);
+      // Result of a background measurement, done while the measurement is stopped (the state is not changed)
+      void UpdateBackground(uint8_t heartRate);
 
       void SetHeartRateTask(Applications::HeartRateTask* task);
 
@@ -34,11 +50,36 @@ namespace Pinetime {
 
       void SetService(Pinetime::Controllers::HeartRateService* service);
 
+      // Returns the average and maximum heart rate measured since the previous call (0 if none)
+      Summary TakeSummary();
+
+      // Adds the interval (ms) between the last two beats. It is sent with the next heart rate notification.
+      void AddRrInterval(uint16_t interval);
+      // Beats were missed since the last interval, the next one does not follow it
+      void InterruptRrIntervals();
+      // Shown by the heart rate app while a measurement is running
+      Variability HeartRateVariability() const;
+
+      // Number of RR intervals used for the heart rate variability (~30s at 60 BPM)
+      static constexpr size_t rrHistoryLength = 32;
+      // Maximum number of RR intervals sent in a single notification
+      static constexpr size_t maxPendingRrIntervals = 8;
+
     private:
       Applications::HeartRateTask* task = nullptr;
       States state = States::Stopped;
       uint8_t heartRate = 0;
       Pinetime::Controllers::HeartRateService* service = nullptr;
+
+      uint32_t summarySum = 0;
+      uint32_t summaryCount = 0;
+      uint8_t summaryMax = 0;
+      void AddToSummary(uint8_t heartRate);
+
+      // 0 marks an interruption
+      Utility::CircularBuffer<uint16_t, rrHistoryLength> rrIntervals = {};
+      std::array<uint16_t, maxPendingRrIntervals> pendingRrIntervals;
+      uint8_t nbPendingRrIntervals = 0;
     };
   }
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Pinetime {
+  namespace Controllers {
+    namespace PeakSearchDetail {
+      // Approximation of log2(value) (error < 0.005), good enough for the interpolation and much smaller than logf()
+      inline float FastLog2(float value) {
+        if (value <= 0.0f) {
+          return -127.0f;
+        }
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        float exponent = static_cast<float>(static_cast<int>((bits >> 23) & 0xFF) - 127);
+        // Mantissa in [1, 2)
+        bits = (bits & 0x007FFFFF) | 0x3F800000;
+        float mantissa;
+        std::memcpy(&mantissa, &bits, sizeof(mantissa));
+        return exponent + ((-0.34484843f * mantissa + 2.02466578f) * mantissa - 0.67487759f);
+      }
+
+      // Refines the location of the maximum at bin `index` with a gaussian fitted on its neighbours (parabolic
+      // interpolation of the log of the magnitude, less biased than on the magnitude itself for windowed spectra)
+      template <size_t N>
+      float GaussianPeak(const std::array<float, N>& spectrum, int index) {
+        if (index <= 0 || index >= static_cast<int>(N) - 1) {
+          return static_cast<float>(index);
+        }
+        float left = FastLog2(spectrum[index - 1]);
+        float center = FastLog2(spectrum[index]);
+        float right = FastLog2(spectrum[index + 1]);
+        float curvature = left - 2.0f * center + right;
+        if (curvature >= 0.0f) {
+          return static_cast<float>(index);
+        }
+        float offset = 0.5f * (left - right) / curvature;
+        return static_cast<float>(index) + std::clamp(offset, -0.5f, 0.5f);
+      }
+    }
+
+    // Looks for peaks above threshold between the bins start and end, the spectrum being linearly interpolated between
+    // the bins, and returns the location (bins) of the peak if there is exactly one, 0 otherwise. width is set to the
+    // width (bins) of the peak at threshold.
+    // Each pair of consecutive bins is looked at once: a peak starts where the spectrum rises from below threshold to
+    // threshold or above, and ends where it falls back to threshold or below (a bin at threshold between two bins above
+    // it does not end it). A peak that is already above threshold at start, or still above it at end, is not counted.
+    // Its location is refined around its maximum bin.
+    template <size_t N>
+    float PeakSearch(const std::array<float, N>& spectrum, float threshold, float& width, int start, int end) {
+      int peaks = 0;
+      // The spectrum was below threshold since start
+      bool enabled = false;
+      bool inPeak = false;
+      float risingEdge = 0.0f;
+      int maxBin = 0;
+      float peakCenter = 0.0f;
+      const int last = std::min(end, static_cast<int>(N) - 1);
+      for (int idx = start; idx < last; idx++) {
+        const float currValue = spectrum[idx];
+        const float nextValue = spectrum[idx + 1];
+        if (currValue < threshold) {
+          enabled = true;
+        }
+        if (!inPeak) {
+          // Back above threshold right after a peak ended on it: another peak
+          if (enabled && ((currValue < threshold && nextValue >= threshold) || (currValue == threshold && nextValue > threshold))) {
+            inPeak = true;
+            risingEdge = static_cast<float>(idx) + (threshold - currValue) / (nextValue - currValue);
+            maxBin = idx + 1;
+          }
+        } else if (nextValue < threshold || (nextValue == threshold && (idx + 2 > last || spectrum[idx + 2] <= threshold))) {
+          inPeak = false;
+          const float fallingEdge =
+            currValue > nextValue ? static_cast<float>(idx) + (currValue - threshold) / (currValue - nextValue) : static_cast<float>(idx);
+          // Only touching the threshold is not a peak
+          if (fallingEdge > risingEdge) {
+            peaks++;
+            width = fallingEdge - risingEdge;
+            peakCenter = PeakSearchDetail::GaussianPeak(spectrum, maxBin);
+          }
+        } else if (nextValue > spectrum[maxBin]) {
+          maxBin = idx + 1;
+        }
+      }
+      if (peaks != 1) {
+        width = 0.0f;
+        peakCenter = 0.0f;
+      }
+      return peakCenter;
+    }
+  }
+}
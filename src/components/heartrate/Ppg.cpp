@@ -1,65 +1,16 @@
 #include "components/heartrate/Ppg.h"
+#include <algorithm>
+#include <cmath>
 #include <nrf_log.h>
-#include <vector>
+#include "components/heartrate/PeakSearch.h"
+#include "utility/Biquad.h"
+#include "utility/RealFft.h"
 
 using namespace Pinetime::Controllers;
 
 namespace {
-  float LinearInterpolation(const float* xValues, const float* yValues, int length, float pointX) {
-    if (pointX > xValues[length - 1]) {
-      return yValues[length - 1];
-    } else if (pointX <= xValues[0]) {
-      return yValues[0];
-    }
-    int index = 0;
-    while (pointX > xValues[index] && index < length - 1) {
-      index++;
-    }
-    float pointX0 = xValues[index - 1];
-    float pointX1 = xValues[index];
-    float pointY0 = yValues[index - 1];
-    float pointY1 = yValues[index];
-    float mu = (pointX - pointX0) / (pointX1 - pointX0);
-
-    return (pointY0 * (1 - mu) + pointY1 * mu);
-  }
-
-  float PeakSearch(float* xVals, float* yVals, float threshold, float& width, float start, float end, int length) {
-    int peaks = 0;
-    bool enabled = false;
-    float minBin = 0.0f;
-    float maxBin = 0.0f;
-    float peakCenter = 0.0f;
-    float prevValue = LinearInterpolation(xVals, yVals, length, start - 0.01f);
-    float currValue = LinearInterpolation(xVals, yVals, length, start);
-    float idx = start;
-    while (idx < end) {
-      float nextValue = LinearInterpolation(xVals, yVals, length, idx + 0.01f);
-      if (currValue < threshold) {
-        enabled = true;
-      }
-      if (currValue >= threshold and enabled) {
-        if (prevValue < threshold) {
-          minBin = idx;
-        } else if (nextValue <= threshold) {
-          maxBin = idx;
-          peaks++;
-          width = maxBin - minBin;
-          peakCenter = width / 2.0f + minBin;
-        }
-      }
-      prevValue = currValue;
-      currValue = nextValue;
-      idx += 0.01f;
-    }
-    if (peaks != 1) {
-      width = 0.0f;
-      peakCenter = 0.0f;
-    }
-    return peakCenter;
-  }
-
-  float SpectrumMean(const std::array<float, Ppg::spectrumLength>& signal, int start, int end) {
+  template <size_t N>
+  float SpectrumMean(const std::array<float, N>& signal, int start, int end) {
     int total = 0;
     float mean = 0.0f;
     for (int idx = start; idx < end; idx++) {
@@ -72,38 +23,67 @@ namespace {
     return mean;
   }
 
-  float SignalToNoise(const std::array<float, Ppg::spectrumLength>& signal, int start, int end, float max) {
+  template <size_t N>
+  float SignalToNoise(const std::array<float, N>& signal, int start, int end, float max) {
     float mean = SpectrumMean(signal, start, end);
     return max / mean;
   }
 
-  // Simple bandpass filter using exponential moving average
-  void Filter30to240(std::array<float, Ppg::dataLength>& signal) {
-    // From:
-    // https://www.norwegiancreations.com/2016/03/arduino-tutorial-simple-high-pass-band-pass-and-band-stop-filtering/
+  // Number of fractional bits of the fixed-point samples before they are scaled to Q15
+  constexpr int fractionBits = 8;
 
-    int length = signal.size();
-    // 0.268 is ~0.5Hz and 0.816 is ~4Hz cutoff at 10Hz sampling
-    float expAlpha = 0.816f;
-    float expAvg = 0.0f;
+  // Smoothing factor (Q14) of an exponential moving average at SampleRate, with the same time constant as the
+  // smoothing factor alpha10 at 10Hz
+  template <uint16_t SampleRate>
+  constexpr int32_t EmaAlpha(double alpha10) {
+    const double alpha = 1 - Pinetime::Utility::ConstexprExp(Pinetime::Utility::ConstexprLog(1 - alpha10) * 10.0 / SampleRate);
+    return static_cast<int32_t>(alpha * (1 << 14) + 0.5);
+  }
+
+  // alpha * (value - average), rounded to the nearest (truncating would bias the averages)
+  int32_t EmaStep(int32_t alpha, int32_t value, int32_t average) {
+    return static_cast<int32_t>((static_cast<int64_t>(alpha) * (value - average) + (1 << 13)) >> 14);
+  }
+
+  // Simple bandpass filter using exponential moving average, same as the original floating point one.
+  // The low-pass factor is ~4Hz and the high-pass one ~0.5Hz (0.816 and 0.268 at 10Hz sampling).
+  // The DC level of the spectrum, compared to dcThreshold, depends on this filter (see ppg-compare).
+  template <uint16_t SampleRate, size_t N>
+  void Filter30to240(std::array<int32_t, N>& signal) {
+    constexpr int32_t lowPassAlpha = EmaAlpha<SampleRate>(0.816);
+    constexpr int32_t highPassAlpha = EmaAlpha<SampleRate>(0.268);
     for (int loop = 0; loop < 4; loop++) {
-      expAvg = signal.front();
-      for (int idx = 0; idx < length; idx++) {
-        expAvg = (expAlpha * signal.at(idx)) + ((1 - expAlpha) * expAvg);
-        signal[idx] = expAvg;
+      int32_t average = signal.front();
+      for (auto& value : signal) {
+        average += EmaStep(lowPassAlpha, value, average);
+        value = average;
       }
     }
-    expAlpha = 0.268f;
     for (int loop = 0; loop < 4; loop++) {
-      expAvg = signal.front();
-      for (int idx = 0; idx < length; idx++) {
-        expAvg = (expAlpha * signal.at(idx)) + ((1 - expAlpha) * expAvg);
-        signal[idx] -= expAvg;
+      int32_t average = signal.front();
+      for (auto& value : signal) {
+        average += EmaStep(highPassAlpha, value, average);
+        value -= average;
       }
     }
   }
 
-  float SpectrumMax(const std::array<float, Ppg::spectrumLength>& data, int start, int end) {
+  // 0.5Hz to 4Hz band-pass with a unit gain, for the motion: motionThreshold is an acceleration
+  template <uint16_t SampleRate>
+  constexpr Pinetime::Utility::Biquad::Coefficients bandPass30to240 =
+    Pinetime::Utility::Biquad::BandPass(SampleRate, 30.0 / 60.0, 240.0 / 60.0);
+
+  template <uint16_t SampleRate, size_t N>
+  void BandPass30to240(std::array<int32_t, N>& signal) {
+    Pinetime::Utility::Biquad filter {bandPass30to240<SampleRate>};
+    filter.Prime(signal.front());
+    for (auto& value : signal) {
+      value = filter.Process(value);
+    }
+  }
+
+  template <size_t N>
+  float SpectrumMax(const std::array<float, N>& data, int start, int end) {
     float max = 0.0f;
     for (int idx = start; idx < end; idx++) {
       if (data.at(idx) > max) {
@@ -113,37 +93,92 @@ namespace {
     return max;
   }
 
-  void Detrend(std::array<float, Ppg::dataLength>& signal) {
+  // Removes the linear trend of the raw samples and differentiates them, with fractionBits fractional bits
+  template <size_t N>
+  void Detrend(const std::array<uint16_t, N>& data, std::array<int32_t, N>& signal) {
     int size = signal.size();
-    float offset = signal.front();
-    float slope = (signal.at(size - 1) - offset) / static_cast<float>(size - 1);
+    int32_t slope = ((static_cast<int32_t>(data.back()) - data.front()) << fractionBits) / (size - 1);
+    for (int idx = 0; idx < size - 1; idx++) {
+      signal[idx] = ((static_cast<int32_t>(data[idx + 1]) - data[idx]) << fractionBits) - slope;
+    }
+    // The last detrended sample is always 0
+    signal[size - 1] = 0;
+  }
 
+  // Removes the linear trend of the samples, with fractionBits fractional bits.
+  // The unknown samples (0) are replaced by missing.
+  template <size_t N>
+  void RemoveTrend(const std::array<uint16_t, N>& data, uint16_t missing, std::array<int32_t, N>& signal) {
+    int size = signal.size();
     for (int idx = 0; idx < size; idx++) {
-      signal[idx] -= (slope * static_cast<float>(idx) + offset);
+      signal[idx] = static_cast<int32_t>(data[idx] != 0 ? data[idx] : missing) << fractionBits;
     }
-    for (int idx = 0; idx < size - 1; idx++) {
-      signal[idx] = signal[idx + 1] - signal[idx];
+    int32_t offset = signal.front();
+    int32_t slope = (signal.back() - offset) / (size - 1);
+    for (int idx = 0; idx < size; idx++) {
+      signal[idx] -= offset + slope * idx;
+    }
+  }
+
+  // Hanning window (same as numpy.hanning(N)) in Q15, computed at build time.
+  // This data is symetrical so just using the first half.
+  template <size_t N>
+  constexpr std::array<int16_t, N / 2> MakeHanning() {
+    std::array<int16_t, N / 2> window {};
+    for (size_t idx = 0; idx < window.size(); idx++) {
+      double value = 0.5 - 0.5 * Pinetime::Utility::ConstexprCos(2 * 3.14159265358979323846 * idx / (N - 1));
+      window[idx] = static_cast<int16_t>(value * 32767.0 + 0.5);
     }
+    return window;
   }
 
-  // Hanning Coefficients from numpy: python -c 'import numpy;print(numpy.hanning(64))'
-  // Note: Harcoded and must be updated if constexpr dataLength is changed. Prevents the need to
-  // use cosf() which results in an extra ~5KB in storage.
-  // This data is symetrical so just using the first half (saves 128B when dataLength is 64).
-  static constexpr float hanning[Ppg::dataLength >> 1] {
-    0.0f,        0.00248461f, 0.00991376f, 0.0222136f,  0.03926189f, 0.06088921f, 0.08688061f, 0.11697778f,
-    0.15088159f, 0.1882551f,  0.22872687f, 0.27189467f, 0.31732949f, 0.36457977f, 0.41317591f, 0.46263495f,
-    0.51246535f, 0.56217185f, 0.61126047f, 0.65924333f, 0.70564355f, 0.75f,       0.79187184f, 0.83084292f,
-    0.86652594f, 0.89856625f, 0.92664544f, 0.95048443f, 0.96984631f, 0.98453864f, 0.99441541f, 0.99937846f};
+  template <size_t N>
+  constexpr std::array<int16_t, N / 2> hanning = MakeHanning<N>();
+
+  // Scales the signal to Q15 (using its whole range) and applies the Hanning window.
+  // Returns the number of bits the signal was shifted left by (negative if it was shifted right).
+  template <size_t N>
+  int ApplyWindow(std::array<int32_t, N>& signal) {
+    int32_t maxAbs = 0;
+    for (const auto value : signal) {
+      maxAbs = std::max(maxAbs, value < 0 ? -value : value);
+    }
+    int shift = 0;
+    if (maxAbs > 0) {
+      for (; maxAbs < (1 << 14); maxAbs <<= 1) {
+        shift++;
+      }
+      for (; maxAbs >= (1 << 15); maxAbs >>= 1) {
+        shift--;
+      }
+    }
+
+    int length = signal.size();
+    for (int idx = 0; idx < length; idx++) {
+      int32_t value = shift >= 0 ? signal[idx] << shift : signal[idx] >> -shift;
+      int hannIdx = idx < length / 2 ? idx : length - 1 - idx;
+      signal[idx] = (value * hanning<N>[hannIdx]) >> 15;
+    }
+    return shift;
+  }
+
+  // 2^exponent
+  float Exp2(int exponent) {
+    return exponent >= 0 ? static_cast<float>(1UL << exponent) : 1.0f / static_cast<float>(1UL << -exponent);
+  }
 }
 
-Ppg::Ppg() {
+template <uint16_t SampleRate, uint16_t DataLength>
+Ppg<SampleRate, DataLength>::Ppg() {
   dataAverage.fill(0.0f);
   spectrum.fill(0.0f);
+  motionSpectrum.fill(0.0f);
 }
 
-int8_t Ppg::Preprocess(uint16_t hrs, uint16_t als) {
+template <uint16_t SampleRate, uint16_t DataLength>
+int8_t Ppg<SampleRate, DataLength>::Preprocess(uint16_t hrs, uint16_t als, uint16_t motion) {
   if (dataIndex < dataLength) {
+    dataMotion[dataIndex] = motion;
     dataHRS[dataIndex++] = hrs;
   }
   alsValue = als;
@@ -153,7 +188,8 @@ int8_t Ppg::Preprocess(uint16_t hrs, uint16_t als) {
   return 0;
 }
 
-int Ppg::HeartRate() {
+template <uint16_t SampleRate, uint16_t DataLength>
+int Ppg<SampleRate, DataLength>::HeartRate() {
   if (dataIndex < dataLength) {
     return 0;
   }
@@ -163,18 +199,22 @@ int Ppg::HeartRate() {
   // Make room for overlapWindow number of new samples
   for (int idx = 0; idx < dataLength - overlapWindow; idx++) {
     dataHRS[idx] = dataHRS[idx + overlapWindow];
+    dataMotion[idx] = dataMotion[idx + overlapWindow];
   }
   dataIndex = dataLength - overlapWindow;
   return hr;
 }
 
-void Ppg::Reset(bool resetDaqBuffer) {
+template <uint16_t SampleRate, uint16_t DataLength>
+void Ppg<SampleRate, DataLength>::Reset(bool resetDaqBuffer) {
   if (resetDaqBuffer) {
     dataIndex = 0;
   }
   avgIndex = 0;
   dataAverage.fill(0.0f);
   lastPeakLocation = 0.0f;
+  lastValidPeak = 0.0f;
+  nbStableEstimates = 0;
   alsThreshold = UINT16_MAX;
   alsValue = 0;
   resetSpectralAvg = true;
@@ -183,47 +223,30 @@ void Ppg::Reset(bool resetDaqBuffer) {
 
 // Pass init == true to reset spectral averaging.
 // Returns -1 (Reset Acquisition), 0 (Unable to obtain HR) or HR (BPM).
-int Ppg::ProcessHeartRate(bool init) {
-  std::copy(dataHRS.begin(), dataHRS.end(), vReal.begin());
-  Detrend(vReal);
-  Filter30to240(vReal);
-  vImag.fill(0.0f);
-  // Apply Hanning Window
-  int hannIdx = 0;
-  for (int idx = 0; idx < dataLength; idx++) {
-    if (idx >= dataLength >> 1) {
-      hannIdx--;
-    }
-    vReal[idx] *= hanning[hannIdx];
-    if (idx < dataLength >> 1) {
-      hannIdx++;
-    }
-  }
-  // Compute in place power spectrum
-  ArduinoFFT<float> FFT = ArduinoFFT<float>(vReal.data(), vImag.data(), dataLength, sampleFreq);
-  FFT.compute(FFTDirection::Forward);
-  FFT.complexToMagnitude();
-  FFT.~ArduinoFFT();
-  SpectrumAverage(vReal.data(), spectrum.data(), spectrum.size(), init);
+template <uint16_t SampleRate, uint16_t DataLength>
+int Ppg<SampleRate, DataLength>::ProcessHeartRate(bool init) {
+  const bool motionKnown = MotionSpectrum();
+  Detrend(dataHRS, signal);
+  Filter30to240<SampleRate>(signal);
+  int shift = ApplyWindow(signal);
+  // Compute in place the spectrum, then convert it back to ADC counts
+  Utility::RealFft<dataLength>::Compute(signal);
+  SpectrumAverage(signal, Exp2(-(shift + fractionBits)), init);
+  // Look for the peak in the spectrum penalized by the motion, if there is any
+  const bool penalized = motionKnown && PenalizeMotion();
+  const auto& analyzed = penalized ? motionSpectrum : spectrum;
   peakLocation = 0.0f;
   float threshold = peakDetectionThreshold;
   float peakWidth = 0.0f;
-  int specLen = spectrum.size();
-  float max = SpectrumMax(spectrum, hrROIbegin, hrROIend);
-  float signalToNoiseRatio = SignalToNoise(spectrum, hrROIbegin, hrROIend, max);
-  if (signalToNoiseRatio > signalToNoiseThreshold && spectrum.at(0) < dcThreshold) {
+  float max = SpectrumMax(analyzed, hrROIbegin, hrROIend);
+  float signalToNoiseRatio = SignalToNoise(analyzed, hrROIbegin, hrROIend, max);
+  if (signalToNoiseRatio > signalToNoiseThreshold && analyzed.at(0) < dcThreshold) {
     threshold *= max;
-    // Reuse VImag for interpolation x values passed to PeakSearch
-    for (int idx = 0; idx < dataLength; idx++) {
-      vImag[idx] = idx;
+    peakLocation = PeakSearch(analyzed, threshold, peakWidth, hrROIbegin, hrROIend);
+    // A peak next to the motion artifacts is distorted by the penalty, and may be one of them
+    if (penalized && peakLocation > 0.0f && NearMotion(peakLocation)) {
+      peakLocation = 0.0f;
     }
-    peakLocation = PeakSearch(vImag.data(),
-                              spectrum.data(),
-                              threshold,
-                              peakWidth,
-                              static_cast<float>(hrROIbegin),
-                              static_cast<float>(hrROIend),
-                              specLen);
     peakLocation *= freqResolution;
   }
   // Peak too wide? (broad spectrum noise or large, rapid HR change)
@@ -237,7 +260,15 @@ int Ppg::ProcessHeartRate(bool init) {
   // Reset spectral averaging if bad reading
   if (peakLocation == 0.0f) {
     resetSpectralAvg = true;
+    nbStableEstimates = 0;
+  } else if (lastValidPeak > 0.0f && std::abs(peakLocation - lastValidPeak) <= maxEstimateShift) {
+    if (nbStableEstimates < confidentEstimates) {
+      nbStableEstimates++;
+    }
+  } else {
+    nbStableEstimates = 1;
   }
+  lastValidPeak = peakLocation;
   // Set the ambient light threshold and return HR in BPM
   alsThreshold = static_cast<uint16_t>(alsValue * alsFactor);
   // Get current average HR. If HR reduced to zero, return -1 (reset) else HR
@@ -252,20 +283,93 @@ int Ppg::ProcessHeartRate(bool init) {
   return rtn;
 }
 
-void Ppg::SpectrumAverage(const float* data, float* spectrum, int length, bool reset) {
+// Averages the magnitude of the FFT bins (multiplied by scale) into the spectrum
+template <uint16_t SampleRate, uint16_t DataLength>
+void Ppg<SampleRate, DataLength>::SpectrumAverage(const std::array<int32_t, dataLength>& bins, float scale, bool reset) {
   if (reset) {
     spectralAvgCount = 0;
   }
   float count = static_cast<float>(spectralAvgCount);
+  int length = spectrum.size();
   for (int idx = 0; idx < length; idx++) {
-    spectrum[idx] = (spectrum[idx] * count + data[idx]) / (count + 1);
+    float re = static_cast<float>(bins[2 * idx]);
+    float im = static_cast<float>(bins[2 * idx + 1]);
+    float magnitude = std::sqrt(re * re + im * im) * scale;
+    spectrum[idx] = (spectrum[idx] * count + magnitude) / (count + 1);
   }
   if (spectralAvgCount < spectralAvgMax) {
     spectralAvgCount++;
   }
 }
 
-float Ppg::HeartRateAverage(float hr) {
+// Computes the magnitude spectrum of the motion samples into motionSpectrum, with the same window as the HRS samples
+// (but without differentiation, and with a unit gain band-pass filter).
+// The unknown samples are replaced by the mean of the known ones. Returns false (and leaves motionSpectrum untouched)
+// if less than half of them are known.
+template <uint16_t SampleRate, uint16_t DataLength>
+bool Ppg<SampleRate, DataLength>::MotionSpectrum() {
+  uint32_t sum = 0;
+  int nbKnown = 0;
+  for (const auto value : dataMotion) {
+    if (value != 0) {
+      sum += value;
+      nbKnown++;
+    }
+  }
+  if (nbKnown < dataLength / 2) {
+    return false;
+  }
+  RemoveTrend(dataMotion, static_cast<uint16_t>(sum / nbKnown), signal);
+  BandPass30to240<SampleRate>(signal);
+  int shift = ApplyWindow(signal);
+  Utility::RealFft<dataLength>::Compute(signal);
+  float scale = Exp2(-(shift + fractionBits));
+  int length = motionSpectrum.size();
+  for (int idx = 0; idx < length; idx++) {
+    float re = static_cast<float>(signal[2 * idx]);
+    float im = static_cast<float>(signal[2 * idx + 1]);
+    motionSpectrum[idx] = std::sqrt(re * re + im * im) * scale;
+  }
+  return true;
+}
+
+// Attenuates the bins of the spectrum where the motion spectrum has a peak (step cadence, arm swing), as the motion
+// artifacts of the PPG are at the same frequencies. The result is stored in motionSpectrum.
+// Returns false (and leaves motionSpectrum untouched) if there is not enough motion.
+template <uint16_t SampleRate, uint16_t DataLength>
+bool Ppg<SampleRate, DataLength>::PenalizeMotion() {
+  float motionMax = SpectrumMax(motionSpectrum, hrROIbegin, hrROIend);
+  if (motionMax < motionThreshold) {
+    return false;
+  }
+  int length = motionSpectrum.size();
+  for (int idx = 0; idx < length; idx++) {
+    float relativeMotion = std::min(motionSpectrum[idx] / motionMax, 1.0f);
+    float weight = 1.0f;
+    if (relativeMotion >= motionPeakThreshold) {
+      weight -= motionPenalty * relativeMotion;
+    }
+    motionSpectrum[idx] = spectrum[idx] * weight;
+  }
+  return true;
+}
+
+// Returns true if a bin penalized by PenalizeMotion() is within motionPeakDistance of location (bins)
+template <uint16_t SampleRate, uint16_t DataLength>
+bool Ppg<SampleRate, DataLength>::NearMotion(float location) const {
+  int first = std::max(0, static_cast<int>(std::ceil(location - motionPeakDistance)));
+  int last = std::min(spectrumLength - 1, static_cast<int>(location + motionPeakDistance));
+  for (int idx = first; idx <= last; idx++) {
+    // The penalized bins are the ones attenuated in motionSpectrum
+    if (motionSpectrum[idx] < spectrum[idx]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <uint16_t SampleRate, uint16_t DataLength>
+float Ppg<SampleRate, DataLength>::HeartRateAverage(float hr) {
   avgIndex++;
   avgIndex %= dataAverage.size();
   dataAverage[avgIndex] = hr;
@@ -290,3 +394,7 @@ float Ppg::HeartRateAverage(float hr) {
   }
   return avg;
 }
+
+// Acquisition profiles, see HeartRateTask
+template class Pinetime::Controllers::Ppg<10, 64>;
+template class Pinetime::Controllers::Ppg<25, 256>;
@@ -3,40 +3,57 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
-// Note: Change internal define 'sqrt_internal sqrt' to
-// 'sqrt_internal sqrtf' to save ~3KB of flash.
-#define sqrt_internal sqrtf
-#define FFT_SPEED_OVER_PRECISION
-#include "libs/arduinoFFT/src/arduinoFFT.h"
 
 namespace Pinetime {
   namespace Controllers {
+    // Spectral heart rate estimation from the HRS samples, sampled at SampleRate (Hz).
+    // DataLength samples are analyzed at a time (window of DataLength / SampleRate seconds), it must be a power of 2.
+    template <uint16_t SampleRate, uint16_t DataLength>
     class Ppg {
     public:
       Ppg();
-      int8_t Preprocess(uint16_t hrs, uint16_t als);
+      // motion: magnitude of the acceleration at the time of the sample (binary milli-g), used to reject the motion
+      // artifacts. Pass 0 if unknown: the motion is only used if it is known for at least half of the samples analyzed.
+      int8_t Preprocess(uint16_t hrs, uint16_t als, uint16_t motion = 0);
       int HeartRate();
       void Reset(bool resetDaqBuffer);
-      static constexpr int deltaTms = 100;
+      // True when the last analyses found the same heart rate, which can then be used without further averaging
+      bool Confident() const {
+        return nbStableEstimates >= confidentEstimates;
+      }
+      // Level of the DC bin of the averaged spectrum at the last analysis, compared to dcThreshold (see ppg-compare)
+      float DcLevel() const {
+        return spectrum[0];
+      }
+      static constexpr uint16_t sampleRate = SampleRate;
+      static constexpr int deltaTms = 1000 / SampleRate;
       // Daq dataLength: Must be power of 2
-      static constexpr uint16_t dataLength = 64;
+      static constexpr uint16_t dataLength = DataLength;
       static constexpr uint16_t spectrumLength = dataLength >> 1;
+      // Number of samples before each analysis
+      // 0.5 second update rate
+      static constexpr uint16_t overlapWindow = SampleRate / 2;
+      // Threshold for high DC level after filtering
+      // Note: 0.5 is the threshold of the original floating point estimation (10Hz, 64 samples), the filter is the same
+      // and so is the DC level (ppg-compare). At 25Hz with 256 samples, the DC level of the same signals is about half
+      // of it (ppg-replay on the synthetic traces, see doc/PpgRecording.md).
+      static constexpr float dcThreshold = SampleRate == 10 ? 0.5f : 0.25f;
 
     private:
-      // The sampling frequency (Hz) based on sampling time in milliseconds (DeltaTms)
-      static constexpr float sampleFreq = 1000.0f / static_cast<float>(deltaTms);
+      static_assert(DataLength >= 16 && (DataLength & (DataLength - 1)) == 0, "DataLength must be a power of 2");
+
+      // The sampling frequency (Hz)
+      static constexpr float sampleFreq = static_cast<float>(SampleRate);
       // The frequency resolution (Hz)
       static constexpr float freqResolution = sampleFreq / dataLength;
-      // Number of samples before each analysis
-      // 0.5 second update rate at 10Hz
-      static constexpr uint16_t overlapWindow = 5;
       // Maximum number of spectrum running averages
       // Note: actual number of spectra averaged = spectralAvgMax + 1
       static constexpr uint16_t spectralAvgMax = 2;
       // Multiple Peaks above this threshold (% of max) are rejected
       static constexpr float peakDetectionThreshold = 0.6f;
       // Maximum peak width (bins) at threshold for valid peak.
-      static constexpr float maxPeakWidth = 2.5f;
+      // 2.5 bins of the original 10Hz, 64 samples analysis (0.39Hz)
+      static constexpr float maxPeakWidth = 2.5f * (10.0f / 64.0f) / freqResolution;
       // Metric for spectrum noise level.
       static constexpr float signalToNoiseThreshold = 3.0f;
       // Heart rate Region Of Interest begin (bins)
@@ -47,25 +64,41 @@ namespace Pinetime {
       static constexpr float minHR = 40.0f / 60.0f;
       // Maximum HR (Hz)
       static constexpr float maxHR = 230.0f / 60.0f;
-      // Threshold for high DC level after filtering
-      static constexpr float dcThreshold = 0.5f;
       // ALS detection factor
       static constexpr float alsFactor = 2.0f;
+      // Motion is taken into account when the motion spectrum has a peak above this level, which is the level of an
+      // acceleration with an amplitude of 30mg (sinusoid, Hanning window)
+      static constexpr float motionThreshold = 30.0f * 1.024f * dataLength / 4.0f;
+      // Bins where the motion spectrum is above this threshold (% of max) are penalized
+      static constexpr float motionPeakThreshold = 0.5f;
+      // Maximum attenuation of the penalized bins
+      static constexpr float motionPenalty = 0.75f;
+      // Peaks closer than this (bins) to a penalized bin are rejected.
+      // 1.5 bins of the original 10Hz, 64 samples analysis (0.23Hz)
+      static constexpr float motionPeakDistance = 1.5f * (10.0f / 64.0f) / freqResolution;
+      // Number of consecutive analyses that must agree for a confident estimate
+      static constexpr uint8_t confidentEstimates = 3;
+      // Maximum difference between two estimates (Hz) that agree
+      static constexpr float maxEstimateShift = 6.0f / 60.0f;
 
       // Raw ADC data
       std::array<uint16_t, dataLength> dataHRS;
-      // Stores Real numbers from FFT
-      std::array<float, dataLength> vReal;
-      // Stores Imaginary numbers from FFT
-      std::array<float, dataLength> vImag;
+      // Fixed-point samples (filtered, then windowed in Q15), replaced in place by the FFT bins
+      std::array<int32_t, dataLength> signal;
+      // Magnitude of the acceleration
+      std::array<uint16_t, dataLength> dataMotion;
       // Stores power spectrum calculated from FFT real and imag values
       std::array<float, (spectrumLength)> spectrum;
+      // Spectrum of the motion, then the spectrum penalized by the motion
+      std::array<float, (spectrumLength)> motionSpectrum;
       // Stores each new HR value (Hz). Non zero values are averaged for HR output
       std::array<float, 20> dataAverage;
 
       uint16_t avgIndex = 0;
       uint16_t spectralAvgCount = 0;
       float lastPeakLocation = 0.0f;
+      float lastValidPeak = 0.0f;
+      uint8_t nbStableEstimates = 0;
       uint16_t alsThreshold = UINT16_MAX;
       uint16_t alsValue = 0;
       uint16_t dataIndex = 0;
@@ -74,7 +107,10 @@ namespace Pinetime {
 
       int ProcessHeartRate(bool init);
       float HeartRateAverage(float hr);
-      void SpectrumAverage(const float* data, float* spectrum, int length, bool reset);
+      void SpectrumAverage(const std::array<int32_t, dataLength>& bins, float scale, bool reset);
+      bool MotionSpectrum();
+      bool PenalizeMotion();
+      bool NearMotion(float location) const;
     };
   }
 }
@@ -0,0 +1,154 @@
+#include "components/heartrate/PpgRecorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <libraries/log/nrf_log.h>
+#include "systemtask/SystemTask.h"
+
+using namespace Pinetime::Controllers;
+
+PpgRecorder::PpgRecorder(Controllers::FS& fs) : fs {fs} {
+}
+
+void PpgRecorder::Register(Pinetime::System::SystemTask* systemTask) {
+  this->systemTask = systemTask;
+}
+
+void PpgRecorder::RecordingPath(uint8_t index, char* path, size_t length) {
+  snprintf(path, length, "%s/%u.ppg", directory, index);
+}
+
+void PpgRecorder::RequestFlush() {
+  if (systemTask != nullptr) {
+    systemTask->PushMessage(System::Messages::FlushPpgRecording);
+  }
+}
+
+bool PpgRecorder::Start(uint16_t sampleRate) {
+  taskENTER_CRITICAL();
+  const bool idle = state == States::Idle;
+  if (idle) {
+    state = States::Starting;
+    this->sampleRate = sampleRate;
+    head = 0;
+    tail = 0;
+  }
+  taskEXIT_CRITICAL();
+
+  if (idle) {
+    // Create the file right away rather than with the first records
+    RequestFlush();
+  }
+  return idle;
+}
+
+void PpgRecorder::Add(uint32_t time, uint16_t hrs, uint16_t als, int16_t x, int16_t y, int16_t z) {
+  taskENTER_CRITICAL();
+  uint16_t pending = static_cast<uint16_t>(head - tail);
+  const bool added = (state == States::Starting || state == States::Recording) && pending < bufferLength;
+  if (added) {
+    buffer[head % bufferLength] = {static_cast<uint16_t>(time), hrs, als, x, y, z};
+    head++;
+    pending++;
+  }
+  taskEXIT_CRITICAL();
+
+  // The sample is dropped if SystemTask doesn't keep up
+  if (added && pending == flushThreshold) {
+    RequestFlush();
+  }
+}
+
+void PpgRecorder::Stop() {
+  taskENTER_CRITICAL();
+  const bool stopping = state == States::Starting || state == States::Recording;
+  if (stopping) {
+    state = States::Stopping;
+  }
+  taskEXIT_CRITICAL();
+
+  if (stopping) {
+    RequestFlush();
+  }
+}
+
+void PpgRecorder::Flush() {
+  taskENTER_CRITICAL();
+  const States current = state;
+  if (current == States::Starting) {
+    state = States::Recording;
+  }
+  taskEXIT_CRITICAL();
+
+  if (current == States::Idle) {
+    return;
+  }
+
+  // No record is added once the recording is stopping: WriteRecords() then writes all the remaining ones
+  if ((!fileOpen && !Open()) || !WriteRecords() || current == States::Stopping) {
+    Close();
+    taskENTER_CRITICAL();
+    state = States::Idle;
+    taskEXIT_CRITICAL();
+  }
+}
+
+bool PpgRecorder::Open() {
+  fs.DirCreate("/.system");
+  fs.DirCreate(directory);
+
+  // Create the first recording that does not exist yet
+  char path[32];
+  int result = LFS_ERR_EXIST;
+  for (uint8_t index = 0; index < maxRecordings && result == LFS_ERR_EXIST; index++) {
+    RecordingPath(index, path, sizeof(path));
+    result = fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
+  }
+  if (result != LFS_ERR_OK) {
+    NRF_LOG_WARNING("[PpgRecorder] Failed to create a new recording (%d)", result);
+    return false;
+  }
+  Header header {formatVersion, sizeof(Record), sampleRate, 0};
+  if (fs.FileWrite(&file, reinterpret_cast<const uint8_t*>(&header), sizeof(header)) != static_cast<int>(sizeof(header))) {
+    fs.FileClose(&file);
+    fs.FileDelete(path);
+    return false;
+  }
+  size = sizeof(header);
+  fileOpen = true;
+  NRF_LOG_INFO("[PpgRecorder] Recording to %s", path);
+  return true;
+}
+
+// Returns false once the recording can't grow anymore (maximum size reached, most likely out of space otherwise)
+bool PpgRecorder::WriteRecords() {
+  taskENTER_CRITICAL();
+  const uint16_t end = head;
+  taskEXIT_CRITICAL();
+
+  while (tail != end) {
+    // Contiguous records only, the buffer wraps around
+    const uint16_t first = tail % bufferLength;
+    const uint16_t count = std::min<uint16_t>(end - tail, bufferLength - first);
+    const uint32_t length = count * sizeof(Record);
+    if (size + length > maxRecordingSize ||
+        fs.FileWrite(&file, reinterpret_cast<const uint8_t*>(&buffer[first]), length) != static_cast<int>(length)) {
+      return false;
+    }
+    size += length;
+    taskENTER_CRITICAL();
+    tail += count;
+    taskEXIT_CRITICAL();
+  }
+  return true;
+}
+
+void PpgRecorder::Close() {
+  if (!fileOpen) {
+    return;
+  }
+  fs.FileClose(&file);
+  fileOpen = false;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "components/fs/FS.h"
+
+namespace Pinetime {
+  namespace System {
+    class SystemTask;
+  }
+
+  namespace Controllers {
+    // Records the raw samples of a heart rate measurement (HRS, ALS and accelerometer) to the file system, so that
+    // the processing can be replayed and benchmarked offline (see tools/ppg-replay).
+    //
+    // Each measurement is written to /.system/ppg/<n>.ppg, <n> being the first unused index. Nothing is recorded
+    // when all the indices are used: the recordings are meant to be retrieved and deleted with the FS service.
+    // The file format is described in doc/PpgRecording.md.
+    //
+    // Start(), Add() and Stop() are called by the heart rate task and never access the file system: the samples are
+    // buffered and SystemTask is asked to write them with Flush(), so that the small stack of the heart rate task
+    // doesn't have to accommodate littlefs.
+    class PpgRecorder {
+    public:
+      explicit PpgRecorder(Controllers::FS& fs);
+
+      void Register(System::SystemTask* systemTask);
+
+      // Returns false if the previous recording is not closed yet
+      bool Start(uint16_t sampleRate);
+      // time: sampling time, in ticks (1/1024s, only the lower 16 bits are stored)
+      void Add(uint32_t time, uint16_t hrs, uint16_t als, int16_t x, int16_t y, int16_t z);
+      void Stop();
+
+      // Called by SystemTask: creates, writes and closes the recording file
+      void Flush();
+
+      static constexpr uint8_t formatVersion = 1;
+      static constexpr uint8_t maxRecordings = 8;
+      // A recording is truncated once it reaches this size (~14 minutes at 25Hz)
+      static constexpr uint32_t maxRecordingSize = 256 * 1024;
+
+    private:
+      static constexpr const char* directory = "/.system/ppg";
+
+      struct __attribute__((packed)) Header {
+        uint8_t version;
+        uint8_t recordSize;
+        uint16_t sampleRate;
+        uint32_t reserved;
+      };
+
+      struct __attribute__((packed)) Record {
+        uint16_t time;
+        uint16_t hrs;
+        uint16_t als;
+        int16_t x;
+        int16_t y;
+        int16_t z;
+      };
+
+      static_assert(sizeof(Record) == 12, "Records are stored as-is in the recording");
+
+      enum class States : uint8_t { Idle, Starting, Recording, Stopping };
+
+#ifdef HEARTRATE_RECORDING
+      // SystemTask is asked to write the records once flushThreshold of them are buffered (1.28s at 25Hz), the rest
+      // of the buffer leaves it the same amount of time to do so before samples are dropped.
+      static constexpr uint16_t bufferLength = 64;
+      static constexpr uint16_t flushThreshold = 32;
+#else
+      // Nothing is ever recorded
+      static constexpr uint16_t bufferLength = 1;
+      static constexpr uint16_t flushThreshold = 1;
+#endif
+
+      static void RecordingPath(uint8_t index, char* path, size_t length);
+      void RequestFlush();
+      bool Open();
+      bool WriteRecords();
+      void Close();
+
+      Controllers::FS& fs;
+      System::SystemTask* systemTask = nullptr;
+
+      // Shared by the heart rate task and SystemTask, accessed in critical sections
+      States state = States::Idle;
+      uint16_t sampleRate = 0;
+      // Records [tail, head) (modulo bufferLength) are waiting to be written. head is only updated by Add(), tail by Flush().
+      Record buffer[bufferLength];
+      uint16_t head = 0;
+      uint16_t tail = 0;
+
+      // Only used by SystemTask
+      lfs_file_t file;
+      bool fileOpen = false;
+      uint32_t size = 0;
+    };
+  }
+}
@@ -0,0 +1,139 @@
+#include "components/history/HistoryController.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <libraries/log/nrf_log.h>
+
+#include "components/battery/BatteryController.h"
+#include "components/datetime/DateTimeController.h"
+#include "components/heartrate/HeartRateController.h"
+#include "components/motion/MotionController.h"
+
+using namespace Pinetime::Controllers;
+
+namespace {
+  // Counters that are reset once a day: a value lower than the previous one means the counter was reset in-between
+  uint32_t CounterDelta(uint32_t current, uint32_t previous) {
+    return current >= previous ? current - previous : current;
+  }
+}
+
+HistoryController::HistoryController(Controllers::FS& fs,
+                                     Controllers::DateTime& dateTimeController,
+                                     Controllers::MotionController& motionController,
+                                     Controllers::HeartRateController& heartRateController,
+                                     Controllers::Battery& batteryController)
+  : fs {fs},
+    dateTimeController {dateTimeController},
+    motionController {motionController},
+    heartRateController {heartRateController},
+    batteryController {batteryController} {
+}
+
+void HistoryController::Init() {
+  lastSteps = motionController.NbSteps();
+  lastLightMinutes = motionController.Activity().LightMinutes();
+  lastVigorousMinutes = motionController.Activity().VigorousMinutes();
+}
+
+void HistoryController::LogHour() {
+  const auto now = std::chrono::duration_cast<std::chrono::seconds>(dateTimeController.UTCDateTime().time_since_epoch()).count();
+  const uint32_t currentHour = static_cast<uint32_t>(now) / secondsPerHour;
+  if (currentHour == 0) {
+    return;
+  }
+
+  const uint32_t steps = motionController.NbSteps();
+  const uint16_t lightMinutes = motionController.Activity().LightMinutes();
+  const uint16_t vigorousMinutes = motionController.Activity().VigorousMinutes();
+  const auto heartRate = heartRateController.TakeSummary();
+
+  Record record {};
+  record.batteryPercent = batteryController.PercentRemaining();
+  record.steps = std::min<uint32_t>(CounterDelta(steps, lastSteps), UINT16_MAX);
+  record.heartRateAverage = heartRate.average;
+  record.heartRateMax = heartRate.max;
+  record.lightMinutes = std::min<uint32_t>(CounterDelta(lightMinutes, lastLightMinutes), UINT8_MAX);
+  record.vigorousMinutes = std::min<uint32_t>(CounterDelta(vigorousMinutes, lastVigorousMinutes), UINT8_MAX);
+
+  lastSteps = steps;
+  lastLightMinutes = lightMinutes;
+  lastVigorousMinutes = vigorousMinutes;
+
+  // Timestamp the record with the start of the hour that just ended
+  Append((currentHour - 1) * secondsPerHour, record);
+}
+
+void HistoryController::SegmentPath(uint32_t week, char* path, size_t length) {
+  snprintf(path, length, "%s/%lu.dat", directory, static_cast<unsigned long>(week));
+}
+
+bool HistoryController::Append(uint32_t timestamp, const Record& record) {
+  const uint32_t week = timestamp / secondsPerWeek;
+  char path[32];
+  SegmentPath(week, path, sizeof(path));
+
+  lfs_file_t file;
+  if (fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) != LFS_ERR_OK) {
+    // The directories are only missing on the very first append
+    fs.DirCreate("/.system");
+    fs.DirCreate(directory);
+    if (fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) != LFS_ERR_OK) {
+      NRF_LOG_WARNING("[HistoryController] Failed to open %s", path);
+      return false;
+    }
+  }
+
+  if (fs.FileSize(&file) == 0) {
+    Header header {formatVersion, sizeof(Record), 0, week * secondsPerWeek};
+    if (fs.FileWrite(&file, reinterpret_cast<const uint8_t*>(&header), sizeof(header)) != static_cast<int>(sizeof(header))) {
+      // Records appended after a missing or partial header could not be read back, start the segment over next time
+      NRF_LOG_WARNING("[HistoryController] Failed to write the header of %s", path);
+      fs.FileClose(&file);
+      fs.FileDelete(path);
+      return false;
+    }
+    DeleteExpiredSegments(week);
+  }
+
+  Record stored = record;
+  stored.hour = static_cast<uint8_t>((timestamp - (week * secondsPerWeek)) / secondsPerHour);
+  const int written = fs.FileWrite(&file, reinterpret_cast<const uint8_t*>(&stored), sizeof(stored));
+  fs.FileClose(&file);
+  return written == static_cast<int>(sizeof(stored));
+}
+
+void HistoryController::DeleteExpiredSegments(uint32_t currentWeek) {
+  if (currentWeek < retentionWeeks) {
+    return;
+  }
+
+  // Removing entries while iterating over a directory is not supported, collect them first
+  static constexpr size_t maxExpired = 8;
+  uint32_t expired[maxExpired];
+  size_t nbExpired = 0;
+
+  lfs_dir_t dir;
+  if (fs.DirOpen(directory, &dir) != LFS_ERR_OK) {
+    return;
+  }
+  lfs_info info;
+  while (nbExpired < maxExpired && fs.DirRead(&dir, &info) > 0) {
+    if (info.type != LFS_TYPE_REG) {
+      continue;
+    }
+    const uint32_t week = strtoul(info.name, nullptr, 10);
+    if (week <= currentWeek - retentionWeeks) {
+      expired[nbExpired++] = week;
+    }
+  }
+  fs.DirClose(&dir);
+
+  char path[32];
+  for (size_t i = 0; i < nbExpired; i++) {
+    SegmentPath(expired[i], path, sizeof(path));
+    fs.FileDelete(path);
+  }
+}
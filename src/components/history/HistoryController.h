@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "components/fs/FS.h"
+
+namespace Pinetime {
+  namespace Controllers {
+    class Battery;
+    class DateTime;
+    class HeartRateController;
+    class MotionController;
+
+    // Append-only log of hourly summaries (steps, heart rate, battery, activity minutes) stored in littlefs.
+    //
+    // The log is split in one segment file per week (/.system/history/<week>.dat, <week> being the number of weeks
+    // since the epoch), so that a range of time maps directly to a handful of files and old data is dropped a whole
+    // segment at a time. Each segment starts with a Header followed by fixed-size Records whose timestamp is
+    // delta-encoded as the number of hours since the start of the segment.
+    // The segments can be retrieved over BLE with the FS service (LISTDIR/READ on /.system/history).
+    class HistoryController {
+    public:
+      HistoryController(Controllers::FS& fs,
+                        Controllers::DateTime& dateTimeController,
+                        Controllers::MotionController& motionController,
+                        Controllers::HeartRateController& heartRateController,
+                        Controllers::Battery& batteryController);
+
+      void Init();
+
+      // Summarizes the hour that just ended and appends it to the log.
+      // The flash must be awake when this is called.
+      void LogHour();
+
+      static constexpr uint8_t formatVersion = 1;
+      // Number of weekly segments kept on flash
+      static constexpr uint32_t retentionWeeks = 12;
+
+    private:
+      static constexpr uint32_t secondsPerHour = 60 * 60;
+      static constexpr uint32_t secondsPerWeek = 7 * 24 * secondsPerHour;
+      static constexpr const char* directory = "/.system/history";
+
+      struct __attribute__((packed)) Header {
+        uint8_t version;
+        uint8_t recordSize;
+        uint16_t reserved;
+        uint32_t startTime;
+      };
+
+      struct __attribute__((packed)) Record {
+        uint8_t hour; // hours since Header::startTime
+        uint8_t batteryPercent;
+        uint16_t steps;
+        uint8_t heartRateAverage;
+        uint8_t heartRateMax;
+        uint8_t lightMinutes;
+        uint8_t vigorousMinutes;
+      };
+
+      static_assert(sizeof(Record) == 8, "Records are stored as-is in the log");
+
+      Controllers::FS& fs;
+      Controllers::DateTime& dateTimeController;
+      Controllers::MotionController& motionController;
+      Controllers::HeartRateController& heartRateController;
+      Controllers::Battery& batteryController;
+
+      uint32_t lastSteps = 0;
+      uint16_t lastLightMinutes = 0;
+      uint16_t lastVigorousMinutes = 0;
+
+      static void SegmentPath(uint32_t week, char* path, size_t length);
+      bool Append(uint32_t timestamp, const Record& record);
+      void DeleteExpiredSegments(uint32_t currentWeek);
+    };
+  }
+}
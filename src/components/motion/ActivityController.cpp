@@ -0,0 +1,94 @@
+#include "components/motion/ActivityController.h"
+
+#include <algorithm>
+
+#include "utility/Math.h"
+
+using namespace Pinetime::Controllers;
+
+void ActivityController::Update(int16_t x, int16_t y, int16_t z, TickType_t time) {
+  if (!started) {
+    minuteStart = time;
+    started = true;
+  }
+
+  // Close the current minute, and fill in the minutes during which no sample was received (sensor off)
+  if (time - minuteStart >= minuteTicks) {
+    uint8_t count = noData;
+    if (sampleCount > 0) {
+      count = std::min<uint32_t>(magnitudeSum / sampleCount / 4, noData - 1);
+    }
+    CloseMinute(count);
+    minuteStart += minuteTicks;
+
+    TickType_t missed = (time - minuteStart) / minuteTicks;
+    for (TickType_t i = 0; i < std::min<TickType_t>(missed, historyLength); i++) {
+      CloseMinute(noData);
+    }
+    minuteStart += missed * minuteTicks;
+
+    magnitudeSum = 0;
+    sampleCount = 0;
+  }
+
+  uint32_t squared = static_cast<uint32_t>(x * x) + static_cast<uint32_t>(y * y) + static_cast<uint32_t>(z * z);
+  uint16_t magnitude = Utility::Sqrt(squared);
+  if (sampleCount < UINT16_MAX) {
+    if (magnitude > oneG) {
+      magnitudeSum += magnitude - oneG;
+    }
+    sampleCount++;
+  }
+}
+
+void ActivityController::CloseMinute(uint8_t count) {
+  history++;
+  history[0] = count;
+  if (nbMinutes < historyLength) {
+    nbMinutes++;
+  }
+
+  switch (Classify(count)) {
+    case Intensity::Sedentary:
+      sedentaryMinutes++;
+      break;
+    case Intensity::Light:
+      lightMinutes++;
+      break;
+    case Intensity::Vigorous:
+      vigorousMinutes++;
+      break;
+    default:
+      break;
+  }
+}
+
+void ActivityController::ResetDailyMinutes() {
+  sedentaryMinutes = 0;
+  lightMinutes = 0;
+  vigorousMinutes = 0;
+}
+
+uint8_t ActivityController::ActivityCount(size_t minutesAgo) const {
+  if (minutesAgo >= nbMinutes) {
+    return noData;
+  }
+  return history[historyLength - minutesAgo];
+}
+
+ActivityController::Intensity ActivityController::MinuteIntensity(size_t minutesAgo) const {
+  return Classify(ActivityCount(minutesAgo));
+}
+
+ActivityController::Intensity ActivityController::Classify(uint8_t count) {
+  if (count == noData) {
+    return Intensity::Unknown;
+  }
+  if (count >= vigorousThreshold) {
+    return Intensity::Vigorous;
+  }
+  if (count >= lightThreshold) {
+    return Intensity::Light;
+  }
+  return Intensity::Sedentary;
+}
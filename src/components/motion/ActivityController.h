@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <FreeRTOS.h>
+
+#include "utility/CircularBuffer.h"
+
+namespace Pinetime {
+  namespace Controllers {
+    // Condenses the accelerometer samples into one activity count per minute.
+    // The count of a minute is the mean of the vector magnitude of the acceleration minus 1g
+    // (clamped to 0), in units of 4 'binary milli-g' (1g = 1024).
+    class ActivityController {
+    public:
+      enum class Intensity : uint8_t { Unknown, Sedentary, Light, Vigorous };
+
+      // Number of completed minutes kept in the history
+      static constexpr size_t historyLength = 120;
+      // Count stored for minutes during which no sample was received
+      static constexpr uint8_t noData = UINT8_MAX;
+
+      void Update(int16_t x, int16_t y, int16_t z, TickType_t time);
+      void ResetDailyMinutes();
+
+      // Activity count of the completed minute that ended minutesAgo minutes before the current one
+      // (0 is the most recently completed minute), or noData
+      uint8_t ActivityCount(size_t minutesAgo) const;
+      Intensity MinuteIntensity(size_t minutesAgo) const;
+
+      uint16_t SedentaryMinutes() const {
+        return sedentaryMinutes;
+      }
+
+      uint16_t LightMinutes() const {
+        return lightMinutes;
+      }
+
+      uint16_t VigorousMinutes() const {
+        return vigorousMinutes;
+      }
+
+      static Intensity Classify(uint8_t count);
+
+    private:
+      // ~45 mg and ~100 mg, the usual wrist-worn thresholds for light and moderate-to-vigorous activity
+      static constexpr uint8_t lightThreshold = 11;
+      static constexpr uint8_t vigorousThreshold = 25;
+      static constexpr uint16_t oneG = 1024;
+      static constexpr TickType_t minuteTicks = 60 * configTICK_RATE_HZ;
+
+      void CloseMinute(uint8_t count);
+
+      TickType_t minuteStart = 0;
+      bool started = false;
+      uint32_t magnitudeSum = 0;
+      uint16_t sampleCount = 0;
+
+      uint16_t sedentaryMinutes = 0;
+      uint16_t lightMinutes = 0;
+      uint16_t vigorousMinutes = 0;
+
+      Utility::CircularBuffer<uint8_t, historyLength> history = {};
+      size_t nbMinutes = 0;
+    };
+  }
+}
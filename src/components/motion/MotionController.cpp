@@ -54,8 +54,20 @@ void MotionController::Update(int16_t x, int16_t y, int16_t z, uint32_t nbSteps)
   zHistory++;
   zHistory[0] = z;
 
+  // The current window tracks the newest samples, the previous window the oldest ones of the history
+  xStats.Push(x);
+  yStats.Push(y);
+  zStats.Push(z);
+  prevXStats.Push(xHistory[AccelStats::numHistory]);
+  prevYStats.Push(yHistory[AccelStats::numHistory]);
+  prevZStats.Push(zHistory[AccelStats::numHistory]);
+
   stats = GetAccelStats();
 
+#ifndef PINETIME_IS_RECOVERY
+  activity.Update(x, y, z, time);
+#endif
+
   int32_t deltaSteps = nbSteps - this->nbSteps;
   if (deltaSteps > 0) {
     currentTripSteps += deltaSteps;
@@ -66,29 +78,16 @@ void MotionController::Update(int16_t x, int16_t y, int16_t z, uint32_t nbSteps)
 MotionController::AccelStats MotionController::GetAccelStats() const {
   AccelStats stats;
 
-  for (uint8_t i = 0; i < AccelStats::numHistory; i++) {
-    stats.xMean += xHistory[histSize - i];
-    stats.yMean += yHistory[histSize - i];
-    stats.zMean += zHistory[histSize - i];
-    stats.prevXMean += xHistory[1 + i];
-    stats.prevYMean += yHistory[1 + i];
-    stats.prevZMean += zHistory[1 + i];
-  }
-  stats.xMean /= AccelStats::numHistory;
-  stats.yMean /= AccelStats::numHistory;
-  stats.zMean /= AccelStats::numHistory;
-  stats.prevXMean /= AccelStats::numHistory;
-  stats.prevYMean /= AccelStats::numHistory;
-  stats.prevZMean /= AccelStats::numHistory;
-
-  for (uint8_t i = 0; i < AccelStats::numHistory; i++) {
-    stats.xVariance += (xHistory[histSize - i] - stats.xMean) * (xHistory[histSize - i] - stats.xMean);
-    stats.yVariance += (yHistory[histSize - i] - stats.yMean) * (yHistory[histSize - i] - stats.yMean);
-    stats.zVariance += (zHistory[histSize - i] - stats.zMean) * (zHistory[histSize - i] - stats.zMean);
-  }
-  stats.xVariance /= AccelStats::numHistory;
-  stats.yVariance /= AccelStats::numHistory;
-  stats.zVariance /= AccelStats::numHistory;
+  stats.xMean = xStats.Mean();
+  stats.yMean = yStats.Mean();
+  stats.zMean = zStats.Mean();
+  stats.prevXMean = prevXStats.Mean();
+  stats.prevYMean = prevYStats.Mean();
+  stats.prevZMean = prevZStats.Mean();
+
+  stats.xVariance = xStats.Variance();
+  stats.yVariance = yStats.Variance();
+  stats.zVariance = zStats.Variance();
 
   return stats;
 }
@@ -6,7 +6,9 @@
 
 #include "drivers/Bma421.h"
 #include "components/ble/MotionService.h"
+#include "components/motion/ActivityController.h"
 #include "utility/CircularBuffer.h"
+#include "utility/SlidingWindowStatistics.h"
 
 namespace Pinetime {
   namespace Controllers {
@@ -32,6 +34,11 @@ namespace Pinetime {
         return zHistory[0];
       }
 
+      // Tick count of the last update of X(), Y() and Z()
+      TickType_t LastUpdateTime() const {
+        return time;
+      }
+
       uint32_t NbSteps() const {
         return nbSteps;
       }
@@ -66,6 +73,16 @@ namespace Pinetime {
         return service;
       }
 
+#ifndef PINETIME_IS_RECOVERY
+      ActivityController& Activity() {
+        return activity;
+      }
+
+      const ActivityController& Activity() const {
+        return activity;
+      }
+#endif
+
     private:
       uint32_t nbSteps = 0;
       uint32_t currentTripSteps = 0;
@@ -96,8 +113,21 @@ namespace Pinetime {
       Utility::CircularBuffer<int16_t, histSize> xHistory = {};
       Utility::CircularBuffer<int16_t, histSize> yHistory = {};
       Utility::CircularBuffer<int16_t, histSize> zHistory = {};
+      static_assert(AccelStats::numHistory < histSize, "The statistics windows must fit in the history");
+
+      using AxisStats = Utility::SlidingWindowStatistics<int16_t, AccelStats::numHistory>;
+      AxisStats xStats;
+      AxisStats yStats;
+      AxisStats zStats;
+      AxisStats prevXStats;
+      AxisStats prevYStats;
+      AxisStats prevZStats;
       int32_t accumulatedSpeed = 0;
 
+#ifndef PINETIME_IS_RECOVERY
+      ActivityController activity;
+#endif
+
       DeviceTypes deviceType = DeviceTypes::Unknown;
       Pinetime::Controllers::MotionService* service = nullptr;
     };
@@ -22,6 +22,9 @@ namespace {
     return "";
   }
 
+  // Minimum number of consecutive RR intervals for the heart rate variability to be shown
+  constexpr uint8_t minVariabilityIntervals = 8;
+
   void btnStartStopEventHandler(lv_obj_t* obj, lv_event_t event) {
     auto* screen = static_cast<HeartRate*>(obj->user_data);
     screen->OnStartStopEvent(event);
@@ -91,7 +94,12 @@ void HeartRate::Refresh() {
       }
   }
 
-  lv_label_set_text_static(label_status, ToString(state));
+  auto variability = heartRateController.HeartRateVariability();
+  if (state == Controllers::HeartRateController::States::Running && variability.nbIntervals >= minVariabilityIntervals) {
+    lv_label_set_text_fmt(label_status, "%s\nHRV %d ms", ToString(state), variability.rmssd);
+  } else {
+    lv_label_set_text_static(label_status, ToString(state));
+  }
   lv_obj_align(label_status, label_hr, LV_ALIGN_OUT_BOTTOM_MID, 0, 10);
 }
 
@@ -68,6 +68,20 @@ void Hrs3300::Disable() {
   WriteRegister(static_cast<uint8_t>(Registers::PDriver), 0);
 }
 
+void Hrs3300::SetConversionPeriod(ConversionPeriod period) {
+  // Wait time in bits 4-6 of the Enable register, resolution (8 + n bits) of HRS and ALS in the Res register
+  uint8_t waitTime = 0x50;
+  uint8_t resolution = 0x77;
+  if (period == ConversionPeriod::Ms25) {
+    waitTime = 0x70;
+    resolution = 0x66;
+  }
+  auto value = ReadRegister(static_cast<uint8_t>(Registers::Enable));
+  value = (value & ~0x70) | waitTime;
+  WriteRegister(static_cast<uint8_t>(Registers::Enable), value);
+  WriteRegister(static_cast<uint8_t>(Registers::Res), resolution);
+}
+
 Hrs3300::PackedHrsAls Hrs3300::ReadHrsAls() {
   constexpr Registers dataRegisters[] =
     {Registers::C1dataM, Registers::C0DataM, Registers::C0DataH, Registers::C1dataH, Registers::C1dataL, Registers::C0dataL};
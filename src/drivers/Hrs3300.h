@@ -21,6 +21,13 @@ namespace Pinetime {
         Hgain = 0x17
       };
 
+      // The sensor converts continuously while enabled, the conversion period is set by the resolution of the ADC
+      // and the wait time between conversions
+      enum class ConversionPeriod : uint8_t {
+        Ms100, // 15 bits, 50ms wait time
+        Ms25,  // 14 bits, no wait time
+      };
+
       struct PackedHrsAls {
         uint16_t hrs;
         uint16_t als;
@@ -35,6 +42,7 @@ namespace Pinetime {
       void Init();
       void Enable();
       void Disable();
+      void SetConversionPeriod(ConversionPeriod period);
       PackedHrsAls ReadHrsAls();
 
     private:
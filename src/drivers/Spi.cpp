@@ -4,17 +4,21 @@
 
 using namespace Pinetime::Drivers;
 
-Spi::Spi(SpiMaster& spiMaster, uint8_t pinCsn) : spiMaster {spiMaster}, pinCsn {pinCsn} {
+Spi::Spi(SpiMaster& spiMaster, uint8_t pinCsn) : Spi(spiMaster, pinCsn, spiMaster.DefaultDeviceParameters()) {
+}
+
+Spi::Spi(SpiMaster& spiMaster, uint8_t pinCsn, const SpiMaster::DeviceParameters& parameters)
+  : spiMaster {spiMaster}, pinCsn {pinCsn}, parameters {parameters} {
   nrf_gpio_cfg_output(pinCsn);
   nrf_gpio_pin_set(pinCsn);
 }
 
 bool Spi::Write(const uint8_t* data, size_t size, const std::function<void()>& preTransactionHook) {
-  return spiMaster.Write(pinCsn, data, size, preTransactionHook);
+  return spiMaster.Write(pinCsn, parameters, data, size, preTransactionHook);
 }
 
 bool Spi::Read(uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize) {
-  return spiMaster.Read(pinCsn, cmd, cmdSize, data, dataSize);
+  return spiMaster.Read(pinCsn, parameters, cmd, cmdSize, data, dataSize);
 }
 
 void Spi::Sleep() {
@@ -23,7 +27,7 @@ void Spi::Sleep() {
 }
 
 bool Spi::WriteCmdAndBuffer(const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize) {
-  return spiMaster.WriteCmdAndBuffer(pinCsn, cmd, cmdSize, data, dataSize);
+  return spiMaster.WriteCmdAndBuffer(pinCsn, parameters, cmd, cmdSize, data, dataSize);
 }
 
 bool Spi::Init() {
@@ -9,6 +9,7 @@ namespace Pinetime {
     class Spi {
     public:
       Spi(SpiMaster& spiMaster, uint8_t pinCsn);
+      Spi(SpiMaster& spiMaster, uint8_t pinCsn, const SpiMaster::DeviceParameters& parameters);
       Spi(const Spi&) = delete;
       Spi& operator=(const Spi&) = delete;
       Spi(Spi&&) = delete;
@@ -24,6 +25,7 @@ namespace Pinetime {
     private:
       SpiMaster& spiMaster;
       uint8_t pinCsn;
+      SpiMaster::DeviceParameters parameters;
     };
   }
 }
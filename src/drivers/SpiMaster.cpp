@@ -40,27 +40,50 @@ bool SpiMaster::Init() {
   spiBaseAddress->PSELMOSI = params.pinMOSI;
   spiBaseAddress->PSELMISO = params.pinMISO;
 
-  uint32_t frequency;
-  switch (params.Frequency) {
+  currentFrequency = FrequencyRegister(params.Frequency);
+  currentConfig = ConfigRegister(params.mode);
+  spiBaseAddress->FREQUENCY = currentFrequency;
+  spiBaseAddress->CONFIG = currentConfig;
+  spiBaseAddress->EVENTS_ENDRX = 0;
+  spiBaseAddress->EVENTS_ENDTX = 0;
+  spiBaseAddress->EVENTS_END = 0;
+
+  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 6);
+  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 1);
+  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 19);
+
+  spiBaseAddress->ENABLE = (SPIM_ENABLE_ENABLE_Enabled << SPIM_ENABLE_ENABLE_Pos);
+
+  NRFX_IRQ_PRIORITY_SET(SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn, 2);
+  NRFX_IRQ_ENABLE(SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn);
+
+  xSemaphoreGive(mutex);
+  return true;
+}
+
+uint32_t SpiMaster::FrequencyRegister(Frequencies frequency) {
+  switch (frequency) {
+    case Frequencies::Freq125Khz:
+      return 0x02000000;
+    case Frequencies::Freq250Khz:
+      return 0x04000000;
+    case Frequencies::Freq500Khz:
+      return 0x08000000;
+    case Frequencies::Freq1Mhz:
+      return 0x10000000;
+    case Frequencies::Freq2Mhz:
+      return 0x20000000;
+    case Frequencies::Freq4Mhz:
+      return 0x40000000;
     case Frequencies::Freq8Mhz:
-      frequency = 0x80000000;
-      break;
     default:
-      return false;
+      return 0x80000000;
   }
-  spiBaseAddress->FREQUENCY = frequency;
+}
 
-  uint32_t regConfig = 0;
-  switch (params.bitOrder) {
-    case BitOrder::Msb_Lsb:
-      break;
-    case BitOrder::Lsb_Msb:
-      regConfig = 1;
-      break;
-    default:
-      return false;
-  }
-  switch (params.mode) {
+uint32_t SpiMaster::ConfigRegister(Modes mode) const {
+  uint32_t regConfig = (params.bitOrder == BitOrder::Lsb_Msb) ? 1 : 0;
+  switch (mode) {
     case Modes::Mode0:
       break;
     case Modes::Mode1:
@@ -72,26 +95,25 @@ bool SpiMaster::Init() {
     case Modes::Mode3:
       regConfig |= (0x03 << 1);
       break;
-    default:
-      return false;
   }
+  return regConfig;
+}
 
-  spiBaseAddress->CONFIG = regConfig;
-  spiBaseAddress->EVENTS_ENDRX = 0;
-  spiBaseAddress->EVENTS_ENDTX = 0;
-  spiBaseAddress->EVENTS_END = 0;
-
-  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 6);
-  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 1);
-  spiBaseAddress->INTENSET = ((unsigned) 1 << (unsigned) 19);
-
-  spiBaseAddress->ENABLE = (SPIM_ENABLE_ENABLE_Enabled << SPIM_ENABLE_ENABLE_Pos);
-
-  NRFX_IRQ_PRIORITY_SET(SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn, 2);
-  NRFX_IRQ_ENABLE(SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn);
+// Called with the mutex taken: the previous transaction is over and the SPIM is idle, so the clock and the mode can
+// change before the chip select of the device is asserted.
+void SpiMaster::SelectDevice(uint8_t pinCsn, const DeviceParameters& device) {
+  this->pinCsn = pinCsn;
 
-  xSemaphoreGive(mutex);
-  return true;
+  const uint32_t frequency = FrequencyRegister(device.frequency);
+  if (frequency != currentFrequency) {
+    spiBaseAddress->FREQUENCY = frequency;
+    currentFrequency = frequency;
+  }
+  const uint32_t config = ConfigRegister(device.mode);
+  if (config != currentConfig) {
+    spiBaseAddress->CONFIG = config;
+    currentConfig = config;
+  }
 }
 
 void SpiMaster::SetupWorkaroundForErratum58() {
@@ -136,21 +158,21 @@ void SpiMaster::DisableWorkaroundForErratum58() {
 }
 
 void SpiMaster::OnEndEvent() {
-  if (currentBufferAddr == 0) {
+  if (currentBuffer == nullptr) {
     return;
   }
 
   auto s = currentBufferSize;
   if (s > 0) {
-    auto currentSize = std::min((size_t) 255, s);
-    PrepareTx(currentBufferAddr, currentSize);
-    currentBufferAddr = currentBufferAddr + currentSize;
+    auto currentSize = std::min(maxTransferSize, s);
+    PrepareTx(currentBuffer, currentSize);
+    currentBuffer = currentBuffer + currentSize;
     currentBufferSize = currentBufferSize - currentSize;
 
     spiBaseAddress->TASKS_START = 1;
   } else {
     nrf_gpio_pin_set(this->pinCsn);
-    currentBufferAddr = 0;
+    currentBuffer = nullptr;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     xSemaphoreGiveFromISR(mutex, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
@@ -160,8 +182,14 @@ void SpiMaster::OnEndEvent() {
 void SpiMaster::OnStartedEvent() {
 }
 
-void SpiMaster::PrepareTx(const uint32_t bufferAddress, const size_t size) {
-  spiBaseAddress->TXD.PTR = bufferAddress;
+// EasyDMA addresses are 32 bits: the conversion is exact on the nRF52. On a 64-bit host, where the registers are only
+// a model (tools/fs-bench/spim-stub), the address is truncated and never dereferenced.
+uint32_t SpiMaster::DmaAddress(const uint8_t* buffer) {
+  return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(buffer));
+}
+
+void SpiMaster::PrepareTx(const uint8_t* buffer, size_t size) {
+  spiBaseAddress->TXD.PTR = DmaAddress(buffer);
   spiBaseAddress->TXD.MAXCNT = size;
   spiBaseAddress->TXD.LIST = 0;
   spiBaseAddress->RXD.PTR = 0;
@@ -170,23 +198,27 @@ void SpiMaster::PrepareTx(const uint32_t bufferAddress, const size_t size) {
   spiBaseAddress->EVENTS_END = 0;
 }
 
-void SpiMaster::PrepareRx(const uint32_t bufferAddress, const size_t size) {
+void SpiMaster::PrepareRx(uint8_t* buffer, size_t size) {
   spiBaseAddress->TXD.PTR = 0;
   spiBaseAddress->TXD.MAXCNT = 0;
   spiBaseAddress->TXD.LIST = 0;
-  spiBaseAddress->RXD.PTR = bufferAddress;
+  spiBaseAddress->RXD.PTR = DmaAddress(buffer);
   spiBaseAddress->RXD.MAXCNT = size;
   spiBaseAddress->RXD.LIST = 0;
   spiBaseAddress->EVENTS_END = 0;
 }
 
-bool SpiMaster::Write(uint8_t pinCsn, const uint8_t* data, size_t size, const std::function<void()>& preTransactionHook) {
+bool SpiMaster::Write(uint8_t pinCsn,
+                      const DeviceParameters& device,
+                      const uint8_t* data,
+                      size_t size,
+                      const std::function<void()>& preTransactionHook) {
   if (data == nullptr)
     return false;
   auto ok = xSemaphoreTake(mutex, portMAX_DELAY);
   ASSERT(ok == true);
 
-  this->pinCsn = pinCsn;
+  SelectDevice(pinCsn, device);
 
   if (size == 1) {
     SetupWorkaroundForErratum58();
@@ -199,20 +231,20 @@ bool SpiMaster::Write(uint8_t pinCsn, const uint8_t* data, size_t size, const st
   }
   nrf_gpio_pin_clear(this->pinCsn);
 
-  currentBufferAddr = (uint32_t) data;
+  currentBuffer = data;
   currentBufferSize = size;
 
-  auto currentSize = std::min((size_t) 255, (size_t) currentBufferSize);
-  PrepareTx(currentBufferAddr, currentSize);
+  auto currentSize = std::min(maxTransferSize, (size_t) currentBufferSize);
+  PrepareTx(currentBuffer, currentSize);
   currentBufferSize = currentBufferSize - currentSize;
-  currentBufferAddr = currentBufferAddr + currentSize;
+  currentBuffer = currentBuffer + currentSize;
   spiBaseAddress->TASKS_START = 1;
 
   if (size == 1) {
     while (spiBaseAddress->EVENTS_END == 0)
       ;
     nrf_gpio_pin_set(this->pinCsn);
-    currentBufferAddr = 0;
+    currentBuffer = nullptr;
 
     DisableWorkaroundForErratum58();
 
@@ -222,10 +254,10 @@ bool SpiMaster::Write(uint8_t pinCsn, const uint8_t* data, size_t size, const st
   return true;
 }
 
-bool SpiMaster::Read(uint8_t pinCsn, uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize) {
+bool SpiMaster::Read(uint8_t pinCsn, const DeviceParameters& device, uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize) {
   xSemaphoreTake(mutex, portMAX_DELAY);
 
-  this->pinCsn = pinCsn;
+  SelectDevice(pinCsn, device);
   DisableWorkaroundForErratum58();
   spiBaseAddress->INTENCLR = (1 << 6);
   spiBaseAddress->INTENCLR = (1 << 1);
@@ -233,19 +265,25 @@ bool SpiMaster::Read(uint8_t pinCsn, uint8_t* cmd, size_t cmdSize, uint8_t* data
 
   nrf_gpio_pin_clear(this->pinCsn);
 
-  currentBufferAddr = 0;
+  currentBuffer = nullptr;
   currentBufferSize = 0;
 
-  PrepareTx((uint32_t) cmd, cmdSize);
+  PrepareTx(cmd, cmdSize);
   spiBaseAddress->TASKS_START = 1;
   while (spiBaseAddress->EVENTS_END == 0)
     ;
 
-  PrepareRx((uint32_t) data, dataSize);
-  spiBaseAddress->TASKS_START = 1;
+  // EasyDMA transfers at most 255 bytes at a time, the chip select stays low between the transfers
+  while (dataSize > 0) {
+    const size_t size = std::min(maxTransferSize, dataSize);
+    PrepareRx(data, size);
+    spiBaseAddress->TASKS_START = 1;
 
-  while (spiBaseAddress->EVENTS_END == 0)
-    ;
+    while (spiBaseAddress->EVENTS_END == 0)
+      ;
+    data += size;
+    dataSize -= size;
+  }
   nrf_gpio_pin_set(this->pinCsn);
 
   xSemaphoreGive(mutex);
@@ -269,10 +307,11 @@ void SpiMaster::Wakeup() {
   NRF_LOG_INFO("[SPIMASTER] Wakeup");
 }
 
-bool SpiMaster::WriteCmdAndBuffer(uint8_t pinCsn, const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize) {
+bool SpiMaster::WriteCmdAndBuffer(
+  uint8_t pinCsn, const DeviceParameters& device, const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize) {
   xSemaphoreTake(mutex, portMAX_DELAY);
 
-  this->pinCsn = pinCsn;
+  SelectDevice(pinCsn, device);
   DisableWorkaroundForErratum58();
   spiBaseAddress->INTENCLR = (1 << 6);
   spiBaseAddress->INTENCLR = (1 << 1);
@@ -280,19 +319,24 @@ bool SpiMaster::WriteCmdAndBuffer(uint8_t pinCsn, const uint8_t* cmd, size_t cmd
 
   nrf_gpio_pin_clear(this->pinCsn);
 
-  currentBufferAddr = 0;
+  currentBuffer = nullptr;
   currentBufferSize = 0;
 
-  PrepareTx((uint32_t) cmd, cmdSize);
+  PrepareTx(cmd, cmdSize);
   spiBaseAddress->TASKS_START = 1;
   while (spiBaseAddress->EVENTS_END == 0)
     ;
 
-  PrepareTx((uint32_t) data, dataSize);
-  spiBaseAddress->TASKS_START = 1;
+  while (dataSize > 0) {
+    const size_t size = std::min(maxTransferSize, dataSize);
+    PrepareTx(data, size);
+    spiBaseAddress->TASKS_START = 1;
 
-  while (spiBaseAddress->EVENTS_END == 0)
-    ;
+    while (spiBaseAddress->EVENTS_END == 0)
+      ;
+    data += size;
+    dataSize -= size;
+  }
   nrf_gpio_pin_set(this->pinCsn);
 
   xSemaphoreGive(mutex);
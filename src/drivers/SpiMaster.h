@@ -16,7 +16,7 @@ namespace Pinetime {
       enum class SpiModule : uint8_t { SPI0, SPI1 };
       enum class BitOrder : uint8_t { Msb_Lsb, Lsb_Msb };
       enum class Modes : uint8_t { Mode0, Mode1, Mode2, Mode3 };
-      enum class Frequencies : uint8_t { Freq8Mhz };
+      enum class Frequencies : uint8_t { Freq125Khz, Freq250Khz, Freq500Khz, Freq1Mhz, Freq2Mhz, Freq4Mhz, Freq8Mhz };
 
       struct Parameters {
         BitOrder bitOrder;
@@ -27,6 +27,12 @@ namespace Pinetime {
         uint8_t pinMISO;
       };
 
+      // Mode and clock of a device on the bus, applied before its chip select is asserted
+      struct DeviceParameters {
+        Modes mode;
+        Frequencies frequency;
+      };
+
       SpiMaster(const SpiModule spi, const Parameters& params);
       SpiMaster(const SpiMaster&) = delete;
       SpiMaster& operator=(const SpiMaster&) = delete;
@@ -34,10 +40,20 @@ namespace Pinetime {
       SpiMaster& operator=(SpiMaster&&) = delete;
 
       bool Init();
-      bool Write(uint8_t pinCsn, const uint8_t* data, size_t size, const std::function<void()>& preTransactionHook);
-      bool Read(uint8_t pinCsn, uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize);
+      bool Write(uint8_t pinCsn,
+                 const DeviceParameters& device,
+                 const uint8_t* data,
+                 size_t size,
+                 const std::function<void()>& preTransactionHook);
+      bool Read(uint8_t pinCsn, const DeviceParameters& device, uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize);
 
-      bool WriteCmdAndBuffer(uint8_t pinCsn, const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize);
+      bool WriteCmdAndBuffer(
+        uint8_t pinCsn, const DeviceParameters& device, const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize);
+
+      // Mode and clock of the bus, used by the devices that do not specify their own
+      DeviceParameters DefaultDeviceParameters() const {
+        return {params.mode, params.Frequency};
+      }
 
       void OnStartedEvent();
       void OnEndEvent();
@@ -48,16 +64,26 @@ namespace Pinetime {
     private:
       void SetupWorkaroundForErratum58();
       void DisableWorkaroundForErratum58();
-      void PrepareTx(const volatile uint32_t bufferAddress, const volatile size_t size);
-      void PrepareRx(const volatile uint32_t bufferAddress, const volatile size_t size);
+      void PrepareTx(const uint8_t* buffer, size_t size);
+      void PrepareRx(uint8_t* buffer, size_t size);
+      static uint32_t DmaAddress(const uint8_t* buffer);
+      void SelectDevice(uint8_t pinCsn, const DeviceParameters& device);
+      static uint32_t FrequencyRegister(Frequencies frequency);
+      uint32_t ConfigRegister(Modes mode) const;
+
+      // Size of the largest EasyDMA transfer (8-bit MAXCNT on the nRF52832)
+      static constexpr size_t maxTransferSize = 255;
 
       NRF_SPIM_Type* spiBaseAddress;
       uint8_t pinCsn;
 
       SpiMaster::SpiModule spi;
       SpiMaster::Parameters params;
+      // Values of FREQUENCY and CONFIG, only written when the selected device needs other ones
+      uint32_t currentFrequency = 0;
+      uint32_t currentConfig = 0;
 
-      volatile uint32_t currentBufferAddr = 0;
+      const uint8_t* volatile currentBuffer = nullptr;
       volatile size_t currentBufferSize = 0;
       SemaphoreHandle_t mutex = nullptr;
       static constexpr nrf_ppi_channel_t workaroundPpi = NRF_PPI_CHANNEL0;
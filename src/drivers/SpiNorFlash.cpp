@@ -1,4 +1,6 @@
 #include "drivers/SpiNorFlash.h"
+#include <algorithm>
+#include <cstring>
 #include <hal/nrf_gpio.h>
 #include <libraries/delay/nrf_delay.h>
 #include <libraries/log/nrf_log.h>
@@ -6,10 +8,34 @@
 
 using namespace Pinetime::Drivers;
 
+namespace {
+  // Operations started by a task (program, erase) change the state of the driver and of the flash for all the tasks
+  class Lock {
+  public:
+    explicit Lock(SemaphoreHandle_t mutex) : mutex {mutex} {
+      if (mutex != nullptr) {
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+      }
+    }
+
+    ~Lock() {
+      if (mutex != nullptr) {
+        xSemaphoreGiveRecursive(mutex);
+      }
+    }
+
+  private:
+    SemaphoreHandle_t mutex;
+  };
+}
+
 SpiNorFlash::SpiNorFlash(Spi& spi) : spi {spi} {
 }
 
 void SpiNorFlash::Init() {
+  if (mutex == nullptr) {
+    mutex = xSemaphoreCreateRecursiveMutex();
+  }
   device_id = ReadIdentification();
   NRF_LOG_INFO("[SpiNorFlash] Manufacturer : %d, Memory type : %d, memory density : %d",
                device_id.manufacturer,
@@ -21,6 +47,8 @@ void SpiNorFlash::Uninit() {
 }
 
 void SpiNorFlash::Sleep() {
+  Lock lock {mutex};
+  WaitWhileBusy();
   auto cmd = static_cast<uint8_t>(Commands::DeepPowerDown);
   spi.Write(&cmd, sizeof(uint8_t), nullptr);
   NRF_LOG_INFO("[SpiNorFlash] Sleep")
@@ -71,6 +99,36 @@ uint8_t SpiNorFlash::ReadConfigurationRegister() {
 }
 
 void SpiNorFlash::Read(uint32_t address, uint8_t* buffer, size_t size) {
+  Lock lock {mutex};
+  if (address >= readAheadAddress && address < readAheadAddress + readAheadLength) {
+    const size_t count = std::min(size, readAheadLength - (address - readAheadAddress));
+    memcpy(buffer, readAhead + (address - readAheadAddress), count);
+    address += count;
+    buffer += count;
+    size -= count;
+  }
+  if (size == 0) {
+    return;
+  }
+  if (size >= readAheadSize) {
+    ReadFromFlash(address, buffer, size);
+    return;
+  }
+
+  ReadFromFlash(address, readAhead, readAheadSize);
+  readAheadAddress = address;
+  readAheadLength = readAheadSize;
+  memcpy(buffer, readAhead, size);
+}
+
+void SpiNorFlash::ReadFromFlash(uint32_t address, uint8_t* buffer, size_t size) {
+  // Reads outside of the range being erased suspend the erase instead of waiting for it, unless it was suspended too
+  // many times already
+  const bool suspended = pendingOperation == Operation::Erase &&
+                         (address >= eraseAddress + eraseSize || address + size <= eraseAddress) && SuspendErase();
+  if (!suspended) {
+    WaitWhileBusy();
+  }
   static constexpr uint8_t cmdSize = 4;
   uint8_t cmd[cmdSize] = {static_cast<uint8_t>(Commands::Read),
                           static_cast<uint8_t>(address >> 16U),
@@ -79,26 +137,171 @@ void SpiNorFlash::Read(uint32_t address, uint8_t* buffer, size_t size) {
   spi.Read(reinterpret_cast<uint8_t*>(&cmd), cmdSize, buffer, size);
 }
 
+void SpiNorFlash::InvalidateReadAhead() {
+  readAheadLength = 0;
+}
+
 void SpiNorFlash::WriteEnable() {
   auto cmd = static_cast<uint8_t>(Commands::WriteEnable);
   spi.Read(&cmd, sizeof(cmd), nullptr, 0);
 }
 
 void SpiNorFlash::SectorErase(uint32_t sectorAddress) {
+  SectorEraseAsync(sectorAddress);
+  WaitForCompletion();
+}
+
+void SpiNorFlash::SectorEraseAsync(uint32_t sectorAddress) {
+  Lock lock {mutex};
+  StartErase(Commands::SectorErase, sectorAddress, sectorSize, sectorEraseTicks);
+}
+
+void SpiNorFlash::EraseRange(uint32_t address, size_t size) {
+  while (size > 0) {
+    WaitForCompletion();
+    const size_t erased = std::min(EraseAsync(address, size), size);
+    address += erased;
+    size -= erased;
+  }
+  WaitForCompletion();
+}
+
+size_t SpiNorFlash::EraseAsync(uint32_t address, size_t size) {
+  Lock lock {mutex};
+  if (address % block64KSize == 0 && size >= block64KSize) {
+    StartErase(Commands::BlockErase64K, address, block64KSize, block64KEraseTicks);
+    return block64KSize;
+  }
+  if (address % block32KSize == 0 && size >= block32KSize) {
+    StartErase(Commands::BlockErase32K, address, block32KSize, block32KEraseTicks);
+    return block32KSize;
+  }
+  StartErase(Commands::SectorErase, address, sectorSize, sectorEraseTicks);
+  return sectorSize;
+}
+
+void SpiNorFlash::StartErase(Commands command, uint32_t address, size_t size, TickType_t duration) {
   static constexpr uint8_t cmdSize = 4;
-  uint8_t cmd[cmdSize] = {static_cast<uint8_t>(Commands::SectorErase),
-                          static_cast<uint8_t>(sectorAddress >> 16U),
-                          static_cast<uint8_t>(sectorAddress >> 8U),
-                          static_cast<uint8_t>(sectorAddress)};
+  uint8_t cmd[cmdSize] = {static_cast<uint8_t>(command),
+                          static_cast<uint8_t>(address >> 16U),
+                          static_cast<uint8_t>(address >> 8U),
+                          static_cast<uint8_t>(address)};
 
+  WaitWhileBusy();
+  InvalidateReadAhead();
   WriteEnable();
   while (!WriteEnabled())
     vTaskDelay(1);
 
   spi.Read(reinterpret_cast<uint8_t*>(&cmd), cmdSize, nullptr, 0);
+  pendingOperation = Operation::Erase;
+  operationStart = xTaskGetTickCount();
+  eraseAddress = address & ~(size - 1);
+  eraseSize = size;
+  eraseTicks = duration;
+  eraseSuspends = 0;
+  eraseProgressStart = operationStart;
+}
 
+// Suspending takes up to 30us, the flash can then be read (except the range being erased)
+bool SpiNorFlash::SuspendErase() {
+  if (eraseSuspended) {
+    return true;
+  }
+  if (eraseSuspends == maxEraseSuspends) {
+    return false;
+  }
+  // Less than resumeToSuspendMicroseconds may have elapsed within 2 ticks of the start or of the last resume
+  if (xTaskGetTickCount() - eraseProgressStart < 2) {
+    nrf_delay_us(resumeToSuspendMicroseconds);
+  }
+  auto cmd = static_cast<uint8_t>(Commands::EraseSuspend);
+  spi.Read(&cmd, sizeof(cmd), nullptr, 0);
   while (WriteInProgress())
-    vTaskDelay(1);
+    ;
+  eraseSuspended = true;
+  eraseSuspends++;
+  return true;
+}
+
+void SpiNorFlash::ResumeErase() {
+  if (!eraseSuspended) {
+    return;
+  }
+  auto cmd = static_cast<uint8_t>(Commands::EraseResume);
+  spi.Read(&cmd, sizeof(cmd), nullptr, 0);
+  eraseSuspended = false;
+  eraseProgressStart = xTaskGetTickCount();
+}
+
+bool SpiNorFlash::IsBusy() {
+  Lock lock {mutex};
+  if (pendingOperation == Operation::None) {
+    return false;
+  }
+  // The erase was suspended by reads, which are over
+  ResumeErase();
+  if (WriteInProgress()) {
+    return true;
+  }
+  WaitWhileBusy();
+  return false;
+}
+
+void SpiNorFlash::WaitForCompletion() {
+  // Erases are awaited without holding the lock, so that the other tasks can read in the meantime (suspending the erase)
+  while (true) {
+    TickType_t delay = 1;
+    {
+      Lock lock {mutex};
+      if (pendingOperation != Operation::Erase) {
+        WaitWhileBusy();
+        return;
+      }
+      ResumeErase();
+      // Sleep for most of the erase, the status register is only polled once it should be over
+      const TickType_t elapsed = xTaskGetTickCount() - operationStart;
+      if (elapsed < eraseTicks) {
+        delay = eraseTicks - elapsed;
+      } else if (!WriteInProgress()) {
+        WaitWhileBusy();
+        return;
+      }
+    }
+    vTaskDelay(delay);
+  }
+}
+
+void SpiNorFlash::WaitWhileBusy() {
+  switch (pendingOperation) {
+    case Operation::None:
+      return;
+    case Operation::PageProgram:
+      // Shorter than a tick: wait actively instead of sleeping for a whole tick
+      if (WriteInProgress()) {
+        nrf_delay_us(pageProgramMicroseconds);
+        for (uint32_t waited = pageProgramMicroseconds; WriteInProgress(); waited += busyPollMicroseconds) {
+          if (waited < maxBusyPollMicroseconds) {
+            nrf_delay_us(busyPollMicroseconds);
+          } else {
+            vTaskDelay(1);
+          }
+        }
+      }
+      break;
+    case Operation::Erase: {
+      ResumeErase();
+      const TickType_t elapsed = xTaskGetTickCount() - operationStart;
+      if (elapsed < eraseTicks) {
+        vTaskDelay(eraseTicks - elapsed);
+      }
+      while (WriteInProgress())
+        vTaskDelay(1);
+      break;
+    }
+  }
+  pendingOperation = Operation::None;
+  failures |= ReadSecurityRegister() & (programFailedBit | eraseFailedBit);
 }
 
 uint8_t SpiNorFlash::ReadSecurityRegister() {
@@ -109,16 +312,31 @@ uint8_t SpiNorFlash::ReadSecurityRegister() {
 }
 
 bool SpiNorFlash::ProgramFailed() {
-  return (ReadSecurityRegister() & 0x20u) == 0x20u;
+  WaitForCompletion();
+  Lock lock {mutex};
+  const bool failed = (failures & programFailedBit) == programFailedBit;
+  failures &= ~programFailedBit;
+  return failed;
 }
 
 bool SpiNorFlash::EraseFailed() {
-  return (ReadSecurityRegister() & 0x40u) == 0x40u;
+  WaitForCompletion();
+  Lock lock {mutex};
+  const bool failed = (failures & eraseFailedBit) == eraseFailedBit;
+  failures &= ~eraseFailedBit;
+  return failed;
 }
 
 void SpiNorFlash::Write(uint32_t address, const uint8_t* buffer, size_t size) {
+  WriteAsync(address, buffer, size);
+  WaitForCompletion();
+}
+
+void SpiNorFlash::WriteAsync(uint32_t address, const uint8_t* buffer, size_t size) {
   static constexpr uint8_t cmdSize = 4;
 
+  Lock lock {mutex};
+  InvalidateReadAhead();
   size_t len = size;
   uint32_t addr = address;
   const uint8_t* b = buffer;
@@ -131,14 +349,13 @@ void SpiNorFlash::Write(uint32_t address, const uint8_t* buffer, size_t size) {
                             static_cast<uint8_t>(addr >> 8U),
                             static_cast<uint8_t>(addr)};
 
+    WaitWhileBusy();
     WriteEnable();
     while (!WriteEnabled())
       vTaskDelay(1);
 
     spi.WriteCmdAndBuffer(cmd, cmdSize, b, toWrite);
-
-    while (WriteInProgress())
-      vTaskDelay(1);
+    pendingOperation = Operation::PageProgram;
 
     addr += toWrite;
     b += toWrite;
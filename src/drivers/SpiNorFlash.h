@@ -1,6 +1,8 @@
 #pragma once
 #include <cstddef>
 #include <cstdint>
+#include <FreeRTOS.h>
+#include <semphr.h>
 
 namespace Pinetime {
   namespace Drivers {
@@ -24,14 +26,36 @@ namespace Pinetime {
       bool WriteInProgress();
       bool WriteEnabled();
       uint8_t ReadConfigurationRegister();
+      // Small reads fill a read-ahead buffer, from which the following reads of the next bytes are served
       void Read(uint32_t address, uint8_t* buffer, size_t size);
       void Write(uint32_t address, const uint8_t* buffer, size_t size);
       void WriteEnable();
       void SectorErase(uint32_t sectorAddress);
       uint8_t ReadSecurityRegister();
+      // Whether a program or an erase failed since the last call
       bool ProgramFailed();
       bool EraseFailed();
 
+      // Same as Write() and SectorErase(), but return as soon as the flash starts programming the last page or erasing
+      // the sector, so that the caller can do something else (receive the next packet...) in the meantime.
+      // The buffer can be reused as soon as WriteAsync() returns. The next access to the flash waits for the end of the
+      // operation, or WaitForCompletion() can be called explicitly.
+      void WriteAsync(uint32_t address, const uint8_t* buffer, size_t size);
+      void SectorEraseAsync(uint32_t sectorAddress);
+
+      // Erases [address, address + size), rounded up to sectors, with the largest erase units aligned in the range
+      // (64KB and 32KB blocks, 4KB sectors). `address` must be a multiple of the sector size.
+      void EraseRange(uint32_t address, size_t size);
+      // Starts erasing the largest unit aligned at `address` that is not larger than `size` (one sector at least), and
+      // returns its size
+      size_t EraseAsync(uint32_t address, size_t size);
+      // Reads (from any task) during an erase suspend it, unless they read the range being erased. The erase is
+      // resumed by the next call to IsBusy(), WaitForCompletion() or any operation other than a read.
+      // Returns true while an asynchronous operation is in progress
+      bool IsBusy();
+      // Other tasks can read the flash while it waits for an erase
+      void WaitForCompletion();
+
       Identification GetIdentification() const;
 
       void Init();
@@ -42,6 +66,8 @@ namespace Pinetime {
 
     private:
       Identification ReadIdentification();
+      void ReadFromFlash(uint32_t address, uint8_t* buffer, size_t size);
+      void InvalidateReadAhead();
 
       enum class Commands : uint8_t {
         PageProgram = 0x02,
@@ -50,15 +76,71 @@ namespace Pinetime {
         WriteEnable = 0x06,
         ReadConfigurationRegister = 0x15,
         SectorErase = 0x20,
+        BlockErase32K = 0x52,
+        BlockErase64K = 0xD8,
+        EraseSuspend = 0x75,
+        EraseResume = 0x7A,
         ReadSecurityRegister = 0x2B,
         ReadIdentification = 0x9F,
         ReleaseFromDeepPowerDown = 0xAB,
         DeepPowerDown = 0xB9
       };
+      void StartErase(Commands command, uint32_t address, size_t size, TickType_t duration);
+      // Returns false if the erase can not be suspended again, the caller must then wait for it
+      bool SuspendErase();
+      void ResumeErase();
+      // Waits for the operation in progress while holding the lock
+      void WaitWhileBusy();
+
       static constexpr uint16_t pageSize = 256;
+      static constexpr size_t sectorSize = 0x1000;
+      static constexpr size_t block32KSize = 0x8000;
+      static constexpr size_t block64KSize = 0x10000;
+
+      enum class Operation : uint8_t { None, PageProgram, Erase };
+      // Typical durations from the datasheets of the flash memories of the supported devices (page program 0.6-0.7ms,
+      // sector erase 45-50ms, 32KB block erase 150ms, 64KB block erase 250ms), a bit shorter so that the first poll of
+      // the status register is rarely too late.
+      // Page programs are shorter than a tick, their completion is polled actively. After maxBusyPollMicroseconds (the
+      // maximum duration), the driver sleeps between polls.
+      static constexpr uint32_t pageProgramMicroseconds = 500;
+      static constexpr uint32_t busyPollMicroseconds = 50;
+      static constexpr uint32_t maxBusyPollMicroseconds = 3000;
+      static constexpr TickType_t sectorEraseTicks = 40 * configTICK_RATE_HZ / 1000;
+      static constexpr TickType_t block32KEraseTicks = 130 * configTICK_RATE_HZ / 1000;
+      static constexpr TickType_t block64KEraseTicks = 220 * configTICK_RATE_HZ / 1000;
+
+      // The erase must run for at least resumeToSuspendMicroseconds (tRS of the datasheets) between a resume and the next
+      // suspend. After maxEraseSuspends suspends, reads wait for the end of the erase, so that frequent reads can not
+      // postpone it indefinitely (the pre-erase of the DFU slot).
+      static constexpr uint32_t resumeToSuspendMicroseconds = 100;
+      static constexpr uint8_t maxEraseSuspends = 16;
+
+      static constexpr uint8_t programFailedBit = 0x20;
+      static constexpr uint8_t eraseFailedBit = 0x40;
+      // Most reads of littlefs are 16 bytes: reading ahead 64 bytes costs 48us more on a miss at 8MHz, and saves a
+      // transaction (command, address and its overhead) on each of the next 3 reads
+      static constexpr size_t readAheadSize = 64;
 
       Spi& spi;
       Identification device_id;
+      SemaphoreHandle_t mutex = nullptr;
+      Operation pendingOperation = Operation::None;
+      TickType_t operationStart = 0;
+      // Range and expected duration of the erase in progress
+      uint32_t eraseAddress = 0;
+      size_t eraseSize = 0;
+      TickType_t eraseTicks = 0;
+      bool eraseSuspended = false;
+      uint8_t eraseSuspends = 0;
+      // Time of the start of the erase, or of its last resume
+      TickType_t eraseProgressStart = 0;
+      // Bits of the security register set by the operations since the last call to ProgramFailed() and EraseFailed()
+      uint8_t failures = 0;
+
+      uint8_t readAhead[readAheadSize];
+      uint32_t readAheadAddress = 0;
+      size_t readAheadLength = 0;
     };
   }
 }
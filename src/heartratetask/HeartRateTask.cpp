@@ -1,16 +1,29 @@
 #include "heartratetask/HeartRateTask.h"
-#include <drivers/Hrs3300.h>
 #include <components/heartrate/HeartRateController.h>
+#include <components/motion/MotionController.h>
 #include <nrf_log.h>
+#include "utility/Math.h"
 
 using namespace Pinetime::Applications;
 
-HeartRateTask::HeartRateTask(Drivers::Hrs3300& heartRateSensor, Controllers::HeartRateController& controller)
-  : heartRateSensor {heartRateSensor}, controller {controller} {
+HeartRateTask::HeartRateTask(Drivers::Hrs3300& heartRateSensor,
+                             Controllers::HeartRateController& controller,
+                             const Controllers::MotionController& motionController,
+                             Controllers::FS& fs)
+  : heartRateSensor {heartRateSensor}, controller {controller}, motionController {motionController}, recorder {fs} {
+}
+
+void HeartRateTask::Register(System::SystemTask* systemTask) {
+  recorder.Register(systemTask);
 }
 
 void HeartRateTask::Start() {
   messageQueue = xQueueCreate(10, 1);
+  samplingTimer = xTimerCreate("HrsSampling", samplingPeriod, pdTRUE, this, SamplingTimerCallback);
+  if constexpr (backgroundPeriod > 0) {
+    backgroundTimer = xTimerCreate("HrsBackground", backgroundPeriod * 60 * configTICK_RATE_HZ, pdTRUE, this, BackgroundTimerCallback);
+    xTimerStart(backgroundTimer, 0);
+  }
   controller.SetHeartRateTask(this);
 
   if (pdPASS != xTaskCreate(HeartRateTask::Process, "Heartrate", 500, this, 0, &taskHandle)) {
@@ -23,25 +36,82 @@ void HeartRateTask::Process(void* instance) {
   app->Work();
 }
 
+// The sensor is read by the task: the timer task must not block on the TWI bus. The period is counted even if the
+// queue is full, the task then accounts for it on its next wakeup.
+void HeartRateTask::SamplingTimerCallback(TimerHandle_t xTimer) {
+  auto* task = static_cast<HeartRateTask*>(pvTimerGetTimerID(xTimer));
+  task->periodCount++;
+  Messages msg = Messages::ReadSample;
+  xQueueSend(task->messageQueue, &msg, 0);
+}
+
+void HeartRateTask::BackgroundTimerCallback(TimerHandle_t xTimer) {
+  auto* task = static_cast<HeartRateTask*>(pvTimerGetTimerID(xTimer));
+  Messages msg = Messages::BackgroundMeasurement;
+  xQueueSend(task->messageQueue, &msg, 0);
+}
+
+void HeartRateTask::ReadSample() {
+  const uint32_t count = periodCount;
+  if (count == readCount) {
+    // The periods of the messages still queued were read by an earlier wakeup
+    return;
+  }
+  if (count - readCount > maxGap) {
+    // Too long to bridge, start over
+    NRF_LOG_INFO("[HRS] %d samples missed, restarting the estimation", count - readCount);
+    missedSamples += count - readCount;
+    readCount = count;
+    nbSamples = 0;
+    ppg.Reset(true);
+    beatDetector.Reset();
+    controller.InterruptRrIntervals();
+    return;
+  }
+
+  // The accelerometer is read by SystemTask (~10Hz), use its latest values as the motion reference.
+  // SystemTask doesn't read it while sleeping (unless a wake up gesture is enabled): the motion is then unknown (0).
+  const TickType_t now = xTaskGetTickCount();
+  Sample sample {heartRateSensor.ReadHrsAls(), 0, 0, 0, 0, false};
+  if (now - motionController.LastUpdateTime() <= maxMotionAge) {
+    sample.x = motionController.X();
+    sample.y = motionController.Y();
+    sample.z = motionController.Z();
+  }
+  // The sensor only holds its last conversion: the periods missed since the previous read are filled with this sample
+  while (count - readCount > 1) {
+    missedSamples++;
+    AddSample(sample, true);
+    if (!IsSampling()) {
+      // A background measurement ended with the block
+      return;
+    }
+  }
+  AddSample(sample, false);
+}
+
+// Samples are timestamped from their period, not from the time the task got to read them
+void HeartRateTask::AddSample(Sample sample, bool gap) {
+  readCount++;
+  sample.time = static_cast<uint16_t>(startTime + readCount * samplingPeriod);
+  sample.gap = gap;
+  samples[nbSamples++] = sample;
+  if (nbSamples == samplesPerBlock) {
+    ProcessSamples();
+    nbSamples = 0;
+  }
+}
+
 void HeartRateTask::Work() {
-  int lastBpm = 0;
   while (true) {
     Messages msg;
-    uint32_t delay;
-    if (state == States::Running) {
-      if (measurementStarted) {
-        delay = ppg.deltaTms;
-      } else {
-        delay = 100;
-      }
-    } else {
-      delay = portMAX_DELAY;
-    }
-
-    if (xQueueReceive(messageQueue, &msg, delay)) {
+    if (xQueueReceive(messageQueue, &msg, portMAX_DELAY)) {
       switch (msg) {
         case Messages::GoToSleep:
-          StopMeasurement();
+          // Let a background measurement run to completion
+          if (!backgroundMeasurement) {
+            StopMeasurement();
+          }
           state = States::Idle;
           break;
         case Messages::WakeUp:
@@ -55,6 +125,8 @@ void HeartRateTask::Work() {
           if (measurementStarted) {
             break;
           }
+          // Takes over the background measurement, if any
+          backgroundMeasurement = false;
           lastBpm = 0;
           StartMeasurement();
           measurementStarted = true;
@@ -66,39 +138,104 @@ void HeartRateTask::Work() {
           StopMeasurement();
           measurementStarted = false;
           break;
+        case Messages::ReadSample:
+          if (IsSampling()) {
+            ReadSample();
+          }
+          break;
+        case Messages::BackgroundMeasurement:
+          if (!measurementStarted && !backgroundMeasurement) {
+            StartBackgroundMeasurement();
+          }
+          break;
       }
     }
+  }
+}
 
-    if (measurementStarted) {
-      auto sensorData = heartRateSensor.ReadHrsAls();
-      int8_t ambient = ppg.Preprocess(sensorData.hrs, sensorData.als);
-      int bpm = ppg.HeartRate();
-
-      // If ambient light detected or a reset requested (bpm < 0)
-      if (ambient > 0) {
-        // Reset all DAQ buffers
-        ppg.Reset(true);
-        // Force state to NotEnoughData (below)
-        lastBpm = 0;
-        bpm = 0;
-      } else if (bpm < 0) {
-        // Reset all DAQ buffers except HRS buffer
-        ppg.Reset(false);
-        // Set HR to zero and update
-        bpm = 0;
-        controller.Update(Controllers::HeartRateController::States::Running, bpm);
-      }
+bool HeartRateTask::IsSampling() const {
+  return (measurementStarted && state == States::Running) || backgroundMeasurement;
+}
 
-      if (lastBpm == 0 && bpm == 0) {
-        controller.Update(Controllers::HeartRateController::States::NotEnoughData, bpm);
+void HeartRateTask::ProcessSamples() {
+  for (uint16_t i = 0; i < nbSamples; i++) {
+    const Sample& sample = samples[i];
+    // Missed samples are left out of the recording, their timestamps show the gap
+    if (!sample.gap) {
+      recorder.Add(sample.time, sample.sensorData.hrs, sample.sensorData.als, sample.x, sample.y, sample.z);
+    }
+    int32_t x = sample.x;
+    int32_t y = sample.y;
+    int32_t z = sample.z;
+    uint16_t motion = Utility::Sqrt(static_cast<uint32_t>(x * x + y * y + z * z));
+    int8_t ambient = ppg.Preprocess(sample.sensorData.hrs, sample.sensorData.als, motion);
+    int bpm = ppg.HeartRate();
+    if (backgroundMeasurement) {
+      ProcessBackgroundSample(ambient, bpm);
+      if (!backgroundMeasurement) {
+        // Stopped, drop the rest of the block
+        break;
       }
+      continue;
+    }
+    uint16_t rrInterval = 0;
+    if (sample.gap) {
+      // No beat can be timed across a gap
+      beatDetector.Reset();
+      controller.InterruptRrIntervals();
+    } else {
+      rrInterval = beatDetector.Process(sample.sensorData.hrs);
+    }
 
-      if (bpm != 0) {
-        lastBpm = bpm;
-        controller.Update(Controllers::HeartRateController::States::Running, lastBpm);
-      }
+    // If ambient light detected or a reset requested (bpm < 0)
+    if (ambient > 0) {
+      // Reset all DAQ buffers
+      ppg.Reset(true);
+      beatDetector.Reset();
+      controller.InterruptRrIntervals();
+      // Force state to NotEnoughData (below)
+      lastBpm = 0;
+      bpm = 0;
+    } else if (bpm < 0) {
+      // Reset all DAQ buffers except HRS buffer
+      ppg.Reset(false);
+      // Set HR to zero and update
+      bpm = 0;
+      controller.Update(Controllers::HeartRateController::States::Running, bpm);
     }
+
+    if (rrInterval != 0) {
+      AddRrInterval(rrInterval);
+    }
+
+    if (lastBpm == 0 && bpm == 0) {
+      controller.Update(Controllers::HeartRateController::States::NotEnoughData, bpm);
+    }
+
+    if (bpm != 0) {
+      lastBpm = bpm;
+      controller.Update(Controllers::HeartRateController::States::Running, lastBpm);
+    }
+  }
+}
+
+// Only keep the intervals consistent with the spectral estimation, the beat detector is less robust to noise
+void HeartRateTask::AddRrInterval(uint16_t rrInterval) {
+  if (lastBpm == 0) {
+    controller.InterruptRrIntervals();
+    return;
+  }
+  int beatBpm = 60000 / rrInterval;
+  int tolerance = lastBpm / 4;
+  if (beatBpm < lastBpm - tolerance || beatBpm > lastBpm + tolerance) {
+    controller.InterruptRrIntervals();
+    return;
   }
+  controller.AddRrInterval(rrInterval);
+}
+
+void HeartRateTask::FlushRecording() {
+  recorder.Flush();
 }
 
 void HeartRateTask::PushMessage(HeartRateTask::Messages msg) {
@@ -108,13 +245,60 @@ void HeartRateTask::PushMessage(HeartRateTask::Messages msg) {
 }
 
 void HeartRateTask::StartMeasurement() {
+  heartRateSensor.SetConversionPeriod(conversionPeriod);
   heartRateSensor.Enable();
+  if constexpr (recordingEnabled) {
+    if (!backgroundMeasurement) {
+      recorder.Start(Ppg::sampleRate);
+    }
+  }
   ppg.Reset(true);
+  beatDetector.Reset();
+  controller.InterruptRrIntervals();
   vTaskDelay(100);
+  nbSamples = 0;
+  periodCount = 0;
+  readCount = 0;
+  missedSamples = 0;
+  startTime = xTaskGetTickCount();
+  xTimerStart(samplingTimer, 0);
 }
 
 void HeartRateTask::StopMeasurement() {
+  xTimerStop(samplingTimer, 0);
+  if (missedSamples > 0) {
+    NRF_LOG_INFO("[HRS] %d of %d samples missed", missedSamples, readCount);
+  }
   heartRateSensor.Disable();
+  recorder.Stop();
   ppg.Reset(true);
   vTaskDelay(100);
 }
+
+void HeartRateTask::StartBackgroundMeasurement() {
+  backgroundMeasurement = true;
+  backgroundSamples = 0;
+  StartMeasurement();
+}
+
+// Only the first confident estimate is used: the sensor is switched off as soon as it is available
+void HeartRateTask::ProcessBackgroundSample(int8_t ambient, int bpm) {
+  backgroundSamples++;
+  if (ambient > 0) {
+    ppg.Reset(true);
+  } else if (bpm < 0) {
+    ppg.Reset(false);
+  } else if (bpm > 0 && ppg.Confident()) {
+    controller.UpdateBackground(bpm);
+    StopBackgroundMeasurement();
+    return;
+  }
+  if (backgroundSamples >= maxBackgroundSamples) {
+    StopBackgroundMeasurement();
+  }
+}
+
+void HeartRateTask::StopBackgroundMeasurement() {
+  backgroundMeasurement = false;
+  StopMeasurement();
+}
@@ -2,40 +2,134 @@
 #include <FreeRTOS.h>
 #include <task.h>
 #include <queue.h>
+#include <timers.h>
+#include <array>
+#include <atomic>
+#include <components/heartrate/BeatDetector.h>
 #include <components/heartrate/Ppg.h>
+#include <components/heartrate/PpgRecorder.h>
+#include <drivers/Hrs3300.h>
+
+#ifndef HEARTRATE_SAMPLE_RATE
+  #define HEARTRATE_SAMPLE_RATE 10
+#endif
+
+#ifndef HEARTRATE_BACKGROUND_PERIOD
+  #define HEARTRATE_BACKGROUND_PERIOD 10
+#endif
 
 namespace Pinetime {
-  namespace Drivers {
-    class Hrs3300;
+  namespace System {
+    class SystemTask;
   }
 
   namespace Controllers {
     class HeartRateController;
+    class MotionController;
+    class FS;
   }
 
   namespace Applications {
     class HeartRateTask {
     public:
-      enum class Messages : uint8_t { GoToSleep, WakeUp, StartMeasurement, StopMeasurement };
+      enum class Messages : uint8_t { GoToSleep, WakeUp, StartMeasurement, StopMeasurement, ReadSample, BackgroundMeasurement };
       enum class States { Idle, Running };
 
-      explicit HeartRateTask(Drivers::Hrs3300& heartRateSensor, Controllers::HeartRateController& controller);
+      HeartRateTask(Drivers::Hrs3300& heartRateSensor,
+                    Controllers::HeartRateController& controller,
+                    const Controllers::MotionController& motionController,
+                    Controllers::FS& fs);
+      void Register(System::SystemTask* systemTask);
       void Start();
       void Work();
       void PushMessage(Messages msg);
+      // Called by SystemTask when requested by the recorder
+      void FlushRecording();
 
     private:
+      // Acquisition profile, selected at build time (HEARTRATE_SAMPLE_RATE):
+      // 10Hz with a 6.4s analysis window, or 25Hz with a 10.24s window (finer frequency resolution, more RAM and
+      // a higher duty cycle of the LED).
+#if HEARTRATE_SAMPLE_RATE == 25
+      using Ppg = Controllers::Ppg<25, 256>;
+      static constexpr Drivers::Hrs3300::ConversionPeriod conversionPeriod = Drivers::Hrs3300::ConversionPeriod::Ms25;
+#elif HEARTRATE_SAMPLE_RATE == 10
+      using Ppg = Controllers::Ppg<10, 64>;
+      static constexpr Drivers::Hrs3300::ConversionPeriod conversionPeriod = Drivers::Hrs3300::ConversionPeriod::Ms100;
+#else
+  #error "Unsupported HEARTRATE_SAMPLE_RATE"
+#endif
+      using BeatDetector = Controllers::BeatDetector<Ppg::sampleRate>;
+      // A timer paces the acquisition, the task reads the samples and processes them one block at a time
+      static constexpr uint16_t samplesPerBlock = Ppg::overlapWindow;
+      static constexpr TickType_t samplingPeriod = (configTICK_RATE_HZ + Ppg::sampleRate / 2) / Ppg::sampleRate;
+      // Older accelerometer values are not used, SystemTask reads them at least every 100ms while running
+      static constexpr TickType_t maxMotionAge = pdMS_TO_TICKS(250);
+      // Missed samples are filled in up to 1s, a longer gap restarts the estimation
+      static constexpr uint32_t maxGap = Ppg::sampleRate;
+
+      // When no measurement is running, the heart rate is measured in the background every backgroundPeriod
+      // minutes, whether the watch is sleeping or not. The sensor is switched off as soon as Ppg is confident in
+      // its estimate, or after maxBackgroundDuration seconds if the signal is too noisy.
+      static constexpr uint32_t backgroundPeriod = HEARTRATE_BACKGROUND_PERIOD;
+      static constexpr uint32_t maxBackgroundDuration = 30;
+      static constexpr uint32_t maxBackgroundSamples = maxBackgroundDuration * Ppg::sampleRate;
+
+#ifdef HEARTRATE_RECORDING
+      // The raw samples of the measurements started from the app are recorded to the file system
+      static constexpr bool recordingEnabled = true;
+#else
+      static constexpr bool recordingEnabled = false;
+#endif
+
+      struct Sample {
+        Drivers::Hrs3300::PackedHrsAls sensorData;
+        // Acceleration (binary milli-g)
+        int16_t x;
+        int16_t y;
+        int16_t z;
+        // Ticks, lower 16 bits
+        uint16_t time;
+        // Missed: the values are the ones of the next sample
+        bool gap;
+      };
+
       static void Process(void* instance);
+      static void SamplingTimerCallback(TimerHandle_t xTimer);
+      static void BackgroundTimerCallback(TimerHandle_t xTimer);
+      void ReadSample();
+      void AddSample(Sample sample, bool gap);
+      bool IsSampling() const;
+      void ProcessSamples();
+      void AddRrInterval(uint16_t rrInterval);
       void StartMeasurement();
       void StopMeasurement();
+      void StartBackgroundMeasurement();
+      void ProcessBackgroundSample(int8_t ambient, int bpm);
+      void StopBackgroundMeasurement();
 
       TaskHandle_t taskHandle;
       QueueHandle_t messageQueue;
+      TimerHandle_t samplingTimer;
+      TimerHandle_t backgroundTimer;
       States state = States::Running;
       Drivers::Hrs3300& heartRateSensor;
       Controllers::HeartRateController& controller;
-      Controllers::Ppg ppg;
+      const Controllers::MotionController& motionController;
+      Ppg ppg;
+      BeatDetector beatDetector;
+      Controllers::PpgRecorder recorder;
       bool measurementStarted = false;
+      bool backgroundMeasurement = false;
+      uint32_t backgroundSamples = 0;
+      int lastBpm = 0;
+      std::array<Sample, samplesPerBlock> samples;
+      uint16_t nbSamples = 0;
+      // Sampling periods elapsed (incremented by the timer) and read by the task since the start of the measurement
+      std::atomic<uint32_t> periodCount {0};
+      uint32_t readCount = 0;
+      uint32_t missedSamples = 0;
+      TickType_t startTime = 0;
     };
 
   }
@@ -36,6 +36,7 @@
 #include "components/datetime/DateTimeController.h"
 #include "components/heartrate/HeartRateController.h"
 #include "components/fs/FS.h"
+#include "components/history/HistoryController.h"
 #include "drivers/Spi.h"
 #include "drivers/SpiMaster.h"
 #include "drivers/SpiNorFlash.h"
@@ -94,7 +95,6 @@ Pinetime::Controllers::Battery batteryController;
 Pinetime::Controllers::Ble bleController;
 
 Pinetime::Controllers::HeartRateController heartRateController;
-Pinetime::Applications::HeartRateTask heartRateApp(heartRateSensor, heartRateController);
 
 Pinetime::Controllers::FS fs {spiNorFlash};
 Pinetime::Controllers::Settings settingsController {fs};
@@ -104,7 +104,15 @@ Pinetime::Controllers::DateTime dateTimeController {settingsController};
 Pinetime::Drivers::Watchdog watchdog;
 Pinetime::Controllers::NotificationManager notificationManager;
 Pinetime::Controllers::MotionController motionController;
+Pinetime::Applications::HeartRateTask heartRateApp(heartRateSensor, heartRateController, motionController, fs);
 Pinetime::Controllers::AlarmController alarmController {dateTimeController, fs};
+#ifndef PINETIME_IS_RECOVERY
+Pinetime::Controllers::HistoryController historyController {fs,
+                                                            dateTimeController,
+                                                            motionController,
+                                                            heartRateController,
+                                                            batteryController};
+#endif
 Pinetime::Controllers::TouchHandler touchHandler;
 Pinetime::Controllers::ButtonHandler buttonHandler;
 Pinetime::Controllers::BrightnessController brightnessController {};
@@ -144,6 +152,9 @@ Pinetime::System::SystemTask systemTask(spi,
                                         displayApp,
                                         heartRateApp,
                                         fs,
+#ifndef PINETIME_IS_RECOVERY
+                                        historyController,
+#endif
                                         touchHandler,
                                         buttonHandler);
 int mallocFailedCount = 0;
@@ -80,6 +80,9 @@ void RefreshWatchdog() {
 
 uint8_t displayBuffer[displayWidth * bytesPerPixel];
 
+static constexpr size_t pageSize = 256;
+uint8_t writeBuffer[pageSize];
+
 void Process(void* /*instance*/) {
   RefreshWatchdog();
   APP_GPIOTE_INIT(2);
@@ -95,20 +98,29 @@ void Process(void* /*instance*/) {
   DisplayLogo();
 
   NRF_LOG_INFO("Erasing...");
-  for (uint32_t erased = 0; erased < sizeof(recoveryImage); erased += 0x1000) {
-    spiNorFlash.SectorErase(erased);
+  for (uint32_t erased = 0; erased < sizeof(recoveryImage);) {
+    erased += spiNorFlash.EraseAsync(erased, sizeof(recoveryImage) - erased);
+    spiNorFlash.WaitForCompletion();
     RefreshWatchdog();
   }
 
   NRF_LOG_INFO("Writing factory image...");
-  static constexpr uint32_t memoryChunkSize = 200;
-  uint8_t writeBuffer[memoryChunkSize];
-  for (size_t offset = 0; offset < sizeof(recoveryImage); offset += memoryChunkSize) {
-    std::memcpy(writeBuffer, &recoveryImage[offset], memoryChunkSize);
-    spiNorFlash.Write(offset, writeBuffer, memoryChunkSize);
-    DisplayProgressBar((static_cast<float>(offset) / static_cast<float>(sizeof(recoveryImage))) * 100.0f, colorWhite);
+  // One page at a time: EasyDMA cannot read the image from the internal flash, the page is copied to RAM while the
+  // flash programs the previous one
+  uint8_t lastPercent = 0;
+  for (size_t offset = 0; offset < sizeof(recoveryImage); offset += pageSize) {
+    const size_t size = std::min(pageSize, sizeof(recoveryImage) - offset);
+    std::memcpy(writeBuffer, &recoveryImage[offset], size);
+    spiNorFlash.WriteAsync(offset, writeBuffer, size);
+
+    const uint8_t percent = (offset + size) * 100 / sizeof(recoveryImage);
+    if (percent != lastPercent) {
+      DisplayProgressBar(percent, colorWhite);
+      lastPercent = percent;
+    }
     RefreshWatchdog();
   }
+  spiNorFlash.WaitForCompletion();
   NRF_LOG_INFO("Writing factory image done!");
   DisplayProgressBar(100.0f, colorGreen);
 
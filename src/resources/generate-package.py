@@ -3,13 +3,42 @@
 import io
 import sys
 import json
+import zlib
 import shutil
+import struct
 import typing
 import os.path
 import argparse
 import subprocess
 from zipfile import ZipFile
 
+PACKAGE_MAGIC = b'ITRP'
+PACKAGE_VERSION = 1
+ENTRY_FILE = 0
+ENTRY_DELETE = 1
+MAX_PATH_LENGTH = 64
+
+def write_package(output, resources, obsolete_files):
+    """Writes the package installed by the watch in a single transfer (see components/fs/ResourceInstaller.h)"""
+    body = bytearray()
+    entries = [(ENTRY_DELETE, obsolete['path'], b'') for obsolete in obsolete_files]
+    for resource in resources:
+        with open(resource['source'], 'rb') as fd:
+            entries.append((ENTRY_FILE, resource['path'], fd.read()))
+
+    for entry_type, path, data in entries:
+        encoded_path = path.encode('utf-8')
+        if len(encoded_path) > MAX_PATH_LENGTH:
+            sys.exit(f'Error: the path {path} is longer than {MAX_PATH_LENGTH} bytes.')
+        body += struct.pack('<BBHII', entry_type, len(encoded_path), 0, len(data), zlib.crc32(data))
+        body += encoded_path
+        body += data
+
+    header = struct.pack('<4sBBHII', PACKAGE_MAGIC, PACKAGE_VERSION, 0, len(entries), 16 + len(body), zlib.crc32(body))
+    with open(output, 'wb') as fd:
+        fd.write(header)
+        fd.write(body)
+
 def main():
     ap = argparse.ArgumentParser(description='auto generate LVGL font files from fonts')
     ap.add_argument('--config', '-c', type=str, action='append', help='config file to use')
@@ -32,6 +61,7 @@ def main():
 
     zf = ZipFile(args.output, mode='w')
     resource_files = []
+    package_files = []
 
     for config_file in args.config:
         with open(config_file, 'r') as fd:
@@ -49,6 +79,10 @@ def main():
             if not os.path.exists(path):
                 path = os.path.join(os.path.dirname(sys.argv[0]), path)
             zf.write(path)
+            package_files.append({
+                "source": path,
+                "path": resource['target_path'] + name+'.bin'
+            })
 
     if args.obsolete:
         obsolete_file_path = os.path.join(os.path.dirname(sys.argv[0]), args.obsolete)
@@ -56,9 +90,14 @@ def main():
             obsolete_data = json.load(fd)
     else:
         obsolete_data = {}
+
+    write_package('resources.pkg', sorted(package_files, key=lambda f: f['path']), obsolete_data)
+    zf.write('resources.pkg')
+
     output = {
         'resources': resource_files,
-        'obsolete_files': obsolete_data
+        'obsolete_files': obsolete_data,
+        'package': 'resources.pkg'
     }
 
 
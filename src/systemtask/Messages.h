@@ -29,6 +29,8 @@ namespace Pinetime {
       BatteryPercentageUpdated,
       StartFileTransfer,
       StopFileTransfer,
+      FileTransferSessionTimeout,
+      FlushPpgRecording,
       BleRadioEnableToggle
     };
   }
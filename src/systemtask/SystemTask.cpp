@@ -50,6 +50,9 @@ SystemTask::SystemTask(Drivers::SpiMaster& spi,
                        Pinetime::Applications::DisplayApp& displayApp,
                        Pinetime::Applications::HeartRateTask& heartRateApp,
                        Pinetime::Controllers::FS& fs,
+#ifndef PINETIME_IS_RECOVERY
+                       Pinetime::Controllers::HistoryController& historyController,
+#endif
                        Pinetime::Controllers::TouchHandler& touchHandler,
                        Pinetime::Controllers::ButtonHandler& buttonHandler)
   : spi {spi},
@@ -70,6 +73,9 @@ SystemTask::SystemTask(Drivers::SpiMaster& spi,
     displayApp {displayApp},
     heartRateApp(heartRateApp),
     fs {fs},
+#ifndef PINETIME_IS_RECOVERY
+    historyController {historyController},
+#endif
     touchHandler {touchHandler},
     buttonHandler {buttonHandler},
     nimbleController(*this,
@@ -136,6 +142,9 @@ void SystemTask::Work() {
   motionSensor.Init();
   motionController.Init(motionSensor.DeviceType());
   settingsController.Init();
+#ifndef PINETIME_IS_RECOVERY
+  historyController.Init();
+#endif
 
   displayApp.Register(this);
   displayApp.Register(&nimbleController.weather());
@@ -145,6 +154,7 @@ void SystemTask::Work() {
 
   heartRateSensor.Init();
   heartRateSensor.Disable();
+  heartRateApp.Register(this);
   heartRateApp.Start();
 
   buttonHandler.Init(this);
@@ -245,6 +255,14 @@ void SystemTask::Work() {
           wakeLocksHeld--;
           // TODO add intent of fs access icon or something
           break;
+        case Messages::FileTransferSessionTimeout:
+          nimbleController.fs().OnSessionTimeout();
+          break;
+        case Messages::FlushPpgRecording:
+          AccessFlash([this]() {
+            heartRateApp.FlushRecording();
+          });
+          break;
         case Messages::OnTouchEvent:
           // Finish immediately if no new events
           if (!touchHandler.ProcessTouchInfo(touchPanel.GetTouchInfo())) {
@@ -321,6 +339,11 @@ void SystemTask::Work() {
           stepCounterMustBeReset = true;
           break;
         case Messages::OnNewHour:
+#ifndef PINETIME_IS_RECOVERY
+          AccessFlash([this]() {
+            historyController.LogHour();
+          });
+#endif
           using Pinetime::Controllers::AlarmController;
           if (settingsController.GetNotificationStatus() != Controllers::Settings::Notification::Sleep &&
               settingsController.GetChimeOption() == Controllers::Settings::ChimesOption::Hours && !alarmController.IsAlerting()) {
@@ -374,6 +397,13 @@ void SystemTask::Work() {
       }
     }
 
+    if (!resourcesVerified && state == SystemTaskState::Running) {
+      resourcesVerified = !fs.VerifyNextResource();
+    }
+    if (state == SystemTaskState::Running) {
+      nimbleController.dfu().PreErase();
+    }
+
     monitor.Process();
     NoInit_BackUpTime = dateTimeController.CurrentDateTime();
     if (nrf_gpio_pin_read(PinMap::Button) == 0) {
@@ -429,6 +459,28 @@ void SystemTask::GoToSleep() {
   state = SystemTaskState::GoingToSleep;
 };
 
+template <class Access>
+void SystemTask::AccessFlash(Access access) {
+  // The SPI bus and the flash are powered down while sleeping, only wake them up for the time of the access
+  const bool spiSleeping = state == SystemTaskState::Sleeping;
+  const bool flashSleeping = spiSleeping || state == SystemTaskState::AODSleeping;
+  if (spiSleeping) {
+    spi.Wakeup();
+  }
+  if (flashSleeping) {
+    spiNorFlash.Wakeup();
+  }
+
+  access();
+
+  if (flashSleeping && BootloaderVersion::IsValid()) {
+    spiNorFlash.Sleep();
+  }
+  if (spiSleeping) {
+    spi.Sleep();
+  }
+}
+
 void SystemTask::UpdateMotion() {
   // Only consider disabling motion updates specifically in the Sleeping state
   // AOD needs motion on to show up to date step counts
@@ -440,6 +492,9 @@ void SystemTask::UpdateMotion() {
 
   if (stepCounterMustBeReset) {
     motionSensor.ResetStepCounter();
+#ifndef PINETIME_IS_RECOVERY
+    motionController.Activity().ResetDailyMinutes();
+#endif
     stepCounterMustBeReset = false;
   }
 
@@ -16,6 +16,7 @@
 #include "components/ble/NimbleController.h"
 #include "components/ble/NotificationManager.h"
 #include "components/alarm/AlarmController.h"
+#include "components/history/HistoryController.h"
 #include "components/fs/FS.h"
 #include "touchhandler/TouchHandler.h"
 #include "buttonhandler/ButtonHandler.h"
@@ -71,6 +72,9 @@ namespace Pinetime {
                  Pinetime::Applications::DisplayApp& displayApp,
                  Pinetime::Applications::HeartRateTask& heartRateApp,
                  Pinetime::Controllers::FS& fs,
+#ifndef PINETIME_IS_RECOVERY
+                 Pinetime::Controllers::HistoryController& historyController,
+#endif
                  Pinetime::Controllers::TouchHandler& touchHandler,
                  Pinetime::Controllers::ButtonHandler& buttonHandler);
 
@@ -113,6 +117,9 @@ namespace Pinetime {
       Pinetime::Applications::DisplayApp& displayApp;
       Pinetime::Applications::HeartRateTask& heartRateApp;
       Pinetime::Controllers::FS& fs;
+#ifndef PINETIME_IS_RECOVERY
+      Pinetime::Controllers::HistoryController& historyController;
+#endif
       Pinetime::Controllers::TouchHandler& touchHandler;
       Pinetime::Controllers::ButtonHandler& buttonHandler;
       Pinetime::Controllers::NimbleController nimbleController;
@@ -131,7 +138,12 @@ namespace Pinetime {
       void GoToRunning();
       void GoToSleep();
       void UpdateMotion();
+      // Wakes the SPI bus and the flash up for the time of the access if they are sleeping
+      template <class Access>
+      void AccessFlash(Access access);
       bool stepCounterMustBeReset = false;
+      // The resources are verified one per iteration of the main loop after boot, while the flash is awake
+      bool resourcesVerified = false;
       static constexpr TickType_t batteryMeasurementPeriod = pdMS_TO_TICKS(10 * 60 * 1000);
 
       SystemMonitor monitor;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+
+#include "utility/Math.h"
+
+namespace Pinetime {
+  namespace Utility {
+    // Second order IIR filter (direct form I) with Q14 coefficients normalized so that a0 == 1.
+    // The accumulator is 64 bits wide, the input and output samples can use the whole int32_t range
+    // as long as the filter gain keeps the output within it.
+    class Biquad {
+    public:
+      struct Coefficients {
+        int32_t b0;
+        int32_t b1;
+        int32_t b2;
+        int32_t a1;
+        int32_t a2;
+      };
+
+      // Band-pass filter with a 0dB peak gain (RBJ audio EQ cookbook), -3dB at lowCutoff and highCutoff (Hz)
+      static constexpr Coefficients BandPass(double sampleFrequency, double lowCutoff, double highCutoff) {
+        const double center = ConstexprSqrt(lowCutoff * highCutoff);
+        const double q = center / (highCutoff - lowCutoff);
+        const double w0 = 2 * 3.14159265358979323846 * center / sampleFrequency;
+        const double alpha = ConstexprSin(w0) / (2 * q);
+        const double a0 = 1 + alpha;
+        return {ToQ14(alpha / a0), 0, ToQ14(-alpha / a0), ToQ14(-2 * ConstexprCos(w0) / a0), ToQ14((1 - alpha) / a0)};
+      }
+
+      constexpr explicit Biquad(const Coefficients& coefficients) : coefficients {coefficients} {
+      }
+
+      int32_t Process(int32_t x) {
+        const int64_t accumulator = static_cast<int64_t>(coefficients.b0) * x + static_cast<int64_t>(coefficients.b1) * x1 +
+                                    static_cast<int64_t>(coefficients.b2) * x2 - static_cast<int64_t>(coefficients.a1) * y1 -
+                                    static_cast<int64_t>(coefficients.a2) * y2;
+        const int32_t y = static_cast<int32_t>(accumulator >> 14);
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        return y;
+      }
+
+      void Reset() {
+        x1 = x2 = y1 = y2 = 0;
+      }
+
+      // Sets the state as if the input had been constant and equal to x, to avoid the startup transient.
+      // Only valid for filters with a 0 DC gain (high-pass, band-pass).
+      void Prime(int32_t x) {
+        x1 = x2 = x;
+        y1 = y2 = 0;
+      }
+
+    private:
+      static constexpr int32_t ToQ14(double value) {
+        const double scaled = value * (1 << 14);
+        return static_cast<int32_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+      }
+
+      Coefficients coefficients;
+      int32_t x1 = 0;
+      int32_t x2 = 0;
+      int32_t y1 = 0;
+      int32_t y2 = 0;
+    };
+  }
+}
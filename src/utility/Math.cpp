@@ -4,6 +4,24 @@
 
 using namespace Pinetime::Utility;
 
+uint16_t Pinetime::Utility::Sqrt(uint32_t arg) {
+  uint32_t result = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > arg) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (arg >= result + bit) {
+      arg -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return static_cast<uint16_t>(result);
+}
+
 #ifndef PINETIME_IS_RECOVERY
 
 int16_t Pinetime::Utility::Asin(int16_t arg) {
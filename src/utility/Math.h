@@ -6,5 +6,84 @@ namespace Pinetime {
   namespace Utility {
     // returns the arcsin of `arg`. asin(-32767) = -90, asin(32767) = 90
     int16_t Asin(int16_t arg);
+
+    // returns the integer square root of `arg`, rounded down
+    uint16_t Sqrt(uint32_t arg);
+
+    // Sine, cosine, square root, exponential and logarithm that can be evaluated at compile time, to build lookup tables
+    // and filter coefficients without linking sinf()/cosf(). Too slow to be used at runtime.
+    constexpr double ConstexprSin(double x) {
+      constexpr double pi = 3.14159265358979323846;
+      while (x > pi) {
+        x -= 2 * pi;
+      }
+      while (x < -pi) {
+        x += 2 * pi;
+      }
+      double term = x;
+      double sum = x;
+      for (int n = 1; n < 12; n++) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+      }
+      return sum;
+    }
+
+    constexpr double ConstexprCos(double x) {
+      return ConstexprSin(x + 3.14159265358979323846 / 2);
+    }
+
+    constexpr double ConstexprSqrt(double x) {
+      if (x <= 0) {
+        return 0;
+      }
+      double root = x > 1 ? x : 1;
+      for (int i = 0; i < 64; i++) {
+        root = (root + x / root) / 2;
+      }
+      return root;
+    }
+
+    constexpr double ConstexprExp(double x) {
+      // exp(x) = exp(x / 2^n)^(2^n), with |x / 2^n| <= 0.5
+      int halvings = 0;
+      while (x > 0.5 || x < -0.5) {
+        x /= 2;
+        halvings++;
+      }
+      double term = 1;
+      double sum = 1;
+      for (int n = 1; n < 16; n++) {
+        term *= x / n;
+        sum += term;
+      }
+      for (; halvings > 0; halvings--) {
+        sum *= sum;
+      }
+      return sum;
+    }
+
+    // Natural logarithm, x > 0
+    constexpr double ConstexprLog(double x) {
+      // log(x) = log(x / 2^n) + n log(2), with 0.5 <= x / 2^n <= 2, then log(x) = 2 atanh((x - 1) / (x + 1))
+      constexpr double log2 = 0.69314718055994530942;
+      int exponent = 0;
+      while (x > 2) {
+        x /= 2;
+        exponent++;
+      }
+      while (x < 0.5) {
+        x *= 2;
+        exponent--;
+      }
+      const double z = (x - 1) / (x + 1);
+      double term = z;
+      double sum = 0;
+      for (int n = 1; n < 64; n += 2) {
+        sum += term / n;
+        term *= z * z;
+      }
+      return 2 * sum + exponent * log2;
+    }
   }
 }
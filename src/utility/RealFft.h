@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "utility/Math.h"
+
+namespace Pinetime {
+  namespace Utility {
+    // In-place fixed-point FFT of N real samples, computed as a N/2 points complex FFT (even samples as the real part,
+    // odd samples as the imaginary part) followed by a split step.
+    //
+    // The input samples are expected in Q15 and the twiddle factors are Q15, but the butterflies are computed on 32 bits
+    // without any scaling: the output is the unnormalized DFT (|X[k]| <= N * 2^15), with the same scale as a floating
+    // point FFT of the same Q15 values.
+    template <size_t N>
+    class RealFft {
+      static_assert(N >= 4 && (N & (N - 1)) == 0, "N must be a power of 2");
+      static_assert(N <= 1 << 15, "The output must fit in 32 bits");
+
+    public:
+      // Number of bins in the output, from DC (0) to N/2 - 1. The Nyquist bin is not computed.
+      static constexpr size_t nbBins = N / 2;
+
+      // data holds N real samples on input, and nbBins complex bins (real part first) on output
+      static void Compute(std::array<int32_t, N>& data) {
+        ComplexFft(data);
+        Split(data);
+      }
+
+    private:
+      static constexpr size_t halfN = N / 2;
+
+      struct Twiddles {
+        // W_N^k = cos(2 pi k / N) - j sin(2 pi k / N), in Q15
+        int16_t cos[halfN];
+        int16_t sin[halfN];
+      };
+
+      static constexpr int16_t ToQ15(double value) {
+        const double scaled = value * 32767.0;
+        return static_cast<int16_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+      }
+
+      static constexpr Twiddles MakeTwiddles() {
+        Twiddles result {};
+        for (size_t k = 0; k < halfN; k++) {
+          const double angle = 2 * 3.14159265358979323846 * static_cast<double>(k) / N;
+          result.cos[k] = ToQ15(ConstexprCos(angle));
+          result.sin[k] = ToQ15(ConstexprSin(angle));
+        }
+        return result;
+      }
+
+      static constexpr Twiddles twiddles = MakeTwiddles();
+
+      // (re + j im) * W_N^k, in place
+      static void Rotate(int32_t& re, int32_t& im, size_t k) {
+        const int64_t c = twiddles.cos[k];
+        const int64_t s = twiddles.sin[k];
+        const int32_t rotatedRe = static_cast<int32_t>((re * c + im * s) >> 15);
+        im = static_cast<int32_t>((im * c - re * s) >> 15);
+        re = rotatedRe;
+      }
+
+      // Radix-2 decimation in time FFT of the halfN complex values stored as (re, im) pairs
+      static void ComplexFft(std::array<int32_t, N>& data) {
+        for (size_t i = 1, j = 0; i < halfN; i++) {
+          size_t bit = halfN >> 1;
+          for (; j & bit; bit >>= 1) {
+            j ^= bit;
+          }
+          j ^= bit;
+          if (i < j) {
+            std::swap(data[2 * i], data[2 * j]);
+            std::swap(data[2 * i + 1], data[2 * j + 1]);
+          }
+        }
+
+        for (size_t size = 2; size <= halfN; size <<= 1) {
+          const size_t half = size >> 1;
+          // W_size^k == W_N^(k * N / size)
+          const size_t step = N / size;
+          for (size_t start = 0; start < halfN; start += size) {
+            for (size_t k = 0; k < half; k++) {
+              int32_t* a = &data[2 * (start + k)];
+              int32_t* b = &data[2 * (start + k + half)];
+              int32_t re = b[0];
+              int32_t im = b[1];
+              Rotate(re, im, k * step);
+              b[0] = a[0] - re;
+              b[1] = a[1] - im;
+              a[0] += re;
+              a[1] += im;
+            }
+          }
+        }
+      }
+
+      // 2 X[k] = (Z[k] + Z*[M-k]) - j W_N^k (Z[k] - Z*[M-k]), M = N/2
+      static void SplitBin(int32_t zRe, int32_t zIm, int32_t mirrorRe, int32_t mirrorIm, size_t k, int32_t& re, int32_t& im) {
+        const int32_t sumRe = zRe + mirrorRe;
+        const int32_t sumIm = zIm - mirrorIm;
+        // -j * (Z[k] - Z*[M-k])
+        int32_t diffRe = zIm + mirrorIm;
+        int32_t diffIm = mirrorRe - zRe;
+        Rotate(diffRe, diffIm, k);
+        re = (sumRe + diffRe) / 2;
+        im = (sumIm + diffIm) / 2;
+      }
+
+      static void Split(std::array<int32_t, N>& data) {
+        // DC: sum of the even samples + sum of the odd samples
+        data[0] += data[1];
+        data[1] = 0;
+
+        // Bins k and M-k depend on the same two values of Z, compute them together
+        for (size_t k = 1; k <= halfN / 2; k++) {
+          const size_t mirror = halfN - k;
+          const int32_t zRe = data[2 * k];
+          const int32_t zIm = data[2 * k + 1];
+          const int32_t mirrorRe = data[2 * mirror];
+          const int32_t mirrorIm = data[2 * mirror + 1];
+          SplitBin(zRe, zIm, mirrorRe, mirrorIm, k, data[2 * k], data[2 * k + 1]);
+          if (mirror != k) {
+            SplitBin(mirrorRe, mirrorIm, zRe, zIm, mirror, data[2 * mirror], data[2 * mirror + 1]);
+          }
+        }
+      }
+    };
+  }
+}
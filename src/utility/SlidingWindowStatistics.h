@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "utility/CircularBuffer.h"
+
+namespace Pinetime {
+  namespace Utility {
+    // Mean and variance of the last S samples pushed, maintained as a running sum and sum of squares
+    // so that each new sample costs O(1) regardless of the window length.
+    // Sum and SumSquares must be wide enough to hold S * max(|T|) and S * max(T)^2 respectively.
+    template <class T, size_t S, class Sum = int32_t, class SumSquares = int64_t>
+    class SlidingWindowStatistics {
+    public:
+      static_assert(S > 0, "Window length must not be zero");
+
+      void Push(T value) {
+        // After the increment, the first element of the buffer is the oldest sample, which leaves the window
+        window++;
+        const T oldest = window[0];
+        sum += static_cast<Sum>(value) - static_cast<Sum>(oldest);
+        sumSquares += static_cast<SumSquares>(value) * value - static_cast<SumSquares>(oldest) * oldest;
+        window[0] = value;
+      }
+
+      void Reset() {
+        window.data.fill(0);
+        window.idx = 0;
+        sum = 0;
+        sumSquares = 0;
+      }
+
+      constexpr size_t Size() const {
+        return S;
+      }
+
+      // Most recently pushed sample
+      T Last() const {
+        return window[0];
+      }
+
+      Sum Total() const {
+        return sum;
+      }
+
+      Sum Mean() const {
+        return sum / static_cast<Sum>(S);
+      }
+
+      // Population variance: (S * sum(x^2) - sum(x)^2) / S^2, exact up to the final division
+      SumSquares Variance() const {
+        constexpr SumSquares n = static_cast<SumSquares>(S);
+        return (n * sumSquares - static_cast<SumSquares>(sum) * sum) / (n * n);
+      }
+
+    private:
+      CircularBuffer<T, S> window = {};
+      Sum sum = 0;
+      SumSquares sumSquares = 0;
+    };
+  }
+}
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+# Compresses a firmware image, to send with the DFU service instead of the image itself. The watch decompresses it
+# while it is received. See doc/CompressedFirmwareUpdate.md and src/components/ble/DfuDecompressor.h.
+
+import sys
+import zlib
+import struct
+import argparse
+import subprocess
+
+COMPRESSED_MAGIC = b'ITDZ'
+COMPRESSED_VERSION = 1
+MIN_MATCH_LENGTH = 4
+# Matches are encoded with a 16-bit offset
+MAX_DISTANCE = 65535
+# Previous positions kept per 4-byte sequence: more is slower, and barely compresses better
+MAX_CANDIDATES = 16
+# Largest image the watch accepts (size of the OTA slot)
+MAX_IMAGE_SIZE = 475136
+
+
+def match_length(data, source, position):
+    length = 0
+    limit = len(data) - position
+    # Compare large chunks first, then byte by byte
+    step = 256
+    while length < limit:
+        size = min(step, limit - length)
+        if data[source + length:source + length + size] == data[position + length:position + length + size]:
+            length += size
+        elif step > 1:
+            step //= 16
+        else:
+            break
+    return length
+
+
+def write_length(output, value):
+    while value >= 255:
+        output.append(255)
+        value -= 255
+    output.append(value)
+
+
+def write_sequence(output, literals, offset=0, length=0):
+    """LZ4 sequence: token, literals, and the match (offset, length) unless it is the last sequence"""
+    match = length - MIN_MATCH_LENGTH if length > 0 else 0
+    output.append((min(len(literals), 15) << 4) | min(match, 15))
+    if len(literals) >= 15:
+        write_length(output, len(literals) - 15)
+    output += literals
+    if length > 0:
+        output += struct.pack('<H', offset)
+        if match >= 15:
+            write_length(output, match - 15)
+
+
+def compress(data):
+    """LZ4 block format, greedy matching"""
+    output = bytearray()
+    positions = {}
+
+    def add(position):
+        candidates = positions.setdefault(data[position:position + MIN_MATCH_LENGTH], [])
+        candidates.append(position)
+        if len(candidates) > MAX_CANDIDATES:
+            del candidates[0]
+
+    anchor = 0
+    position = 0
+    while position + MIN_MATCH_LENGTH <= len(data):
+        best_source, best_length = 0, 0
+        for source in reversed(positions.get(data[position:position + MIN_MATCH_LENGTH], [])):
+            if position - source > MAX_DISTANCE:
+                break
+            length = match_length(data, source, position)
+            if length > best_length:
+                best_source, best_length = source, length
+        if best_length < MIN_MATCH_LENGTH:
+            add(position)
+            position += 1
+            continue
+        write_sequence(output, data[anchor:position], position - best_source, best_length)
+        for matched in range(position, min(position + best_length, len(data) - MIN_MATCH_LENGTH + 1)):
+            add(matched)
+        position += best_length
+        anchor = position
+    if anchor < len(data):
+        write_sequence(output, data[anchor:])
+    return bytes(output)
+
+
+def decompress(compressed, size):
+    """Same decoding as the watch, to check the compressed image"""
+    image = bytearray()
+    position = 0
+
+    def read_length(length):
+        nonlocal position
+        if length == 15:
+            while True:
+                value = compressed[position]
+                position += 1
+                length += value
+                if value != 255:
+                    break
+        return length
+
+    while len(image) < size:
+        token = compressed[position]
+        position += 1
+        literals = read_length(token >> 4)
+        image += compressed[position:position + literals]
+        position += literals
+        if len(image) == size:
+            break
+        offset = struct.unpack_from('<H', compressed, position)[0]
+        position += 2
+        length = read_length(token & 0x0F) + MIN_MATCH_LENGTH
+        if offset == 0 or offset > len(image):
+            raise ValueError('invalid offset')
+        for _ in range(length):
+            image.append(image[-offset])
+    if position != len(compressed) or len(image) != size:
+        raise ValueError('invalid size')
+    return bytes(image)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='compress a firmware image for the DFU service')
+    ap.add_argument('image', type=str, help='MCUBoot image (pinetime-mcuboot-app-image-x.y.z.bin)')
+    ap.add_argument('--output', '-o', type=str, required=True, help='output file name')
+    ap.add_argument('--package', type=str, help='also generate a DFU package (.zip) with adafruit-nrfutil')
+    args = ap.parse_args()
+
+    with open(args.image, 'rb') as fd:
+        image = fd.read()
+    if len(image) > MAX_IMAGE_SIZE:
+        sys.exit(f'Error: the image is larger than the OTA slot ({MAX_IMAGE_SIZE} bytes).')
+
+    body = compress(image)
+    if decompress(body, len(image)) != image:
+        sys.exit('Error: the compressed image does not decompress to the image.')
+
+    with open(args.output, 'wb') as fd:
+        fd.write(struct.pack('<4sB3xII', COMPRESSED_MAGIC, COMPRESSED_VERSION, len(image), zlib.crc32(image)))
+        fd.write(body)
+    print(f'{len(image)} -> {16 + len(body)} bytes ({100 * (16 + len(body)) / len(image):.1f}%)')
+
+    if args.package:
+        subprocess.run(['adafruit-nrfutil', 'dfu', 'genpkg', '--dev-type', '0x0052', '--application', args.output, args.package],
+                       check=True)
+
+
+if __name__ == '__main__':
+    main()
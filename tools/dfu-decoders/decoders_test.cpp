@@ -0,0 +1,261 @@
+// Tests of the decoders of the DFU service (components/ble/DfuPatch and DfuDecompressor) on the patches and compressed
+// images generated by the tools of tools/dfu-patch and tools/dfu-compress.
+//
+// Usage: dfu-decoders-test patch <base.bin> <image.bin> <patch.bin>
+//        dfu-decoders-test compressed <image.bin> <compressed.bin>
+//
+// The input is fed to the decoder in chunks of random sizes, like the DFU service does with the received packets, and
+// the image is rebuilt from the parts returned by the decoder as the DFU service writes it. The tests check that:
+// - the image is rebuilt exactly, whatever the size of the chunks, and its size and CRC are the ones of the header
+// - the parts are in the base or in the current chunk, and the matches only copy the image already produced
+// - a truncated input never completes, and its output is the beginning of the image
+// - a corrupted input fails, does not complete, or produces an image whose CRC differs from the one of the header (which
+//   the DFU service rejects), unless the corrupted byte is not used (the output is then the image itself)
+// - data after the end of the input makes the decoder fail
+// The chunk sizes and the corruptions are deterministic (mt19937).
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "components/ble/DfuDecompressor.h"
+#include "components/ble/DfuPatch.h"
+#include "utility/Crc32.h"
+
+namespace {
+  using Data = std::vector<uint8_t>;
+  using Pinetime::Controllers::DfuDecompressor;
+  using Pinetime::Controllers::DfuPatch;
+
+  // Size of the OTA slot
+  constexpr size_t maxImageSize = 475136;
+  // The chunks are up to the size of the largest BLE packets, or of a few of them
+  constexpr size_t maxChunkSizes[] = {1, 3, 20, 244, 1000};
+  constexpr int roundTrips = 40;
+  constexpr int truncations = 200;
+  constexpr int corruptions = 1000;
+
+  int failures = 0;
+
+  void Fail(const char* test, const char* message) {
+    fprintf(stderr, "%s: %s\n", test, message);
+    failures++;
+  }
+
+  bool Load(const char* path, Data& data) {
+    std::ifstream file {path, std::ios::binary};
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", path);
+      return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  struct Result {
+    Data output;
+    bool failed;
+    bool complete;
+    uint32_t imageSize;
+    uint32_t imageCrc;
+    // A part was outside of the base or of the current chunk, or copied data that was not produced yet
+    bool outOfBounds = false;
+  };
+
+  bool Contains(const uint8_t* begin, size_t size, const uint8_t* part, size_t length) {
+    return part >= begin && part <= begin + size && length <= static_cast<size_t>(begin + size - part);
+  }
+
+  // Each chunk is copied to a buffer of its own, as the packets are received: the parts must not refer to the previous
+  // ones
+  template <typename Decode>
+  void Feed(const Data& input, size_t maxChunkSize, std::mt19937& random, Decode decode) {
+    size_t position = 0;
+    while (position < input.size()) {
+      const size_t chunkSize = std::min<size_t>(1 + random() % maxChunkSize, input.size() - position);
+      const Data chunk(input.begin() + static_cast<std::ptrdiff_t>(position),
+                       input.begin() + static_cast<std::ptrdiff_t>(position + chunkSize));
+      decode(chunk);
+      position += chunkSize;
+    }
+  }
+
+  Result ApplyPatch(const Data& base, const Data& patch, size_t maxChunkSize, std::mt19937& random) {
+    DfuPatch decoder {base.data(), base.size(), maxImageSize};
+    Result result;
+    decoder.Begin();
+    Feed(patch, maxChunkSize, random, [&](const Data& chunk) {
+      const uint8_t* data = chunk.data();
+      size_t size = chunk.size();
+      while (size > 0) {
+        size_t length;
+        const uint8_t* part = decoder.Next(data, size, length);
+        if (part == nullptr) {
+          continue;
+        }
+        if (!Contains(base.data(), base.size(), part, length) && !Contains(chunk.data(), chunk.size(), part, length)) {
+          result.outOfBounds = true;
+          return;
+        }
+        result.output.insert(result.output.end(), part, part + length);
+      }
+    });
+    result.failed = decoder.HasFailed();
+    result.complete = decoder.IsComplete();
+    result.imageSize = decoder.ImageSize();
+    result.imageCrc = decoder.ImageCrc();
+    return result;
+  }
+
+  Result Decompress(const Data& compressed, size_t maxChunkSize, std::mt19937& random) {
+    DfuDecompressor decoder {maxImageSize};
+    Result result;
+    decoder.Begin();
+    Feed(compressed, maxChunkSize, random, [&](const Data& chunk) {
+      const uint8_t* data = chunk.data();
+      size_t size = chunk.size();
+      DfuDecompressor::Part part;
+      while (decoder.Next(data, size, part)) {
+        if (part.literals != nullptr) {
+          if (!Contains(chunk.data(), chunk.size(), part.literals, part.length)) {
+            result.outOfBounds = true;
+            return;
+          }
+          result.output.insert(result.output.end(), part.literals, part.literals + part.length);
+          continue;
+        }
+        if (part.distance == 0 || part.distance > result.output.size()) {
+          result.outOfBounds = true;
+          return;
+        }
+        // The match overlaps the bytes it produces when the distance is smaller than the length
+        for (size_t i = 0; i < part.length; i++) {
+          result.output.push_back(result.output[result.output.size() - part.distance]);
+        }
+      }
+    });
+    result.failed = decoder.HasFailed();
+    result.complete = decoder.IsComplete();
+    result.imageSize = decoder.ImageSize();
+    result.imageCrc = decoder.ImageCrc();
+    return result;
+  }
+
+  template <typename Decode>
+  void Test(const char* name, const Data& image, const Data& input, Decode decode) {
+    std::mt19937 random {1};
+    const uint32_t imageCrc = Pinetime::Utility::Crc32(image.data(), image.size());
+
+    for (const size_t maxChunkSize : maxChunkSizes) {
+      for (int i = 0; i < roundTrips; i++) {
+        const Result result = decode(input, maxChunkSize, random);
+        if (result.outOfBounds) {
+          Fail(name, "part out of bounds");
+        } else if (result.failed || !result.complete) {
+          Fail(name, "the decoder did not complete");
+        } else if (result.output != image) {
+          Fail(name, "the output differs from the image");
+        } else if (result.imageSize != image.size() || result.imageCrc != imageCrc) {
+          Fail(name, "the size or the CRC of the header differs from the image");
+        } else {
+          continue;
+        }
+        fprintf(stderr, "  chunks of up to %zu bytes\n", maxChunkSize);
+        return;
+      }
+    }
+
+    // Truncated inputs, including in the header
+    for (int i = 0; i < truncations; i++) {
+      const size_t size = (i < 32) ? static_cast<size_t>(i) : random() % input.size();
+      const Data truncated(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(size));
+      const Result result = decode(truncated, maxChunkSizes[random() % std::size(maxChunkSizes)], random);
+      if (result.outOfBounds || result.complete || result.output.size() > image.size() ||
+          !std::equal(result.output.begin(), result.output.end(), image.begin())) {
+        fprintf(stderr, "%s: input truncated to %zu bytes\n", name, size);
+        Fail(name, "a truncated input completed or produced another image");
+        return;
+      }
+    }
+
+    // Corrupted inputs: a random byte, or a byte of the header
+    int failed = 0;
+    int incomplete = 0;
+    int badCrc = 0;
+    int unused = 0;
+    for (int i = 0; i < corruptions; i++) {
+      Data corrupted = input;
+      const size_t position = (i < 64) ? static_cast<size_t>(i) % 32 : random() % input.size();
+      corrupted[position] ^= static_cast<uint8_t>(1 + random() % 255);
+      const Result result = decode(corrupted, maxChunkSizes[random() % std::size(maxChunkSizes)], random);
+      if (result.outOfBounds) {
+        fprintf(stderr, "%s: byte %zu corrupted\n", name, position);
+        Fail(name, "part out of bounds");
+        return;
+      }
+      if (result.failed) {
+        failed++;
+      } else if (!result.complete) {
+        incomplete++;
+      } else if (Pinetime::Utility::Crc32(result.output.data(), result.output.size()) != result.imageCrc ||
+                 result.output.size() != result.imageSize) {
+        badCrc++;
+      } else if (result.output == image) {
+        unused++;
+      } else {
+        fprintf(stderr, "%s: byte %zu corrupted\n", name, position);
+        Fail(name, "a corrupted input produced another image with a valid CRC");
+        return;
+      }
+    }
+
+    // Data after the end
+    Data extended = input;
+    extended.push_back(0);
+    const Result result = decode(extended, maxChunkSizes[0], random);
+    if (!result.failed) {
+      Fail(name, "the data after the end of the input was accepted");
+      return;
+    }
+
+    printf("%s: %zu bytes -> %zu bytes, corruptions: %d failed, %d incomplete, %d bad CRC, %d unused\n", name, input.size(),
+           image.size(), failed, incomplete, badCrc, unused);
+  }
+}
+
+int main(int argc, char** argv) {
+  Data image;
+  Data input;
+  if (argc == 5 && strcmp(argv[1], "patch") == 0) {
+    Data base;
+    if (!Load(argv[2], base) || !Load(argv[3], image) || !Load(argv[4], input)) {
+      return 1;
+    }
+    Test("patch", image, input, [&base](const Data& patch, size_t maxChunkSize, std::mt19937& random) {
+      return ApplyPatch(base, patch, maxChunkSize, random);
+    });
+    // The patch only applies to its base
+    Data otherBase = base;
+    otherBase[otherBase.size() / 2] ^= 1;
+    std::mt19937 random {1};
+    const Result result = ApplyPatch(otherBase, input, maxChunkSizes[3], random);
+    if (!result.failed || !result.output.empty()) {
+      Fail("patch", "the patch was applied to another base");
+    }
+  } else if (argc == 4 && strcmp(argv[1], "compressed") == 0) {
+    if (!Load(argv[2], image) || !Load(argv[3], input)) {
+      return 1;
+    }
+    Test("compressed", image, input, Decompress);
+  } else {
+    fprintf(stderr, "Usage: %s patch <base.bin> <image.bin> <patch.bin>\n", argv[0]);
+    fprintf(stderr, "       %s compressed <image.bin> <compressed.bin>\n", argv[0]);
+    return 2;
+  }
+  return (failures == 0) ? 0 : 1;
+}
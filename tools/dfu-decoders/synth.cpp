@@ -0,0 +1,172 @@
+// Generates synthetic firmware images for the tests of the DFU decoders, from which tools/dfu-patch/generate-patch.py
+// and tools/dfu-compress/compress-image.py generate the patches and the compressed images.
+//
+// Usage: dfu-synth <scenario> <image.bin>
+//
+// The images look like a firmware to the tools: code made of a small set of frequent instructions, constant tables,
+// strings and padding. The scenarios are successive versions of the same firmware:
+//   base     the running firmware
+//   update   base with a few changed constants, a function inserted and another one removed (code after them moves),
+//            a new version string, and more data at the end
+//   rewrite  another firmware of the same size, mostly different from base
+// The generation is deterministic (mt19937, no implementation-defined distribution).
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+namespace {
+  using Image = std::vector<uint8_t>;
+
+  constexpr size_t baseSize = 96 * 1024;
+
+  class Generator {
+  public:
+    explicit Generator(uint32_t seed) : random {seed} {
+      for (auto& instruction : instructions) {
+        instruction = static_cast<uint16_t>(random());
+      }
+    }
+
+    uint32_t Below(uint32_t count) {
+      return static_cast<uint32_t>(random() % count);
+    }
+
+    // Most instructions are among a few frequent ones, the other ones are random
+    void Code(Image& image, size_t size) {
+      for (size_t i = 0; i + 1 < size; i += 2) {
+        const uint16_t instruction = (Below(4) != 0) ? instructions[Below(8) * Below(8)] : static_cast<uint16_t>(random());
+        image.push_back(instruction & 0xFF);
+        image.push_back(instruction >> 8);
+      }
+    }
+
+    // Increasing 32 bits values, like lookup tables and addresses
+    void Table(Image& image, size_t size) {
+      uint32_t value = random() & 0xFFFF;
+      for (size_t i = 0; i + 3 < size; i += 4) {
+        value += Below(300);
+        for (int byte = 0; byte < 4; byte++) {
+          image.push_back(static_cast<uint8_t>(value >> (8 * byte)));
+        }
+      }
+    }
+
+    void Strings(Image& image, size_t size) {
+      static constexpr const char* words[] = {"Heart rate", "Steps", "Bluetooth", "Battery", "Settings", "Alarm", "Timer",
+                                              "Notification", "Brightness", "Firmware", "Validate", "Music"};
+      const size_t end = image.size() + size;
+      while (image.size() < end) {
+        const char* word = words[Below(std::size(words))];
+        for (size_t i = 0; i <= strlen(word) && image.size() < end; i++) {
+          image.push_back(static_cast<uint8_t>(word[i]));
+        }
+      }
+    }
+
+    void Padding(Image& image, size_t size, uint8_t value) {
+      image.insert(image.end(), size, value);
+    }
+
+    // A function: code followed by its literal pool
+    void Function(Image& image) {
+      Code(image, 64 + 2 * Below(600));
+      Table(image, 4 * (1 + Below(8)));
+    }
+
+  private:
+    std::mt19937 random;
+    std::array<uint16_t, 64> instructions;
+  };
+
+  void Version(Image& image, const char* version) {
+    image.insert(image.end(), version, version + strlen(version) + 1);
+  }
+
+  // The functions of a firmware of about baseSize bytes
+  std::vector<Image> Functions(uint32_t seed) {
+    Generator generator {seed};
+    std::vector<Image> functions;
+    size_t size = 0;
+    while (size < baseSize - 16 * 1024) {
+      functions.emplace_back();
+      generator.Function(functions.back());
+      size += functions.back().size();
+    }
+    return functions;
+  }
+
+  Image Firmware(uint32_t seed, const std::vector<Image>& functions, const char* version) {
+    Generator generator {seed};
+    Image image;
+    // MCUBoot header and vector table
+    generator.Padding(image, 32, 0x00);
+    generator.Table(image, 224);
+    for (const auto& function : functions) {
+      image.insert(image.end(), function.begin(), function.end());
+    }
+    generator.Table(image, 4096);
+    generator.Strings(image, 6000);
+    Version(image, version);
+    generator.Padding(image, 1500, 0xFF);
+    generator.Strings(image, 2000);
+    return image;
+  }
+
+  Image Base() {
+    return Firmware(2, Functions(1), "1.14.0");
+  }
+
+  Image Update() {
+    auto functions = Functions(1);
+    Generator changes {3};
+    // Changed constants in a few functions
+    for (int i = 0; i < 20; i++) {
+      auto& function = functions[changes.Below(functions.size())];
+      function[changes.Below(function.size())] ^= static_cast<uint8_t>(1 + changes.Below(255));
+    }
+    // A new function, and one that is not used anymore
+    Image function;
+    changes.Function(function);
+    functions.insert(functions.begin() + static_cast<std::ptrdiff_t>(functions.size() / 3), function);
+    functions.erase(functions.begin() + static_cast<std::ptrdiff_t>(2 * functions.size() / 3));
+    Image image = Firmware(2, functions, "1.15.0");
+    changes.Table(image, 3000);
+    changes.Code(image, 2000);
+    return image;
+  }
+
+  Image Rewrite() {
+    return Firmware(5, Functions(4), "2.0.0");
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <base|update|rewrite> <image.bin>\n", argv[0]);
+    return 2;
+  }
+  Image image;
+  if (strcmp(argv[1], "base") == 0) {
+    image = Base();
+  } else if (strcmp(argv[1], "update") == 0) {
+    image = Update();
+  } else if (strcmp(argv[1], "rewrite") == 0) {
+    image = Rewrite();
+  } else {
+    fprintf(stderr, "Unknown scenario %s\n", argv[1]);
+    return 2;
+  }
+  std::ofstream output {argv[2], std::ios::binary};
+  output.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+  if (!output) {
+    fprintf(stderr, "Cannot write %s\n", argv[2]);
+    return 1;
+  }
+  return 0;
+}
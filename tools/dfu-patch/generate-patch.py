@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+
+# Generates a patch that updates the firmware running on the watch to a new firmware, to send with the DFU service
+# instead of the full image. See doc/DeltaFirmwareUpdate.md and src/components/ble/DfuPatch.h.
+
+import sys
+import zlib
+import struct
+import argparse
+
+PATCH_MAGIC = b'ITDP'
+PATCH_VERSION = 1
+OPERATION_COPY = 0
+OPERATION_INSERT = 1
+OPERATION_SIZE = 12
+# Size of the blocks of the base indexed to find the matches, and shortest copy worth an operation
+BLOCK_SIZE = 16
+MIN_COPY_LENGTH = 32
+# Offsets kept per block of the base: repeated blocks (padding, tables) would make the search slow
+MAX_CANDIDATES = 8
+# Largest image the watch accepts (size of the OTA slot)
+MAX_IMAGE_SIZE = 475136
+
+
+def index_base(base):
+    """Offsets of each block of BLOCK_SIZE bytes of the base, at every 2 bytes (Thumb instructions)"""
+    index = {}
+    for offset in range(0, len(base) - BLOCK_SIZE + 1, 2):
+        candidates = index.setdefault(base[offset:offset + BLOCK_SIZE], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(offset)
+    return index
+
+
+def match_length(base, base_offset, image, image_offset):
+    length = 0
+    limit = min(len(base) - base_offset, len(image) - image_offset)
+    # Compare large chunks first, then byte by byte
+    step = 256
+    while length < limit:
+        size = min(step, limit - length)
+        if base[base_offset + length:base_offset + length + size] == image[image_offset + length:image_offset + length + size]:
+            length += size
+        elif step > 1:
+            step //= 16
+        else:
+            break
+    return length
+
+
+def diff(base, image):
+    """Operations (type, offset, data or length) that produce the image from the base"""
+    index = index_base(base)
+    operations = []
+    literal_start = 0
+    position = 0
+    while position < len(image):
+        best_offset, best_length = 0, 0
+        for offset in index.get(image[position:position + BLOCK_SIZE], []):
+            length = match_length(base, offset, image, position)
+            if length > best_length:
+                best_offset, best_length = offset, length
+        if best_length < MIN_COPY_LENGTH:
+            position += 1
+            continue
+        if literal_start < position:
+            operations.append((OPERATION_INSERT, 0, image[literal_start:position]))
+        operations.append((OPERATION_COPY, best_offset, best_length))
+        position += best_length
+        literal_start = position
+    if literal_start < len(image):
+        operations.append((OPERATION_INSERT, 0, image[literal_start:]))
+    return operations
+
+
+def encode(base, image, operations):
+    patch = bytearray(struct.pack('<4sBBHIIII', PATCH_MAGIC, PATCH_VERSION, 0, 0,
+                                  len(base), zlib.crc32(base), len(image), zlib.crc32(image)))
+    for operation_type, offset, data in operations:
+        if operation_type == OPERATION_COPY:
+            patch += struct.pack('<B3xII', OPERATION_COPY, data, offset)
+        else:
+            patch += struct.pack('<B3xII', OPERATION_INSERT, len(data), 0)
+            patch += data
+    return bytes(patch)
+
+
+def apply(base, patch):
+    """Same decoding as the watch, to check the patch"""
+    magic, version, flags, _, base_size, base_crc, image_size, image_crc = struct.unpack_from('<4sBBHIIII', patch)
+    if magic != PATCH_MAGIC or version != PATCH_VERSION or flags != 0:
+        raise ValueError('invalid header')
+    if base_size != len(base) or base_crc != zlib.crc32(base):
+        raise ValueError('the patch does not apply to this base')
+    image = bytearray()
+    position = 24
+    while len(image) < image_size:
+        operation_type, length, offset = struct.unpack_from('<B3xII', patch, position)
+        position += OPERATION_SIZE
+        if operation_type == OPERATION_COPY:
+            image += base[offset:offset + length]
+        else:
+            image += patch[position:position + length]
+            position += length
+    if position != len(patch) or zlib.crc32(image) != image_crc:
+        raise ValueError('invalid image')
+    return bytes(image)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='generate a DFU patch from the running firmware to a new firmware')
+    ap.add_argument('base', type=str, help='MCUBoot image running on the watch (pinetime-mcuboot-app-image-x.y.z.bin)')
+    ap.add_argument('image', type=str, help='new MCUBoot image')
+    ap.add_argument('--output', '-o', type=str, required=True, help='output file name')
+    args = ap.parse_args()
+
+    with open(args.base, 'rb') as fd:
+        base = fd.read()
+    with open(args.image, 'rb') as fd:
+        image = fd.read()
+    if len(image) > MAX_IMAGE_SIZE:
+        sys.exit(f'Error: the image is larger than the OTA slot ({MAX_IMAGE_SIZE} bytes).')
+
+    operations = diff(base, image)
+    patch = encode(base, image, operations)
+    if apply(base, patch) != image:
+        sys.exit('Error: the patch does not produce the image.')
+
+    with open(args.output, 'wb') as fd:
+        fd.write(patch)
+    copied = sum(data for operation_type, _, data in operations if operation_type == OPERATION_COPY)
+    print(f'{len(patch)} bytes ({100 * len(patch) / len(image):.1f}% of the image), '
+          f'{len(operations)} operations, {copied} bytes copied from the base')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,160 @@
+#include "FlashModel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "drivers/Spi.h"
+#include "libraries/delay/nrf_delay.h"
+
+FlashModel::Stats FlashModel::stats;
+
+namespace {
+  using FlashModel::stats;
+
+  constexpr size_t flashSize = 0x400000;
+  constexpr size_t sectorSize = 4096;
+  constexpr size_t pageSize = 256;
+
+  // Timings of the watch: 8MHz SPI, overhead of a transaction in the SPI driver (chip select, DMA setup, semaphore),
+  // and the FreeRTOS tick, the unit of the sleeps of SpiNorFlash
+  constexpr double byteMicroseconds = 1.0;
+  constexpr double transactionMicroseconds = 15.0;
+  constexpr double tickMicroseconds = 1000000.0 / 1024;
+  // Typical program time of a page and erase times of a sector and of the blocks
+  constexpr double programMicroseconds = 600;
+  constexpr double eraseMicroseconds = 45000;
+  constexpr double block32KEraseMicroseconds = 150000;
+  constexpr double block64KEraseMicroseconds = 250000;
+
+  // State of the flash chip
+  std::vector<uint8_t> flash(flashSize, 0xFF);
+  double now = 0;
+  // End of the page program or sector erase in progress
+  double busyUntil = 0;
+  // Remaining time of the suspended erase
+  double suspendedMicroseconds = 0;
+  bool writeEnabled = false;
+
+  void Elapse(double microseconds) {
+    now += microseconds;
+    stats.microseconds += microseconds;
+  }
+
+  void Transaction(size_t size) {
+    stats.transactions++;
+    stats.bytes += size;
+    Elapse(transactionMicroseconds + size * byteMicroseconds);
+  }
+
+  bool Busy() {
+    return now < busyUntil;
+  }
+
+  void StartOperation(double microseconds) {
+    writeEnabled = false;
+    busyUntil = now + microseconds;
+  }
+
+  void Erase(uint32_t address, size_t size, double microseconds) {
+    if (writeEnabled && !Busy()) {
+      memset(&flash[address & ~(size - 1)], 0xFF, size);
+      stats.sectorErases += size / sectorSize;
+      StartOperation(microseconds);
+    }
+  }
+
+  uint32_t Address(const uint8_t* cmd) {
+    return (cmd[1] << 16U) | (cmd[2] << 8U) | cmd[3];
+  }
+}
+
+void vTaskDelay(TickType_t ticks) {
+  Elapse(ticks * tickMicroseconds);
+}
+
+TickType_t xTaskGetTickCount() {
+  return static_cast<TickType_t>(now / tickMicroseconds);
+}
+
+void nrf_delay_us(uint32_t microseconds) {
+  Elapse(microseconds);
+}
+
+// The SPI driver talks to the flash chip of the model
+
+using Pinetime::Drivers::Spi;
+
+Spi::Spi(SpiMaster& spiMaster, uint8_t pinCsn) : spiMaster {spiMaster}, pinCsn {pinCsn} {
+}
+
+bool Spi::Read(uint8_t* cmd, size_t cmdSize, uint8_t* data, size_t dataSize) {
+  Transaction(cmdSize + dataSize);
+  switch (cmd[0]) {
+    case 0x03: // Read
+      stats.reads++;
+      for (size_t i = 0; i < dataSize; i++) {
+        // Reads are not possible while the flash is busy
+        data[i] = Busy() ? 0x5A : flash[(Address(cmd) + i) % flashSize];
+      }
+      break;
+    case 0x05: // Read status register
+      if (dataSize > 0) {
+        data[0] = (Busy() ? 0x01 : 0x00) | (writeEnabled ? 0x02 : 0x00);
+      }
+      break;
+    case 0x06: // Write enable
+      writeEnabled = writeEnabled || !Busy();
+      break;
+    case 0x20: // Sector erase
+      Erase(Address(cmd), sectorSize, eraseMicroseconds);
+      break;
+    case 0x52: // 32KB block erase
+      Erase(Address(cmd), 0x8000, block32KEraseMicroseconds);
+      break;
+    case 0xD8: // 64KB block erase
+      Erase(Address(cmd), 0x10000, block64KEraseMicroseconds);
+      break;
+    case 0x75: // Erase suspend
+      suspendedMicroseconds = Busy() ? busyUntil - now : 0;
+      busyUntil = now;
+      break;
+    case 0x7A: // Erase resume
+      busyUntil = now + suspendedMicroseconds;
+      suspendedMicroseconds = 0;
+      break;
+    default: // Security register (no failure), identification...
+      memset(data, 0, dataSize);
+      break;
+  }
+  return true;
+}
+
+bool Spi::WriteCmdAndBuffer(const uint8_t* cmd, size_t cmdSize, const uint8_t* data, size_t dataSize) {
+  Transaction(cmdSize + dataSize);
+  if (cmd[0] == 0x02 && writeEnabled && !Busy()) { // Page program
+    // The address wraps around at the end of the page
+    const uint32_t address = Address(cmd);
+    for (size_t i = 0; i < dataSize; i++) {
+      flash[(address & ~(pageSize - 1)) + ((address + i) % pageSize)] &= data[i];
+    }
+    stats.pagePrograms++;
+    StartOperation(programMicroseconds);
+  }
+  return true;
+}
+
+bool Spi::Write(const uint8_t* /*data*/, size_t size, const std::function<void()>& /*preTransactionHook*/) {
+  Transaction(size);
+  return true;
+}
+
+void FlashModel::EraseAll() {
+  std::fill(flash.begin(), flash.end(), 0xFF);
+  busyUntil = 0;
+  suspendedMicroseconds = 0;
+  writeEnabled = false;
+}
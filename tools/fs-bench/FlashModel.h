@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Model of the flash chip of the watch backed by RAM, behind the SPI driver (drivers/Spi): drivers/SpiNorFlash runs
+// unmodified on top of it. The model counts the SPI transactions and bytes sent by the driver, and estimates the time
+// they would take on the watch. The sleeps of the driver (vTaskDelay, nrf_delay_us) advance the simulated time.
+namespace FlashModel {
+  struct Stats {
+    uint32_t transactions = 0;
+    uint64_t bytes = 0;
+    uint32_t reads = 0;
+    uint32_t pagePrograms = 0;
+    uint32_t sectorErases = 0;
+    double microseconds = 0;
+  };
+
+  extern Stats stats;
+
+  // Erases the whole chip, as a new watch: the next mount of FS formats the file system
+  void EraseAll();
+}
@@ -0,0 +1,184 @@
+// Benchmark of the littlefs configuration of the firmware (components/fs/FS, FS_PROFILE) on the host.
+//
+// Usage: fs-bench-<profile>
+//
+// FS and the SPI flash driver (drivers/SpiNorFlash) run over the model of the flash chip (FlashModel), which counts the
+// SPI transactions and bytes sent by the driver, and estimates the time they would take on the watch. The scenarios are
+// the file system accesses that matter for the user: mounting at boot, saving the settings, loading a font with LVGL,
+// and uploading a file with the BLE FS service.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "FlashModel.h"
+#include "components/fs/FS.h"
+#include "drivers/Spi.h"
+#include "drivers/SpiNorFlash.h"
+
+namespace {
+  using FlashModel::stats;
+  using FlashModel::Stats;
+  using Pinetime::Controllers::FS;
+  using Pinetime::Drivers::Spi;
+  using Pinetime::Drivers::SpiNorFlash;
+
+  constexpr size_t settingsSize = 96;
+  constexpr int settingsSaves = 50;
+  constexpr size_t fontSize = 20 * 1024;
+  // Sizes of the successive reads of lv_font_load(): headers, tables and glyph bitmaps
+  constexpr size_t fontReads[] = {4, 4, 48, 2, 16, 64, 4, 8};
+  constexpr size_t uploadSize = 20 * 1024;
+  // Data in a WRITE_DATA request of the FS service, with a MTU of 247 bytes
+  constexpr size_t uploadChunkSize = 227;
+
+  void Print(const char* scenario, const Stats& s, int count = 1) {
+    printf("%-28s %10.1f %10.1f %10.1f %10.1f %10.1f %10.2f\n",
+           scenario,
+           static_cast<double>(s.transactions) / count,
+           static_cast<double>(s.bytes) / count,
+           static_cast<double>(s.reads) / count,
+           static_cast<double>(s.pagePrograms) / count,
+           static_cast<double>(s.sectorErases) / count,
+           s.microseconds / 1000 / count);
+  }
+
+  std::vector<uint8_t> Content(size_t size, uint8_t seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) {
+      data[i] = static_cast<uint8_t>(i * 31 + seed);
+    }
+    return data;
+  }
+
+  bool WriteFile(FS& fs, const char* path, const std::vector<uint8_t>& data) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+      return false;
+    }
+    const int written = fs.FileWrite(&file, data.data(), data.size());
+    return fs.FileClose(&file) == LFS_ERR_OK && written == static_cast<int>(data.size());
+  }
+
+  // Files of a watch with the external resources and a few recordings installed
+  bool Populate(FS& fs) {
+    fs.DirCreate("/.system");
+    fs.DirCreate("/fonts");
+    fs.DirCreate("/images");
+    const char* fonts[] = {"/fonts/teko.bin", "/fonts/bebas.bin", "/fonts/lv_font_dots_40.bin", "/fonts/7segments_40.bin"};
+    for (const char* path : fonts) {
+      if (!WriteFile(fs, path, Content(fontSize, static_cast<uint8_t>(path[7])))) {
+        return false;
+      }
+    }
+    const char* images[] = {"/images/navigation0.bin", "/images/navigation1.bin", "/images/pine_small.bin"};
+    for (const char* path : images) {
+      if (!WriteFile(fs, path, Content(12 * 1024, static_cast<uint8_t>(path[8])))) {
+        return false;
+      }
+    }
+    char path[32];
+    for (int i = 0; i < 8; i++) {
+      snprintf(path, sizeof(path), "/.system/log%d.dat", i);
+      if (!WriteFile(fs, path, Content(2048, static_cast<uint8_t>(i)))) {
+        return false;
+      }
+    }
+    return WriteFile(fs, "/settings.dat", Content(settingsSize, 0));
+  }
+
+  // Same accesses as Settings::SaveSettingsToFile()
+  void SaveSettings(FS& fs, uint8_t seed) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, "/settings.dat", LFS_O_WRONLY | LFS_O_CREAT) != LFS_ERR_OK) {
+      return;
+    }
+    const auto data = Content(settingsSize, seed);
+    fs.FileWrite(&file, data.data(), data.size());
+    fs.FileClose(&file);
+  }
+
+  // Small sequential reads of the whole file, as lv_font_load() through the LVGL file system driver
+  void LoadFont(FS& fs, const char* path) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, path, LFS_O_RDONLY) != LFS_ERR_OK) {
+      return;
+    }
+    uint8_t buffer[64];
+    size_t offset = 0;
+    for (size_t i = 0; offset < fontSize; i++) {
+      const size_t size = std::min(fontReads[i % std::size(fontReads)], fontSize - offset);
+      fs.FileRead(&file, buffer, size);
+      offset += size;
+    }
+    fs.FileClose(&file);
+  }
+
+  // Same accesses as a WRITE session of the FS service: the file stays open between chunks
+  void Upload(FS& fs, const char* path) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+      return;
+    }
+    const auto data = Content(uploadSize, 7);
+    for (size_t offset = 0; offset < uploadSize; offset += uploadChunkSize) {
+      fs.FileWrite(&file, data.data() + offset, std::min(uploadChunkSize, uploadSize - offset));
+    }
+    fs.FileClose(&file);
+  }
+}
+
+int main() {
+  Pinetime::Drivers::SpiMaster spiMaster;
+  Spi spi {spiMaster, 0};
+  SpiNorFlash flashDriver {spi};
+
+  printf("Profile %s: read_size %u, prog_size %u, cache_size %u, lookahead_size %u\n",
+         FS_PROFILE_NAME,
+         FS::readSize,
+         FS::progSize,
+         FS::cacheSize,
+         FS::lookaheadSize);
+  printf("RAM: %u bytes mounted, %u bytes per open file\n\n", 2 * FS::cacheSize + FS::lookaheadSize, FS::cacheSize);
+  printf("%-28s %10s %10s %10s %10s %10s %10s\n", "Scenario", "SPI trans.", "SPI bytes", "Reads", "Programs", "Erases", "Est. ms");
+
+  {
+    FS fs {flashDriver};
+    stats = {};
+    fs.Init();
+    Print("format and mount", stats);
+    if (!Populate(fs)) {
+      fprintf(stderr, "Failed to populate the file system\n");
+      return 1;
+    }
+  }
+
+  // A new instance of FS, as after a reboot
+  FS fs {flashDriver};
+  stats = {};
+  fs.Init();
+  Print("mount", stats);
+
+  // The first allocation after mounting scans the file system to fill the lookahead bitmap
+  stats = {};
+  SaveSettings(fs, 1);
+  Print("settings save (first)", stats);
+
+  stats = {};
+  for (int i = 0; i < settingsSaves; i++) {
+    SaveSettings(fs, static_cast<uint8_t>(i + 2));
+  }
+  Print("settings save", stats, settingsSaves);
+
+  stats = {};
+  LoadFont(fs, "/fonts/teko.bin");
+  Print("font load (20KB)", stats);
+
+  stats = {};
+  Upload(fs, "/upload.bin");
+  Print("file upload (20KB)", stats);
+  return 0;
+}
@@ -0,0 +1,332 @@
+// Test of the installation of resource packages (components/fs/ResourceInstaller), over FS, littlefs and the SPI flash
+// driver running on the model of the flash chip (FlashModel).
+//
+// Usage: resource-installer-test
+//
+// The packages are built as src/resources/generate-package.py does, and sent in chunks of the size of the WRITE_DATA
+// requests of the FS service. Each scenario starts from an erased flash:
+// - a package with files in subdirectories and obsolete files is installed, and its resources are available
+// - chunks sent again (retries of the client) are ignored, chunks after the expected position are rejected
+// - an install interrupted in the middle of an entry, then after a reboot, resumes after the last installed entry, and
+//   the resource being received keeps its previous version until then
+// - entries larger than the package (size close to UINT32_MAX), files to delete with data, and data with a bad CRC
+//   fail the install without touching the previous version of the resource
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "FlashModel.h"
+#include "components/fs/FS.h"
+#include "components/fs/ResourceInstaller.h"
+#include "drivers/Spi.h"
+#include "drivers/SpiNorFlash.h"
+#include "utility/Crc32.h"
+
+namespace {
+  using Data = std::vector<uint8_t>;
+  using Pinetime::Controllers::FS;
+  using Pinetime::Controllers::ResourceInstaller;
+  using Pinetime::Drivers::Spi;
+  using Pinetime::Drivers::SpiNorFlash;
+
+  // Data in a WRITE_DATA request of the FS service, with a MTU of 247 bytes
+  constexpr uint32_t chunkSize = 227;
+  constexpr size_t entryHeaderSize = 12;
+  constexpr const char* temporaryPath = "/.system/resources.tmp";
+  constexpr const char* progressPath = "/.system/resources.progress";
+
+  int failures = 0;
+
+  void Check(bool condition, const char* scenario, const char* message) {
+    if (!condition) {
+      fprintf(stderr, "%s: %s\n", scenario, message);
+      failures++;
+    }
+  }
+
+  void Put32(Data& data, size_t offset, uint32_t value) {
+    memcpy(&data[offset], &value, sizeof(value));
+  }
+
+  Data Content(size_t size, uint8_t seed) {
+    Data data(size);
+    for (size_t i = 0; i < size; i++) {
+      data[i] = static_cast<uint8_t>(i * 31 + seed);
+    }
+    return data;
+  }
+
+  // Entry of a package: header (type, path length, size, CRC32 of the data), path and data
+  Data Entry(uint8_t type, const std::string& path, const Data& data) {
+    Data entry(entryHeaderSize);
+    entry[0] = type;
+    entry[1] = static_cast<uint8_t>(path.size());
+    Put32(entry, 4, static_cast<uint32_t>(data.size()));
+    Put32(entry, 8, Pinetime::Utility::Crc32(data.data(), data.size()));
+    entry.insert(entry.end(), path.begin(), path.end());
+    entry.insert(entry.end(), data.begin(), data.end());
+    return entry;
+  }
+
+  Data File(const std::string& path, const Data& data) {
+    return Entry(0, path, data);
+  }
+
+  Data Delete(const std::string& path) {
+    return Entry(1, path, {});
+  }
+
+  // Header (magic, version, entry count, size, CRC32 of the entries) followed by the entries
+  Data Package(const std::vector<Data>& entries) {
+    Data body;
+    for (const auto& entry : entries) {
+      body.insert(body.end(), entry.begin(), entry.end());
+    }
+    Data package(16);
+    memcpy(package.data(), "ITRP", 4);
+    package[4] = ResourceInstaller::formatVersion;
+    package[6] = static_cast<uint8_t>(entries.size());
+    package[7] = static_cast<uint8_t>(entries.size() >> 8);
+    Put32(package, 8, static_cast<uint32_t>(package.size() + body.size()));
+    Put32(package, 12, Pinetime::Utility::Crc32(body.data(), body.size()));
+    package.insert(package.end(), body.begin(), body.end());
+    return package;
+  }
+
+  // Sends the package from `from` to `to` in chunks, as the FS service. Returns the first error, or 0.
+  int Send(ResourceInstaller& installer, const Data& package, uint32_t from, uint32_t to) {
+    for (uint32_t offset = from; offset < to; offset += chunkSize) {
+      const int res = installer.Write(offset, package.data() + offset, std::min(chunkSize, to - offset));
+      if (res < 0) {
+        return res;
+      }
+    }
+    return 0;
+  }
+
+  int Install(ResourceInstaller& installer, const Data& package) {
+    installer.Begin(static_cast<uint32_t>(package.size()));
+    return Send(installer, package, 0, static_cast<uint32_t>(package.size()));
+  }
+
+  bool WriteFile(FS& fs, const char* path, const Data& data) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+      return false;
+    }
+    const int written = fs.FileWrite(&file, data.data(), data.size());
+    return fs.FileClose(&file) == LFS_ERR_OK && written == static_cast<int>(data.size());
+  }
+
+  bool HasContent(FS& fs, const char* path, const Data& data) {
+    lfs_file_t file;
+    if (fs.FileOpen(&file, path, LFS_O_RDONLY) != LFS_ERR_OK) {
+      return false;
+    }
+    Data content(data.size() + 1);
+    const int read = fs.FileRead(&file, content.data(), content.size());
+    fs.FileClose(&file);
+    return read == static_cast<int>(data.size()) && std::equal(data.begin(), data.end(), content.begin());
+  }
+
+  bool Exists(FS& fs, const char* path) {
+    lfs_info info;
+    return fs.Stat(path, &info) == LFS_ERR_OK;
+  }
+
+  // Resources of the packages of the tests, larger than a chunk, and the previous version of the first one
+  const Data font = Content(3000, 1);
+  const Data oldFont = Content(2000, 2);
+  const Data image = Content(1500, 3);
+  const Data icon = Content(100, 4);
+
+  std::vector<Data> Entries() {
+    return {File("/fonts/teko.bin", font),
+            Delete("/fonts/old.bin"),
+            File("/images/navigation/arrow.bin", image),
+            Delete("/images/missing.bin"),
+            File("/icon.bin", icon)};
+  }
+
+  bool IsInstalled(FS& fs) {
+    return HasContent(fs, "/fonts/teko.bin", font) && HasContent(fs, "/images/navigation/arrow.bin", image) &&
+           HasContent(fs, "/icon.bin", icon) && !Exists(fs, "/fonts/old.bin") && !Exists(fs, temporaryPath) &&
+           !Exists(fs, progressPath) && fs.IsResourceAvailable("/fonts/teko.bin") &&
+           fs.IsResourceAvailable("/images/navigation/arrow.bin") && fs.IsResourceAvailable("/icon.bin");
+  }
+
+  // The flash driver and the file system of a watch that just booted, on the current content of the flash
+  struct Watch {
+    Watch() {
+      fs.Init();
+    }
+
+    Pinetime::Drivers::SpiMaster spiMaster;
+    Spi spi {spiMaster, 0};
+    SpiNorFlash flashDriver {spi};
+    FS fs {flashDriver};
+  };
+
+  // Older versions of the resources, on an erased flash
+  void Setup(FS& fs) {
+    fs.DirCreate("/fonts");
+    WriteFile(fs, "/fonts/teko.bin", oldFont);
+    WriteFile(fs, "/fonts/old.bin", Content(500, 5));
+  }
+
+  void TestInstall() {
+    constexpr const char* scenario = "install";
+    FlashModel::EraseAll();
+    Watch watch;
+    FS& fs = watch.fs;
+    Setup(fs);
+    ResourceInstaller installer {fs};
+    const Data package = Package(Entries());
+    Check(Install(installer, package) == 0, scenario, "the install failed");
+    Check(installer.IsComplete() && installer.Position() == package.size(), scenario, "the install did not complete");
+    Check(IsInstalled(fs), scenario, "the resources are not installed");
+
+    // The index is loaded again at boot
+    Watch rebooted;
+    Check(rebooted.fs.IsResourceAvailable("/fonts/teko.bin") && rebooted.fs.IsResourceAvailable("/icon.bin"),
+          scenario,
+          "the resources are not available after a reboot");
+  }
+
+  void TestDuplicatedChunks() {
+    constexpr const char* scenario = "duplicated chunks";
+    FlashModel::EraseAll();
+    Watch watch;
+    FS& fs = watch.fs;
+    Setup(fs);
+    ResourceInstaller installer {fs};
+    const Data package = Package(Entries());
+    const uint32_t size = static_cast<uint32_t>(package.size());
+    installer.Begin(size);
+    // Each chunk is sent again, with the previous one (overlapping the data already processed)
+    for (uint32_t offset = 0; offset < size; offset += chunkSize) {
+      const uint32_t length = std::min(chunkSize, size - offset);
+      Check(installer.Write(offset, package.data() + offset, length) == 0, scenario, "a chunk was rejected");
+      Check(installer.Write(offset, package.data() + offset, length) == 0, scenario, "a chunk sent again was rejected");
+      const uint32_t previous = (offset >= chunkSize) ? offset - chunkSize : 0;
+      Check(installer.Write(previous, package.data() + previous, offset + length - previous) == 0,
+            scenario,
+            "overlapping chunks were rejected");
+      // A chunk after the expected position is rejected, without failing the install
+      if (offset + length + chunkSize < size) {
+        Check(installer.Write(offset + length + chunkSize, package.data() + offset + length + chunkSize, chunkSize) ==
+                LFS_ERR_INVAL,
+              scenario,
+              "a chunk after the expected position was accepted");
+      }
+    }
+    Check(installer.IsComplete(), scenario, "the install did not complete");
+    Check(IsInstalled(fs), scenario, "the resources are not installed");
+  }
+
+  void TestResume() {
+    constexpr const char* scenario = "resume";
+    const Data package = Package(Entries());
+    const uint32_t size = static_cast<uint32_t>(package.size());
+    const std::vector<Data> entries = Entries();
+    // In the middle of the data of the third entry, once the first two are installed
+    const uint32_t thirdEntry = static_cast<uint32_t>(16 + entries[0].size() + entries[1].size());
+    const uint32_t interruption = thirdEntry + static_cast<uint32_t>(entryHeaderSize + 28 + 700);
+
+    FlashModel::EraseAll();
+    {
+      Watch watch;
+      FS& fs = watch.fs;
+      Setup(fs);
+      WriteFile(fs, "/icon.bin", Content(50, 6));
+      ResourceInstaller installer {fs};
+      installer.Begin(size);
+      Check(Send(installer, package, 0, interruption) == 0, scenario, "the install failed");
+      Check(installer.Position() == interruption, scenario, "the data was not processed");
+      // Disconnection: the partial entry is discarded
+      installer.Suspend();
+      Check(HasContent(fs, "/fonts/teko.bin", font) && !Exists(fs, "/fonts/old.bin"),
+            scenario,
+            "the first entries are not installed");
+      Check(!Exists(fs, temporaryPath) && !Exists(fs, "/images/navigation/arrow.bin"),
+            scenario,
+            "the interrupted entry was kept");
+      Check(installer.Write(interruption, package.data() + interruption, chunkSize) == LFS_ERR_INVAL,
+            scenario,
+            "data was accepted after the install was suspended");
+
+      // Interrupted again, after the header of the next attempt
+      installer.Begin(size);
+      Check(Send(installer, package, 0, 16) == 0, scenario, "the header of the package was rejected");
+      Check(installer.Position() == thirdEntry, scenario, "the install did not resume after the installed entries");
+      Check(HasContent(fs, "/icon.bin", Content(50, 6)), scenario, "the previous version of a resource was replaced");
+    }
+
+    // Reboot, and the package is sent again from the start
+    Watch watch;
+    FS& fs = watch.fs;
+    ResourceInstaller installer {fs};
+    installer.Begin(size);
+    Check(Send(installer, package, 0, 16) == 0, scenario, "the header of the package was rejected after a reboot");
+    Check(installer.Position() == thirdEntry, scenario, "the install did not resume after a reboot");
+    Check(Send(installer, package, 0, size) == 0, scenario, "the resumed install failed");
+    Check(installer.IsComplete(), scenario, "the resumed install did not complete");
+    Check(IsInstalled(fs), scenario, "the resources are not installed");
+
+    // Another package starts from its first entry
+    const Data other = Package({File("/icon.bin", Content(80, 7))});
+    Check(Install(installer, other) == 0 && HasContent(fs, "/icon.bin", Content(80, 7)),
+          scenario,
+          "another package was not installed");
+  }
+
+  // The entry after the first one of the package is replaced by `entry`: the install fails with `error`, after the
+  // first entry is installed, and the previous version of the font is kept
+  void TestInvalidEntry(const char* scenario, const Data& entry, int error) {
+    FlashModel::EraseAll();
+    Watch watch;
+    FS& fs = watch.fs;
+    Setup(fs);
+    ResourceInstaller installer {fs};
+    const Data package = Package({File("/icon.bin", icon), entry, File("/images/arrow.bin", image)});
+    Check(Install(installer, package) == error, scenario, "the invalid entry was not rejected");
+    Check(!installer.IsComplete() && installer.Position() == 0, scenario, "the install did not fail");
+    Check(installer.Write(0, package.data(), chunkSize) == LFS_ERR_INVAL, scenario, "data was accepted after a failure");
+    Check(HasContent(fs, "/icon.bin", icon), scenario, "the entry before the invalid one was not installed");
+    Check(HasContent(fs, "/fonts/teko.bin", oldFont) && HasContent(fs, "/fonts/old.bin", Content(500, 5)),
+          scenario,
+          "the previous version of a resource was modified");
+    Check(!Exists(fs, "/images/arrow.bin") && !Exists(fs, temporaryPath), scenario, "the entries after the invalid one were written");
+  }
+
+  void TestInvalidEntries() {
+    // The size of the data would wrap around if it were added to the position
+    Data overflow = File("/fonts/teko.bin", font);
+    Put32(overflow, 4, 0xFFFFFFF0);
+    TestInvalidEntry("overflowing entry size", overflow, LFS_ERR_CORRUPT);
+
+    // The data would be parsed as the header of the next entry
+    Data deleteWithData = Entry(1, "/fonts/old.bin", Content(entryHeaderSize, 8));
+    TestInvalidEntry("delete entry with data", deleteWithData, LFS_ERR_CORRUPT);
+
+    Data badCrc = File("/fonts/teko.bin", font);
+    badCrc.back() ^= 1;
+    TestInvalidEntry("bad CRC", badCrc, LFS_ERR_CORRUPT);
+  }
+}
+
+int main() {
+  TestInstall();
+  TestDuplicatedChunks();
+  TestResume();
+  TestInvalidEntries();
+  if (failures > 0) {
+    return 1;
+  }
+  printf("All scenarios passed\n");
+  return 0;
+}
@@ -0,0 +1,186 @@
+// Checks that drivers/SpiMaster applies the mode and the clock of each device before asserting its chip select, when
+// the display and the flash share the bus with different parameters, and that FREQUENCY and CONFIG are only written
+// when they change. The real SpiMaster and Spi run over a model of the SPIM registers (spim-stub/).
+//
+// Usage: spi-master-test
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "drivers/Spi.h"
+#include "drivers/SpiMaster.h"
+
+namespace {
+  using Pinetime::Drivers::Spi;
+  using Pinetime::Drivers::SpiMaster;
+
+  // Pins of the PineTime
+  constexpr uint8_t pinSck = 2;
+  constexpr uint8_t pinMosi = 3;
+  constexpr uint8_t pinMiso = 4;
+  constexpr uint8_t pinLcdCsn = 25;
+  constexpr uint8_t pinFlashCsn = 5;
+
+  // Expected values of the registers: mode 3 at 8MHz for the display (bus parameters), mode 0 at 2MHz for the flash
+  constexpr uint32_t lcdFrequency = 0x80000000;
+  constexpr uint32_t lcdConfig = 0x06;
+  constexpr uint32_t flashFrequency = 0x20000000;
+  constexpr uint32_t flashConfig = 0x00;
+
+  struct Selection {
+    uint32_t pin;
+    uint32_t frequency;
+    uint32_t config;
+  };
+
+  // State of the model
+  std::vector<Selection> selections;
+  int selectedPin = -1;
+  size_t transferredBytes = 0;
+  bool failed = false;
+
+  void Fail(const char* message) {
+    fprintf(stderr, "%s\n", message);
+    failed = true;
+  }
+
+  // Interrupt handler of main.cpp: the transfers of a Write of more than 1 byte are chained by OnEndEvent()
+  void CompleteTransfer(SpiMaster& bus) {
+    while (selectedPin >= 0) {
+      if (NRF_SPIM0->EVENTS_END != 1) {
+        Fail("The transfer doesn't progress");
+        return;
+      }
+      NRF_SPIM0->EVENTS_END = 0;
+      bus.OnEndEvent();
+    }
+  }
+
+  void Check(const char* name, uint32_t pin, uint32_t frequency, uint32_t config, size_t bytes) {
+    if (selections.size() != 1) {
+      fprintf(stderr, "%s: %zu chip selects asserted instead of 1\n", name, selections.size());
+      failed = true;
+    } else if (selections[0].pin != pin || selections[0].frequency != frequency || selections[0].config != config) {
+      fprintf(stderr,
+              "%s: pin %u selected with FREQUENCY 0x%08x and CONFIG 0x%02x, expected pin %u with 0x%08x and 0x%02x\n",
+              name,
+              selections[0].pin,
+              selections[0].frequency,
+              selections[0].config,
+              pin,
+              frequency,
+              config);
+      failed = true;
+    }
+    if (selectedPin >= 0) {
+      fprintf(stderr, "%s: the chip select is still asserted\n", name);
+      failed = true;
+    }
+    if (transferredBytes != bytes) {
+      fprintf(stderr, "%s: %zu bytes transferred instead of %zu\n", name, transferredBytes, bytes);
+      failed = true;
+    }
+    selections.clear();
+    transferredBytes = 0;
+  }
+
+  void CheckWrites(const char* name, uint32_t frequencyWrites, uint32_t configWrites) {
+    if (NRF_SPIM0->FREQUENCY.writes != frequencyWrites || NRF_SPIM0->CONFIG.writes != configWrites) {
+      fprintf(stderr,
+              "%s: FREQUENCY written %u times and CONFIG %u times, expected %u and %u\n",
+              name,
+              NRF_SPIM0->FREQUENCY.writes,
+              NRF_SPIM0->CONFIG.writes,
+              frequencyWrites,
+              configWrites);
+      failed = true;
+    }
+  }
+}
+
+void SpimTaskStarted(NRF_SPIM_Type& spim) {
+  if (selectedPin < 0) {
+    Fail("Transfer started without chip select");
+  }
+  // The registers must not change during a transaction
+  if (!selections.empty() && (spim.FREQUENCY != selections.back().frequency || spim.CONFIG != selections.back().config)) {
+    Fail("FREQUENCY or CONFIG changed while the device is selected");
+  }
+  transferredBytes += spim.TXD.MAXCNT + spim.RXD.MAXCNT;
+  spim.EVENTS_END = 1;
+}
+
+void nrf_gpio_pin_clear(uint32_t pin) {
+  if (pin != pinLcdCsn && pin != pinFlashCsn) {
+    return;
+  }
+  if (selectedPin >= 0) {
+    Fail("Two chip selects asserted at the same time");
+  }
+  selectedPin = static_cast<int>(pin);
+  selections.push_back({pin, NRF_SPIM0->FREQUENCY, NRF_SPIM0->CONFIG});
+}
+
+void nrf_gpio_pin_set(uint32_t pin) {
+  if (static_cast<int>(pin) == selectedPin) {
+    selectedPin = -1;
+  }
+}
+
+int main() {
+  SpiMaster bus {SpiMaster::SpiModule::SPI0,
+                 {SpiMaster::BitOrder::Msb_Lsb, SpiMaster::Modes::Mode3, SpiMaster::Frequencies::Freq8Mhz, pinSck, pinMosi, pinMiso}};
+  Spi lcd {bus, pinLcdCsn};
+  Spi flash {bus, pinFlashCsn, {SpiMaster::Modes::Mode0, SpiMaster::Frequencies::Freq2Mhz}};
+  bus.Init();
+  lcd.Init();
+  flash.Init();
+  CheckWrites("Init", 1, 1);
+
+  uint8_t command = 0x2C;
+  uint8_t pixels[600] = {};
+  uint8_t readCommand[4] = {0x03, 0x00, 0x10, 0x00};
+  uint8_t readData[300];
+  uint8_t programCommand[4] = {0x02, 0x00, 0x20, 0x00};
+  uint8_t page[256] = {};
+
+  // Display flush, then a read of the flash (a font) between two flushes, as the display and the file system tasks do
+  lcd.Write(pixels, sizeof(pixels), nullptr);
+  CompleteTransfer(bus);
+  Check("Display write", pinLcdCsn, lcdFrequency, lcdConfig, sizeof(pixels));
+  CheckWrites("Display write", 1, 1);
+
+  flash.Read(readCommand, sizeof(readCommand), readData, sizeof(readData));
+  Check("Flash read", pinFlashCsn, flashFrequency, flashConfig, sizeof(readCommand) + sizeof(readData));
+  CheckWrites("Flash read", 2, 2);
+
+  flash.WriteCmdAndBuffer(programCommand, sizeof(programCommand), page, sizeof(page));
+  Check("Flash program", pinFlashCsn, flashFrequency, flashConfig, sizeof(programCommand) + sizeof(page));
+  CheckWrites("Flash program", 2, 2);
+
+  // Single byte write: synchronous, with the workaround of the erratum 58
+  lcd.Write(&command, 1, nullptr);
+  Check("Display command", pinLcdCsn, lcdFrequency, lcdConfig, 1);
+  CheckWrites("Display command", 3, 3);
+
+  lcd.Write(pixels, sizeof(pixels), nullptr);
+  CompleteTransfer(bus);
+  Check("Display write (again)", pinLcdCsn, lcdFrequency, lcdConfig, sizeof(pixels));
+  CheckWrites("Display write (again)", 3, 3);
+
+  flash.Read(readCommand, sizeof(readCommand), readData, sizeof(readData));
+  Check("Flash read (again)", pinFlashCsn, flashFrequency, flashConfig, sizeof(readCommand) + sizeof(readData));
+  CheckWrites("Flash read (again)", 4, 4);
+
+  // Sleep and wake up: Init() writes the bus parameters again, the next flash access must restore its own
+  bus.Sleep();
+  bus.Wakeup();
+  CheckWrites("Wakeup", 5, 5);
+  flash.Read(readCommand, sizeof(readCommand), readData, sizeof(readData));
+  Check("Flash read (after wakeup)", pinFlashCsn, flashFrequency, flashConfig, sizeof(readCommand) + sizeof(readData));
+  CheckWrites("Flash read (after wakeup)", 6, 6);
+
+  printf(failed ? "FAILED\n" : "OK\n");
+  return failed ? 1 : 0;
+}
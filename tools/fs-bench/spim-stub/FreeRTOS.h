@@ -0,0 +1,11 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+
+using TickType_t = uint32_t;
+using BaseType_t = long;
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFU
+#define portYIELD_FROM_ISR(woken) (void) (woken)
+
+#define ASSERT(expr) assert(expr)
@@ -0,0 +1,17 @@
+#pragma once
+#include "nrf.h"
+
+enum nrf_gpio_pin_pull_t { NRF_GPIO_PIN_NOPULL };
+
+// Chip selects: implemented by the test, which checks the SPIM registers when a device is selected
+void nrf_gpio_pin_set(uint32_t pin);
+void nrf_gpio_pin_clear(uint32_t pin);
+
+inline void nrf_gpio_cfg_output(uint32_t /*pin*/) {
+}
+
+inline void nrf_gpio_cfg_input(uint32_t /*pin*/, nrf_gpio_pin_pull_t /*pull*/) {
+}
+
+inline void nrf_gpio_cfg_default(uint32_t /*pin*/) {
+}
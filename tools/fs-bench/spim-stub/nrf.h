@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+
+// Registers of the SPIM used by SpiMaster. The test (spi_master_test.cpp) models the peripheral:
+// - SpimTaskStarted() is called when TASKS_START is written, and ends the transfer (EVENTS_END)
+// - the writes of FREQUENCY and CONFIG are counted
+struct Register {
+  volatile uint32_t value = 0;
+  uint32_t writes = 0;
+
+  Register& operator=(uint32_t newValue) {
+    value = newValue;
+    writes++;
+    return *this;
+  }
+
+  operator uint32_t() const {
+    return value;
+  }
+};
+
+struct TaskRegister {
+  TaskRegister& operator=(uint32_t trigger);
+
+  operator uint32_t() const {
+    return 0;
+  }
+};
+
+struct NRF_SPIM_Type {
+  TaskRegister TASKS_START;
+  Register TASKS_STOP;
+  Register EVENTS_ENDRX;
+  Register EVENTS_END;
+  Register EVENTS_ENDTX;
+  Register INTENSET;
+  Register INTENCLR;
+  Register ENABLE;
+
+  struct {
+    Register SCK;
+    Register MOSI;
+    Register MISO;
+  } PSEL;
+
+  Register FREQUENCY;
+
+  struct {
+    Register PTR;
+    Register MAXCNT;
+    Register AMOUNT;
+    Register LIST;
+  } RXD, TXD;
+
+  Register CONFIG;
+};
+
+// Names of the nRF51 registers, kept by the nRF5 SDK (nrf51_to_nrf52.h)
+#define PSELSCK PSEL.SCK
+#define PSELMOSI PSEL.MOSI
+#define PSELMISO PSEL.MISO
+
+#define SPIM_ENABLE_ENABLE_Pos 0
+#define SPIM_ENABLE_ENABLE_Disabled 0
+#define SPIM_ENABLE_ENABLE_Enabled 7
+
+inline NRF_SPIM_Type spim0;
+inline NRF_SPIM_Type spim1;
+#define NRF_SPIM0 (&spim0)
+#define NRF_SPIM1 (&spim1)
+
+void SpimTaskStarted(NRF_SPIM_Type& spim);
+
+inline TaskRegister& TaskRegister::operator=(uint32_t trigger) {
+  if (trigger != 0) {
+    // TASKS_START is the first member of NRF_SPIM_Type
+    SpimTaskStarted(*reinterpret_cast<NRF_SPIM_Type*>(this));
+  }
+  return *this;
+}
+
+#define NRFX_IRQ_PRIORITY_SET(irq, priority)
+#define NRFX_IRQ_ENABLE(irq)
@@ -0,0 +1,14 @@
+#pragma once
+#include "nrf.h"
+
+using nrf_ppi_channel_t = uint8_t;
+#define NRF_PPI_CHANNEL0 0
+
+inline void nrf_ppi_channel_endpoint_setup(nrf_ppi_channel_t /*channel*/, uint32_t /*event*/, uint32_t /*task*/) {
+}
+
+inline void nrf_ppi_channel_enable(nrf_ppi_channel_t /*channel*/) {
+}
+
+inline void nrf_ppi_channel_disable(nrf_ppi_channel_t /*channel*/) {
+}
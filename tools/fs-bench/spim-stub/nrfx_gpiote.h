@@ -0,0 +1,31 @@
+#pragma once
+#include "hal/nrf_gpio.h"
+
+// The workaround of the erratum 58 (single byte writes) is not modeled
+using nrfx_gpiote_pin_t = uint32_t;
+
+enum nrf_gpiote_polarity_t { NRF_GPIOTE_POLARITY_TOGGLE };
+
+struct nrfx_gpiote_in_config_t {
+  nrf_gpiote_polarity_t sense;
+  nrf_gpio_pin_pull_t pull;
+  bool is_watcher;
+  bool hi_accuracy;
+  bool skip_gpio_setup;
+};
+
+#define APP_ERROR_CHECK(result) (void) (result)
+
+inline int nrfx_gpiote_in_init(nrfx_gpiote_pin_t /*pin*/, const nrfx_gpiote_in_config_t* /*config*/, void* /*handler*/) {
+  return 0;
+}
+
+inline void nrfx_gpiote_in_uninit(nrfx_gpiote_pin_t /*pin*/) {
+}
+
+inline void nrfx_gpiote_in_event_enable(nrfx_gpiote_pin_t /*pin*/, bool /*interrupt*/) {
+}
+
+inline uint32_t nrfx_gpiote_in_event_addr_get(nrfx_gpiote_pin_t /*pin*/) {
+  return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The firmware logs are not needed on the host
+#define NRF_LOG_INFO(...)
@@ -0,0 +1,28 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// The test is single-threaded: taking a semaphore that is not available would block forever, it is an error
+struct Semaphore {
+  bool available = false;
+};
+
+using SemaphoreHandle_t = Semaphore*;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new Semaphore;
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t /*ticks*/) {
+  assert(semaphore->available);
+  semaphore->available = false;
+  return 1;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  semaphore->available = true;
+  return 1;
+}
+
+inline int xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* /*woken*/) {
+  return xSemaphoreGive(semaphore);
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+using TickType_t = uint32_t;
+#define configTICK_RATE_HZ 1024
+
+// Advance the simulated time of the model of the flash (FlashModel.cpp)
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
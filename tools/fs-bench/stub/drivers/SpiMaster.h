@@ -0,0 +1,12 @@
+#pragma once
+#include <FreeRTOS.h>
+
+// The SPI bus is replaced by the model of the flash (FlashModel.cpp), which implements Spi
+namespace Pinetime {
+  namespace Drivers {
+    class SpiMaster {
+    public:
+      struct DeviceParameters {};
+    };
+  }
+}
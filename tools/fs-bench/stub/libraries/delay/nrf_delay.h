@@ -0,0 +1,5 @@
+#pragma once
+#include <cstdint>
+
+// Advances the simulated time of the model of the flash (FlashModel.cpp)
+void nrf_delay_us(uint32_t microseconds);
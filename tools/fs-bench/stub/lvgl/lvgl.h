@@ -0,0 +1,3 @@
+#pragma once
+
+// FS does not use LVGL, only its header is included
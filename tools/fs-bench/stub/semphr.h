@@ -0,0 +1,18 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// The benchmark is single-threaded: SpiNorFlash runs without its mutex
+using SemaphoreHandle_t = void*;
+#define portMAX_DELAY 0xFFFFFFFFU
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+  return nullptr;
+}
+
+inline int xSemaphoreTakeRecursive(SemaphoreHandle_t /*mutex*/, TickType_t /*ticks*/) {
+  return 1;
+}
+
+inline int xSemaphoreGiveRecursive(SemaphoreHandle_t /*mutex*/) {
+  return 1;
+}
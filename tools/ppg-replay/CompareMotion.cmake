@@ -0,0 +1,34 @@
+# Replays a recording with and without the motion, and fails if the estimations are less accurate with the motion
+# (smaller part of the estimations within 5 BPM of the reference), or if fewer than MIN_CORRECT percent of the analyses
+# give an estimation within 5 BPM with the motion. Used by the tests:
+#   cmake -DREPLAY=<ppg-replay> -DRECORDING=<recording.ppg> -DREFERENCE=<reference.csv> [-DMIN_CORRECT=<percent>]
+#         -P CompareMotion.cmake
+function(replay result)
+  execute_process(COMMAND ${REPLAY} ${ARGN} ${RECORDING} ${REFERENCE} OUTPUT_QUIET ERROR_VARIABLE summary RESULT_VARIABLE exitCode)
+  if(NOT exitCode EQUAL 0)
+    message(FATAL_ERROR "Replay of ${RECORDING} failed")
+  endif()
+  message("Replay of ${RECORDING} ${ARGN}\n${summary}")
+  string(REGEX MATCH "Estimations: ([0-9]+)" match "${summary}")
+  set(${result}_ESTIMATIONS ${CMAKE_MATCH_1} PARENT_SCOPE)
+  # No line when no estimation could be compared to the reference
+  set(${result}_CORRECT 0 PARENT_SCOPE)
+  set(${result}_RATIO -1 PARENT_SCOPE)
+  if(summary MATCHES "([0-9]+) \\(([0-9.]+)%\\) within")
+    set(${result}_CORRECT ${CMAKE_MATCH_1} PARENT_SCOPE)
+    set(${result}_RATIO ${CMAKE_MATCH_2} PARENT_SCOPE)
+  endif()
+endfunction()
+
+replay(MOTION)
+replay(NO_MOTION --no-motion)
+
+if(MOTION_RATIO GREATER_EQUAL 0 AND MOTION_RATIO LESS NO_MOTION_RATIO)
+  message(FATAL_ERROR "${RECORDING}: ${MOTION_RATIO}% of the estimations within 5 BPM with the motion, ${NO_MOTION_RATIO}% without")
+endif()
+if(DEFINED MIN_CORRECT)
+  math(EXPR minCorrect "${MOTION_ESTIMATIONS} * ${MIN_CORRECT} / 100")
+  if(MOTION_CORRECT LESS minCorrect)
+    message(FATAL_ERROR "${RECORDING}: ${MOTION_CORRECT} of ${MOTION_ESTIMATIONS} analyses within 5 BPM, at least ${minCorrect} expected")
+  endif()
+endif()
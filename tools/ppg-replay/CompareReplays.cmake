@@ -0,0 +1,38 @@
+# Runs two builds of ppg-replay on the same recording and fails if the first one is less accurate than the second one
+# compared to the reference (more than 1 BPM of additional mean absolute error, or more than 5% fewer estimations within
+# 5 BPM, as ppg-compare --check). Without a reference, only checks that both replays succeed. Used by the tests:
+#   cmake -DFIRST=<ppg-replay> -DSECOND=<other ppg-replay> -DRECORDING=<recording.ppg> [-DREFERENCE=<reference.csv>]
+#         [-DARGS=<options>] -P CompareReplays.cmake
+separate_arguments(ARGS)
+function(replay result command)
+  execute_process(COMMAND ${command} ${ARGS} ${RECORDING} ${REFERENCE} OUTPUT_QUIET ERROR_VARIABLE summary RESULT_VARIABLE exitCode)
+  if(NOT exitCode EQUAL 0)
+    message(FATAL_ERROR "Replay of ${RECORDING} with ${command} failed")
+  endif()
+  message("Replay of ${RECORDING} with ${command} ${ARGS}\n${summary}")
+  string(REGEX MATCH "Estimations: ([0-9]+)" match "${summary}")
+  set(${result}_ESTIMATIONS ${CMAKE_MATCH_1} PARENT_SCOPE)
+  # No line when no estimation could be compared to the reference
+  set(${result}_MAE 0 PARENT_SCOPE)
+  set(${result}_CORRECT 0 PARENT_SCOPE)
+  if(summary MATCHES "MAE ([0-9.]+) BPM, RMSE [0-9.]+ BPM, ([0-9]+) \\(")
+    set(${result}_MAE ${CMAKE_MATCH_1} PARENT_SCOPE)
+    set(${result}_CORRECT ${CMAKE_MATCH_2} PARENT_SCOPE)
+  endif()
+endfunction()
+
+replay(FIRST ${FIRST})
+replay(SECOND ${SECOND})
+
+if(NOT REFERENCE)
+  return()
+endif()
+# CMake has no floating point arithmetic: the errors are compared in hundredths of BPM
+string(REPLACE "." "" firstMae "${FIRST_MAE}")
+string(REPLACE "." "" secondMae "${SECOND_MAE}")
+math(EXPR maxMae "${secondMae} + 100")
+math(EXPR minCorrect "${SECOND_CORRECT} - ${SECOND_ESTIMATIONS} * 5 / 100")
+if(firstMae GREATER maxMae OR FIRST_CORRECT LESS minCorrect)
+  message(FATAL_ERROR "${RECORDING}: MAE ${FIRST_MAE} BPM and ${FIRST_CORRECT} estimations within 5 BPM, "
+                      "${SECOND_MAE} BPM and ${SECOND_CORRECT} with ${SECOND}")
+endif()
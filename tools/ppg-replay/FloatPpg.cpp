@@ -0,0 +1,273 @@
+#include "FloatPpg.h"
+#include <algorithm>
+#include <cmath>
+
+#include "legacy/LegacyPeakSearch.h"
+
+using Legacy::PeakSearch;
+
+namespace {
+  // In place radix-2 FFT, then magnitude of the bins in real (replaces ArduinoFFT<float>: compute() and
+  // complexToMagnitude())
+  void FftMagnitude(float* real, float* imag, int length) {
+    for (int i = 1, j = 0; i < length; i++) {
+      int bit = length >> 1;
+      for (; j & bit; bit >>= 1) {
+        j ^= bit;
+      }
+      j ^= bit;
+      if (i < j) {
+        std::swap(real[i], real[j]);
+        std::swap(imag[i], imag[j]);
+      }
+    }
+    for (int size = 2; size <= length; size <<= 1) {
+      const float angle = -2.0f * 3.14159265358979323846f / static_cast<float>(size);
+      for (int start = 0; start < length; start += size) {
+        for (int k = 0; k < size / 2; k++) {
+          const float wr = std::cos(angle * k);
+          const float wi = std::sin(angle * k);
+          const int even = start + k;
+          const int odd = even + size / 2;
+          const float tr = real[odd] * wr - imag[odd] * wi;
+          const float ti = real[odd] * wi + imag[odd] * wr;
+          real[odd] = real[even] - tr;
+          imag[odd] = imag[even] - ti;
+          real[even] += tr;
+          imag[even] += ti;
+        }
+      }
+    }
+    for (int idx = 0; idx < length; idx++) {
+      real[idx] = std::sqrt(real[idx] * real[idx] + imag[idx] * imag[idx]);
+    }
+  }
+
+  float SpectrumMean(const std::array<float, FloatPpg::spectrumLength>& signal, int start, int end) {
+    int total = 0;
+    float mean = 0.0f;
+    for (int idx = start; idx < end; idx++) {
+      mean += signal.at(idx);
+      total++;
+    }
+    if (total > 0) {
+      mean /= static_cast<float>(total);
+    }
+    return mean;
+  }
+
+  float SignalToNoise(const std::array<float, FloatPpg::spectrumLength>& signal, int start, int end, float max) {
+    float mean = SpectrumMean(signal, start, end);
+    return max / mean;
+  }
+
+  // Simple bandpass filter using exponential moving average
+  void Filter30to240(std::array<float, FloatPpg::dataLength>& signal) {
+    // From:
+    // https://www.norwegiancreations.com/2016/03/arduino-tutorial-simple-high-pass-band-pass-and-band-stop-filtering/
+
+    int length = signal.size();
+    // 0.268 is ~0.5Hz and 0.816 is ~4Hz cutoff at 10Hz sampling
+    float expAlpha = 0.816f;
+    float expAvg = 0.0f;
+    for (int loop = 0; loop < 4; loop++) {
+      expAvg = signal.front();
+      for (int idx = 0; idx < length; idx++) {
+        expAvg = (expAlpha * signal.at(idx)) + ((1 - expAlpha) * expAvg);
+        signal[idx] = expAvg;
+      }
+    }
+    expAlpha = 0.268f;
+    for (int loop = 0; loop < 4; loop++) {
+      expAvg = signal.front();
+      for (int idx = 0; idx < length; idx++) {
+        expAvg = (expAlpha * signal.at(idx)) + ((1 - expAlpha) * expAvg);
+        signal[idx] -= expAvg;
+      }
+    }
+  }
+
+  float SpectrumMax(const std::array<float, FloatPpg::spectrumLength>& data, int start, int end) {
+    float max = 0.0f;
+    for (int idx = start; idx < end; idx++) {
+      if (data.at(idx) > max) {
+        max = data.at(idx);
+      }
+    }
+    return max;
+  }
+
+  void Detrend(std::array<float, FloatPpg::dataLength>& signal) {
+    int size = signal.size();
+    float offset = signal.front();
+    float slope = (signal.at(size - 1) - offset) / static_cast<float>(size - 1);
+
+    for (int idx = 0; idx < size; idx++) {
+      signal[idx] -= (slope * static_cast<float>(idx) + offset);
+    }
+    for (int idx = 0; idx < size - 1; idx++) {
+      signal[idx] = signal[idx + 1] - signal[idx];
+    }
+  }
+
+  // Hanning Coefficients from numpy: python -c 'import numpy;print(numpy.hanning(64))'
+  // Note: Harcoded and must be updated if constexpr dataLength is changed. Prevents the need to
+  // use cosf() which results in an extra ~5KB in storage.
+  // This data is symetrical so just using the first half (saves 128B when dataLength is 64).
+  static constexpr float hanning[FloatPpg::dataLength >> 1] {
+    0.0f,        0.00248461f, 0.00991376f, 0.0222136f,  0.03926189f, 0.06088921f, 0.08688061f, 0.11697778f,
+    0.15088159f, 0.1882551f,  0.22872687f, 0.27189467f, 0.31732949f, 0.36457977f, 0.41317591f, 0.46263495f,
+    0.51246535f, 0.56217185f, 0.61126047f, 0.65924333f, 0.70564355f, 0.75f,       0.79187184f, 0.83084292f,
+    0.86652594f, 0.89856625f, 0.92664544f, 0.95048443f, 0.96984631f, 0.98453864f, 0.99441541f, 0.99937846f};
+}
+
+FloatPpg::FloatPpg() {
+  dataAverage.fill(0.0f);
+  spectrum.fill(0.0f);
+}
+
+int8_t FloatPpg::Preprocess(uint16_t hrs, uint16_t als) {
+  if (dataIndex < dataLength) {
+    dataHRS[dataIndex++] = hrs;
+  }
+  alsValue = als;
+  if (alsValue > alsThreshold) {
+    return 1;
+  }
+  return 0;
+}
+
+int FloatPpg::HeartRate() {
+  if (dataIndex < dataLength) {
+    return 0;
+  }
+  int hr = 0;
+  hr = ProcessHeartRate(resetSpectralAvg);
+  resetSpectralAvg = false;
+  // Make room for overlapWindow number of new samples
+  for (int idx = 0; idx < dataLength - overlapWindow; idx++) {
+    dataHRS[idx] = dataHRS[idx + overlapWindow];
+  }
+  dataIndex = dataLength - overlapWindow;
+  return hr;
+}
+
+void FloatPpg::Reset(bool resetDaqBuffer) {
+  if (resetDaqBuffer) {
+    dataIndex = 0;
+  }
+  avgIndex = 0;
+  dataAverage.fill(0.0f);
+  lastPeakLocation = 0.0f;
+  alsThreshold = UINT16_MAX;
+  alsValue = 0;
+  resetSpectralAvg = true;
+  spectrum.fill(0.0f);
+}
+
+// Pass init == true to reset spectral averaging.
+// Returns -1 (Reset Acquisition), 0 (Unable to obtain HR) or HR (BPM).
+int FloatPpg::ProcessHeartRate(bool init) {
+  std::copy(dataHRS.begin(), dataHRS.end(), vReal.begin());
+  Detrend(vReal);
+  Filter30to240(vReal);
+  vImag.fill(0.0f);
+  // Apply Hanning Window
+  int hannIdx = 0;
+  for (int idx = 0; idx < dataLength; idx++) {
+    if (idx >= dataLength >> 1) {
+      hannIdx--;
+    }
+    vReal[idx] *= hanning[hannIdx];
+    if (idx < dataLength >> 1) {
+      hannIdx++;
+    }
+  }
+  // Compute in place power spectrum
+  FftMagnitude(vReal.data(), vImag.data(), dataLength);
+  SpectrumAverage(vReal.data(), spectrum.data(), spectrum.size(), init);
+  peakLocation = 0.0f;
+  float threshold = peakDetectionThreshold;
+  float peakWidth = 0.0f;
+  int specLen = spectrum.size();
+  float max = SpectrumMax(spectrum, hrROIbegin, hrROIend);
+  float signalToNoiseRatio = SignalToNoise(spectrum, hrROIbegin, hrROIend, max);
+  if (signalToNoiseRatio > signalToNoiseThreshold && spectrum.at(0) < dcThreshold) {
+    threshold *= max;
+    // Reuse VImag for interpolation x values passed to PeakSearch
+    for (int idx = 0; idx < dataLength; idx++) {
+      vImag[idx] = idx;
+    }
+    peakLocation = PeakSearch(vImag.data(),
+                              spectrum.data(),
+                              threshold,
+                              peakWidth,
+                              static_cast<float>(hrROIbegin),
+                              static_cast<float>(hrROIend),
+                              specLen);
+    peakLocation *= freqResolution;
+  }
+  // Peak too wide? (broad spectrum noise or large, rapid HR change)
+  if (peakWidth > maxPeakWidth) {
+    peakLocation = 0.0f;
+  }
+  // Check HR limits
+  if (peakLocation < minHR || peakLocation > maxHR) {
+    peakLocation = 0.0f;
+  }
+  // Reset spectral averaging if bad reading
+  if (peakLocation == 0.0f) {
+    resetSpectralAvg = true;
+  }
+  // Set the ambient light threshold and return HR in BPM
+  alsThreshold = static_cast<uint16_t>(alsValue * alsFactor);
+  // Get current average HR. If HR reduced to zero, return -1 (reset) else HR
+  peakLocation = HeartRateAverage(peakLocation);
+  int rtn = -1;
+  if (peakLocation == 0.0f && lastPeakLocation > 0.0f) {
+    lastPeakLocation = 0.0f;
+  } else {
+    lastPeakLocation = peakLocation;
+    rtn = static_cast<int>((peakLocation * 60.0f) + 0.5f);
+  }
+  return rtn;
+}
+
+void FloatPpg::SpectrumAverage(const float* data, float* spectrum, int length, bool reset) {
+  if (reset) {
+    spectralAvgCount = 0;
+  }
+  float count = static_cast<float>(spectralAvgCount);
+  for (int idx = 0; idx < length; idx++) {
+    spectrum[idx] = (spectrum[idx] * count + data[idx]) / (count + 1);
+  }
+  if (spectralAvgCount < spectralAvgMax) {
+    spectralAvgCount++;
+  }
+}
+
+float FloatPpg::HeartRateAverage(float hr) {
+  avgIndex++;
+  avgIndex %= dataAverage.size();
+  dataAverage[avgIndex] = hr;
+  float avg = 0.0f;
+  float total = 0.0f;
+  float min = 300.0f;
+  float max = 0.0f;
+  for (const float& value : dataAverage) {
+    if (value > 0.0f) {
+      avg += value;
+      if (value < min)
+        min = value;
+      if (value > max)
+        max = value;
+      total++;
+    }
+  }
+  if (total > 0) {
+    avg /= total;
+  } else {
+    avg = 0.0f;
+  }
+  return avg;
+}
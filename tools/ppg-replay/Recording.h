@@ -0,0 +1,108 @@
+#pragma once
+
+// Recordings of the heart rate sensor (see doc/PpgRecording.md) and reference heart rates, shared by the tools
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Recording {
+  struct __attribute__((packed)) Header {
+    uint8_t version;
+    uint8_t recordSize;
+    uint16_t sampleRate;
+    uint32_t reserved;
+  };
+
+  struct __attribute__((packed)) Record {
+    uint16_t time;
+    uint16_t hrs;
+    uint16_t als;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+  };
+
+  constexpr uint8_t formatVersion = 1;
+  constexpr uint32_t tickRate = 1024;
+
+  struct Sample {
+    double time;
+    Record record;
+  };
+
+  struct ReferencePoint {
+    double time;
+    double bpm;
+  };
+
+  inline bool Read(const char* path, Header& header, std::vector<Sample>& samples) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", path);
+      return false;
+    }
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+      fprintf(stderr, "%s: missing header\n", path);
+      return false;
+    }
+    if (header.version != formatVersion || header.recordSize != sizeof(Record)) {
+      fprintf(stderr, "%s: unsupported format (version %u, record size %u)\n", path, header.version, header.recordSize);
+      return false;
+    }
+
+    // The time is stored modulo 2^16 ticks (64s), the samples are much closer than that
+    Record record;
+    uint64_t time = 0;
+    bool first = true;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      if (first) {
+        first = false;
+      } else {
+        time += static_cast<uint16_t>(record.time - samples.back().record.time);
+      }
+      samples.push_back({static_cast<double>(time) / tickRate, record});
+    }
+    return true;
+  }
+
+  inline bool ReadReference(const char* path, std::vector<ReferencePoint>& reference) {
+    std::ifstream file(path);
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", path);
+      return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      ReferencePoint point;
+      if (sscanf(line.c_str(), "%lf,%lf", &point.time, &point.bpm) == 2) {
+        reference.push_back(point);
+      }
+    }
+    return true;
+  }
+
+  // Returns 0 outside of the reference
+  inline double ReferenceAt(const std::vector<ReferencePoint>& reference, double time) {
+    for (size_t i = 1; i < reference.size(); i++) {
+      if (time >= reference[i - 1].time && time <= reference[i].time) {
+        const double span = reference[i].time - reference[i - 1].time;
+        const double ratio = span > 0 ? (time - reference[i - 1].time) / span : 0;
+        return reference[i - 1].bpm + ratio * (reference[i].bpm - reference[i - 1].bpm);
+      }
+    }
+    return 0;
+  }
+
+  // percentile: 0 to 100, returns 0 if there is no value
+  inline double Percentile(std::vector<double> values, double percentile) {
+    if (values.empty()) {
+      return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(percentile / 100.0 * (values.size() - 1) + 0.5)];
+  }
+}
@@ -0,0 +1,244 @@
+// Replays a 10Hz recording of the heart rate sensor through the fixed-point heart rate estimation of the firmware
+// (components/heartrate/Ppg) and through the original floating point one (FloatPpg), and compares them: heart rates,
+// accuracy against the reference, time per estimation and level of the DC bin (compared to dcThreshold).
+// The motion is not used, the original estimation doesn't support it.
+//
+// Usage: ppg-compare [--check] <recording.ppg> [reference.csv]
+//
+// The estimations of both are written as CSV to the standard output, the comparison to the standard error.
+// With --check, the exit code is 1 if the fixed-point estimation is less accurate than the floating point one (more
+// than 1 BPM of additional mean absolute error, or more than 5% fewer estimations within 5 BPM of the reference).
+// The exit code is 77 (skipped test) if the recording isn't sampled at 10Hz.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "FloatPpg.h"
+#include "Recording.h"
+#include "components/heartrate/Ppg.h"
+
+namespace {
+  using Recording::Percentile;
+  using Recording::ReferencePoint;
+  using Recording::Sample;
+  using FixedPpg = Pinetime::Controllers::Ppg<10, 64>;
+
+  // Exit code of the recordings that cannot be compared, see SKIP_RETURN_CODE in CMakeLists.txt
+  constexpr int skippedExitCode = 77;
+
+  // Estimations within this error (BPM) are counted as correct
+  constexpr double correctThreshold = 5.0;
+
+  struct Estimation {
+    bool analyzed;
+    int bpm;
+    float dcLevel;
+    double microseconds;
+  };
+
+  // Feeds the samples to a Ppg and handles its results like HeartRateTask
+  template <class Ppg>
+  class Runner {
+  public:
+    Estimation Process(const Recording::Record& record) {
+      const int8_t ambient = ppg.Preprocess(record.hrs, record.als);
+      if (windowSamples < Ppg::dataLength) {
+        windowSamples++;
+      }
+      Estimation estimation {windowSamples == Ppg::dataLength, 0, 0.0f, 0.0};
+      const auto start = std::chrono::steady_clock::now();
+      int bpm = ppg.HeartRate();
+      const auto end = std::chrono::steady_clock::now();
+      if (estimation.analyzed) {
+        windowSamples = Ppg::dataLength - Ppg::overlapWindow;
+        estimation.dcLevel = ppg.DcLevel();
+        estimation.microseconds = std::chrono::duration<double, std::micro>(end - start).count();
+      }
+      if (ambient > 0) {
+        ppg.Reset(true);
+        windowSamples = 0;
+        bpm = 0;
+      } else if (bpm < 0) {
+        ppg.Reset(false);
+        bpm = 0;
+      }
+      estimation.bpm = bpm;
+      return estimation;
+    }
+
+  private:
+    Ppg ppg;
+    uint16_t windowSamples = 0;
+  };
+
+  struct Statistics {
+    size_t nbValid = 0;
+    size_t nbCompared = 0;
+    size_t nbCorrect = 0;
+    size_t nbDcRejected = 0;
+    double sumError = 0;
+    double totalMicroseconds = 0;
+
+    void Add(const Estimation& estimation, double expected, float dcThreshold) {
+      totalMicroseconds += estimation.microseconds;
+      if (estimation.dcLevel >= dcThreshold) {
+        nbDcRejected++;
+      }
+      if (estimation.bpm <= 0) {
+        return;
+      }
+      nbValid++;
+      if (expected > 0) {
+        const double error = std::abs(estimation.bpm - expected);
+        nbCompared++;
+        sumError += error;
+        if (error <= correctThreshold) {
+          nbCorrect++;
+        }
+      }
+    }
+
+    double MeanError() const {
+      return nbCompared > 0 ? sumError / nbCompared : 0;
+    }
+
+    double CorrectRatio() const {
+      return nbCompared > 0 ? 100.0 * nbCorrect / nbCompared : 0;
+    }
+
+    void Print(const char* name, size_t nbEstimations) const {
+      fprintf(stderr,
+              "%s: %zu/%zu with a heart rate, %.1fus per estimation (host), DC level above threshold in %.1f%%",
+              name,
+              nbValid,
+              nbEstimations,
+              totalMicroseconds / nbEstimations,
+              100.0 * nbDcRejected / nbEstimations);
+      if (nbCompared > 0) {
+        fprintf(stderr, ", MAE %.2f BPM, %.1f%% within %.0f BPM", MeanError(), CorrectRatio(), correctThreshold);
+      }
+      fprintf(stderr, "\n");
+    }
+  };
+
+  bool Compare(const std::vector<Sample>& samples, const std::vector<ReferencePoint>& reference, bool check) {
+    Runner<FloatPpg> floatRunner;
+    Runner<FixedPpg> fixedRunner;
+    Statistics floatStatistics;
+    Statistics fixedStatistics;
+    size_t nbEstimations = 0;
+    size_t nbBoth = 0;
+    size_t nbSame = 0;
+    int maxDifference = 0;
+    std::vector<double> dcRatios;
+    // Levels of the analyses rejected by the DC check of FloatPpg, and of the other ones
+    std::vector<double> rejectedLevels;
+    std::vector<double> acceptedLevels;
+
+    printf("time,floatBpm,fixedBpm,floatDc,fixedDc,reference\n");
+    for (const auto& sample : samples) {
+      const auto floatEstimation = floatRunner.Process(sample.record);
+      const auto fixedEstimation = fixedRunner.Process(sample.record);
+      // Both analyze the same windows, as long as the ambient light doesn't reset only one of them
+      if (!floatEstimation.analyzed || !fixedEstimation.analyzed) {
+        continue;
+      }
+
+      nbEstimations++;
+      const double expected = Recording::ReferenceAt(reference, sample.time);
+      printf("%.2f,%d,%d,%.4f,%.4f,%.1f\n",
+             sample.time,
+             floatEstimation.bpm,
+             fixedEstimation.bpm,
+             floatEstimation.dcLevel,
+             fixedEstimation.dcLevel,
+             expected);
+      floatStatistics.Add(floatEstimation, expected, FloatPpg::dcThreshold);
+      fixedStatistics.Add(fixedEstimation, expected, FixedPpg::dcThreshold);
+
+      if (floatEstimation.bpm > 0 && fixedEstimation.bpm > 0) {
+        nbBoth++;
+        const int difference = std::abs(floatEstimation.bpm - fixedEstimation.bpm);
+        maxDifference = std::max(maxDifference, difference);
+        if (difference <= 1) {
+          nbSame++;
+        }
+      }
+      if (floatEstimation.dcLevel > 0) {
+        dcRatios.push_back(fixedEstimation.dcLevel / floatEstimation.dcLevel);
+      }
+      (floatEstimation.dcLevel >= FloatPpg::dcThreshold ? rejectedLevels : acceptedLevels).push_back(fixedEstimation.dcLevel);
+    }
+
+    if (nbEstimations == 0) {
+      fprintf(stderr, "No estimation\n");
+      return !check;
+    }
+    floatStatistics.Print("Float", nbEstimations);
+    fixedStatistics.Print("Fixed", nbEstimations);
+    fprintf(stderr, "Both with a heart rate: %zu, within 1 BPM of each other: %zu, max difference %d BPM\n", nbBoth, nbSame, maxDifference);
+    fprintf(stderr,
+            "DC level, fixed / float: median %.2f (10%%: %.2f, 90%%: %.2f)\n",
+            Percentile(dcRatios, 50),
+            Percentile(dcRatios, 10),
+            Percentile(dcRatios, 90));
+    fprintf(stderr,
+            "DC level (fixed) of the analyses rejected by the float DC check: %zu, min %.2f, median %.2f; accepted: %zu, "
+            "median %.2f, 99%%: %.2f, max %.2f\n",
+            rejectedLevels.size(),
+            Percentile(rejectedLevels, 0),
+            Percentile(rejectedLevels, 50),
+            acceptedLevels.size(),
+            Percentile(acceptedLevels, 50),
+            Percentile(acceptedLevels, 99),
+            Percentile(acceptedLevels, 100));
+
+    if (!check || floatStatistics.nbCompared == 0) {
+      return true;
+    }
+    const bool accurate = fixedStatistics.MeanError() <= floatStatistics.MeanError() + 1.0 &&
+                          fixedStatistics.nbCorrect + 0.05 * nbEstimations >= floatStatistics.nbCorrect;
+    if (!accurate) {
+      fprintf(stderr, "The fixed-point estimation is less accurate than the floating point one\n");
+    }
+    return accurate;
+  }
+}
+
+int main(int argc, char** argv) {
+  bool check = false;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || paths.size() > 2) {
+    fprintf(stderr, "Usage: %s [--check] <recording.ppg> [reference.csv]\n", argv[0]);
+    return 1;
+  }
+
+  Recording::Header header;
+  std::vector<Sample> samples;
+  if (!Recording::Read(paths[0], header, samples)) {
+    return 1;
+  }
+  std::vector<ReferencePoint> reference;
+  if (paths.size() > 1 && !Recording::ReadReference(paths[1], reference)) {
+    return 1;
+  }
+  if (header.sampleRate != FloatPpg::sampleRate) {
+    fprintf(stderr,
+            "Only %uHz recordings can be compared, the floating point estimation doesn't support %uHz\n",
+            FloatPpg::sampleRate,
+            header.sampleRate);
+    return skippedExitCode;
+  }
+  return Compare(samples, reference, check) ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Replaces components/heartrate/PeakSearch.h in ppg-replay-legacy-peak: Ppg then uses the original peak search, with
+// the same arguments as it used to (x values of the bins, spectrum and ROI as floats).
+
+#include <array>
+#include <cstddef>
+
+#include "LegacyPeakSearch.h"
+
+namespace Pinetime {
+  namespace Controllers {
+    template <size_t N>
+    float PeakSearch(const std::array<float, N>& spectrum, float threshold, float& width, int start, int end) {
+      std::array<float, N> bins;
+      for (size_t idx = 0; idx < N; idx++) {
+        bins[idx] = idx;
+      }
+      std::array<float, N> values = spectrum;
+      return Legacy::PeakSearch(bins.data(), values.data(), threshold, width, static_cast<float>(start), static_cast<float>(end), N);
+    }
+  }
+}
@@ -0,0 +1,165 @@
+// Replays a recording of the heart rate sensor (see doc/PpgRecording.md) through the heart rate estimation of the
+// firmware (components/heartrate/Ppg), and prints the estimated heart rate for each analysis.
+//
+// Usage: ppg-replay [--no-motion] <recording.ppg> [reference.csv]
+//
+// The reference file holds one "<time>,<bpm>" line per reference measurement (for example from a chest strap), the
+// time being in seconds since the start of the recording. The reference is linearly interpolated at the time of each
+// estimation, and the error of the estimation is reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Recording.h"
+#include "components/heartrate/Ppg.h"
+
+namespace {
+  using Recording::Percentile;
+  using Recording::Record;
+  using Recording::ReferencePoint;
+  using Recording::Sample;
+
+  // Estimations within this error (BPM) are counted as correct
+  constexpr double correctThreshold = 5.0;
+
+  template <class Ppg>
+  void Replay(const std::vector<Sample>& samples, const std::vector<ReferencePoint>& reference, bool useMotion) {
+    Ppg ppg;
+    size_t nbEstimations = 0;
+    size_t nbValid = 0;
+    size_t nbCompared = 0;
+    size_t nbCorrect = 0;
+    double sumError = 0;
+    double sumSquaredError = 0;
+    double totalMicroseconds = 0;
+    double maxMicroseconds = 0;
+    // DC level of each analysis, compared to Ppg::dcThreshold
+    std::vector<double> dcLevels;
+    // Number of samples in the analysis window of ppg, to know when HeartRate() analyzes them
+    uint16_t windowSamples = 0;
+
+    printf("time,bpm,confident,reference\n");
+    for (const auto& sample : samples) {
+      const Record& record = sample.record;
+      const int32_t x = record.x;
+      const int32_t y = record.y;
+      const int32_t z = record.z;
+      const uint16_t motion = useMotion ? static_cast<uint16_t>(std::sqrt(static_cast<double>(x * x + y * y + z * z))) : 0;
+
+      // Same handling of the results as HeartRateTask
+      const int8_t ambient = ppg.Preprocess(record.hrs, record.als, motion);
+      if (windowSamples < Ppg::dataLength) {
+        windowSamples++;
+      }
+      const bool analyzed = windowSamples == Ppg::dataLength;
+      const auto start = std::chrono::steady_clock::now();
+      int bpm = ppg.HeartRate();
+      const auto end = std::chrono::steady_clock::now();
+      if (analyzed) {
+        windowSamples = Ppg::dataLength - Ppg::overlapWindow;
+      }
+      if (ambient > 0) {
+        ppg.Reset(true);
+        windowSamples = 0;
+        bpm = 0;
+      } else if (bpm < 0) {
+        ppg.Reset(false);
+        bpm = 0;
+      }
+      if (!analyzed) {
+        continue;
+      }
+
+      const double microseconds = std::chrono::duration<double, std::micro>(end - start).count();
+      totalMicroseconds += microseconds;
+      maxMicroseconds = std::max(maxMicroseconds, microseconds);
+      nbEstimations++;
+      dcLevels.push_back(ppg.DcLevel());
+
+      const double expected = Recording::ReferenceAt(reference, sample.time);
+      printf("%.2f,%d,%d,%.1f\n", sample.time, bpm, ppg.Confident() ? 1 : 0, expected);
+      if (bpm > 0) {
+        nbValid++;
+      }
+      if (bpm > 0 && expected > 0) {
+        const double error = bpm - expected;
+        nbCompared++;
+        sumError += std::abs(error);
+        sumSquaredError += error * error;
+        if (std::abs(error) <= correctThreshold) {
+          nbCorrect++;
+        }
+      }
+    }
+
+    fprintf(stderr, "Samples: %zu (%.1fs at %uHz)\n", samples.size(), samples.empty() ? 0 : samples.back().time, Ppg::sampleRate);
+    fprintf(stderr, "Estimations: %zu, with a heart rate: %zu\n", nbEstimations, nbValid);
+    if (nbEstimations > 0) {
+      fprintf(stderr, "Time per estimation (host): %.1fus average, %.1fus max\n", totalMicroseconds / nbEstimations, maxMicroseconds);
+      const auto nbAboveThreshold = std::count_if(dcLevels.begin(), dcLevels.end(), [](double level) {
+        return level >= Ppg::dcThreshold;
+      });
+      fprintf(stderr,
+              "DC level: median %.3f, 90%%: %.3f, 99%%: %.3f, above the threshold (%.2f) in %.1f%%\n",
+              Percentile(dcLevels, 50),
+              Percentile(dcLevels, 90),
+              Percentile(dcLevels, 99),
+              Ppg::dcThreshold,
+              100.0 * nbAboveThreshold / nbEstimations);
+    }
+    if (nbCompared > 0) {
+      fprintf(stderr,
+              "Error against the reference: MAE %.2f BPM, RMSE %.2f BPM, %zu (%.1f%%) within %.0f BPM\n",
+              sumError / nbCompared,
+              std::sqrt(sumSquaredError / nbCompared),
+              nbCorrect,
+              100.0 * nbCorrect / nbCompared,
+              correctThreshold);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  bool useMotion = true;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-motion") == 0) {
+      useMotion = false;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || paths.size() > 2) {
+    fprintf(stderr, "Usage: %s [--no-motion] <recording.ppg> [reference.csv]\n", argv[0]);
+    return 1;
+  }
+
+  Recording::Header header;
+  std::vector<Sample> samples;
+  if (!Recording::Read(paths[0], header, samples)) {
+    return 1;
+  }
+  std::vector<ReferencePoint> reference;
+  if (paths.size() > 1 && !Recording::ReadReference(paths[1], reference)) {
+    return 1;
+  }
+
+  // Acquisition profiles of HeartRateTask
+  switch (header.sampleRate) {
+    case 10:
+      Replay<Pinetime::Controllers::Ppg<10, 64>>(samples, reference, useMotion);
+      break;
+    case 25:
+      Replay<Pinetime::Controllers::Ppg<25, 256>>(samples, reference, useMotion);
+      break;
+    default:
+      fprintf(stderr, "Unsupported sample rate: %uHz\n", header.sampleRate);
+      return 1;
+  }
+  return 0;
+}
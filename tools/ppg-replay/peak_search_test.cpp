@@ -0,0 +1,253 @@
+// Checks components/heartrate/PeakSearch.h against the original peak search of Ppg (legacy/LegacyPeakSearch.h), a walk of
+// the ROI in 0.01 bin steps, on random spectra:
+// - both find a peak in the same spectra, except the ones the walk cannot resolve (a bin exactly at threshold, or a part
+//   of the spectrum above threshold narrower than its step);
+// - the widths differ by less than 2 steps of the walk;
+// - on spectra made of a single gaussian peak, the location is more accurate than the one of the walk (the middle of
+//   the threshold crossings).
+// It also compares their speed.
+//
+// Usage: peak-search-test [iterations]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "components/heartrate/PeakSearch.h"
+#include "legacy/LegacyPeakSearch.h"
+
+namespace {
+  struct Result {
+    float center;
+    float width;
+  };
+
+  template <size_t N>
+  struct Case {
+    std::array<float, N> spectrum;
+    float threshold;
+  };
+
+  // ROI of the acquisition profiles of HeartRateTask: [30, 240] BPM
+  template <size_t N>
+  struct Profile;
+
+  template <>
+  struct Profile<32> {
+    static constexpr int begin = 3;
+    static constexpr int end = 26;
+  };
+
+  template <>
+  struct Profile<128> {
+    static constexpr int begin = 5;
+    static constexpr int end = 41;
+  };
+
+  template <size_t N>
+  Case<N> MakeCase(std::mt19937& generator) {
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    Case<N> result;
+    auto& spectrum = result.spectrum;
+    switch (generator() % 4) {
+      case 0:
+        // Noise only
+        for (auto& value : spectrum) {
+          value = uniform(generator);
+        }
+        break;
+      case 1:
+      case 2: {
+        // Noise floor and 1 to 3 peaks, at any location within the ROI (or slightly outside of it) and of any width
+        for (auto& value : spectrum) {
+          value = 0.2f * uniform(generator);
+        }
+        const int nbPeaks = 1 + generator() % 3;
+        for (int peak = 0; peak < nbPeaks; peak++) {
+          const float center = Profile<N>::begin - 2 + uniform(generator) * (Profile<N>::end - Profile<N>::begin + 4);
+          const float width = 0.3f + 3.0f * uniform(generator);
+          const float height = 0.5f + uniform(generator);
+          for (size_t idx = 0; idx < N; idx++) {
+            const float distance = (idx - center) / width;
+            spectrum[idx] += height * std::exp(-distance * distance);
+          }
+        }
+        break;
+      }
+      case 3:
+        // Few distinct values: plateaus and bins exactly at the threshold
+        for (auto& value : spectrum) {
+          value = static_cast<float>(generator() % 6);
+        }
+        break;
+    }
+
+    float max = 0.0f;
+    for (int idx = Profile<N>::begin; idx < Profile<N>::end; idx++) {
+      max = std::max(max, spectrum[idx]);
+    }
+    // Same threshold as Ppg most of the time, otherwise the value of one of the bins
+    result.threshold = generator() % 4 != 0 ? 0.6f * max : spectrum[Profile<N>::begin + generator() % (Profile<N>::end - Profile<N>::begin)];
+    return result;
+  }
+
+  template <size_t N>
+  Result Search(const Case<N>& test) {
+    Result result;
+    result.center = Pinetime::Controllers::PeakSearch(test.spectrum, test.threshold, result.width, Profile<N>::begin, Profile<N>::end);
+    return result;
+  }
+
+  template <size_t N>
+  Result LegacySearch(const Case<N>& test) {
+    std::array<float, N> bins;
+    for (size_t idx = 0; idx < N; idx++) {
+      bins[idx] = idx;
+    }
+    std::array<float, N> values = test.spectrum;
+    Result result;
+    result.center = Legacy::PeakSearch(bins.data(),
+                                       values.data(),
+                                       test.threshold,
+                                       result.width,
+                                       static_cast<float>(Profile<N>::begin),
+                                       static_cast<float>(Profile<N>::end),
+                                       N);
+    return result;
+  }
+
+  // The walk of the original search misses the parts of the spectrum above or below threshold narrower than its step,
+  // and its decisions on a bin exactly at threshold, or on a crossing of the threshold next to one of its steps or to the
+  // start or the end of the ROI, depend on the rounding of its location
+  template <size_t N>
+  bool ResolvedByWalk(const Case<N>& test) {
+    constexpr float step = 0.01f;
+    float previousCrossing = -1.0f;
+    for (int idx = Profile<N>::begin - 1; idx <= Profile<N>::end; idx++) {
+      const float value = test.spectrum[idx];
+      const float next = test.spectrum[idx + 1];
+      if (value == test.threshold) {
+        return false;
+      }
+      if ((value < test.threshold) == (next < test.threshold)) {
+        continue;
+      }
+      const float crossing = idx + (test.threshold - value) / (next - value);
+      const float steps = (crossing - Profile<N>::begin) / step;
+      if (crossing - previousCrossing < 2 * step || std::abs(steps - std::round(steps)) < 0.1f ||
+          std::abs(crossing - Profile<N>::begin) < 2 * step || std::abs(crossing - Profile<N>::end) < 2 * step) {
+        return false;
+      }
+      previousCrossing = crossing;
+    }
+    return true;
+  }
+
+  template <size_t N>
+  bool Check(uint32_t iterations) {
+    std::mt19937 generator {N};
+    uint32_t nbMismatches = 0;
+    uint32_t nbUnresolved = 0;
+    uint32_t nbPeaks = 0;
+    double time = 0;
+    double legacyTime = 0;
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+      const auto test = MakeCase<N>(generator);
+      const auto start = std::chrono::steady_clock::now();
+      const Result result = Search(test);
+      const auto middle = std::chrono::steady_clock::now();
+      const Result expected = LegacySearch(test);
+      const auto end = std::chrono::steady_clock::now();
+      time += std::chrono::duration<double, std::micro>(middle - start).count();
+      legacyTime += std::chrono::duration<double, std::micro>(end - middle).count();
+
+      if (expected.center != 0.0f) {
+        nbPeaks++;
+      }
+      const bool found = result.center != 0.0f;
+      const bool expectedFound = expected.center != 0.0f;
+      if (found != expectedFound && !ResolvedByWalk(test)) {
+        nbUnresolved++;
+        continue;
+      }
+      if (found != expectedFound || std::abs(result.width - expected.width) >= 0.02f) {
+        if (nbMismatches++ < 10) {
+          fprintf(stderr,
+                  "N=%zu, case %u: center %.9g width %.9g, expected center %.9g width %.9g\n",
+                  N,
+                  iteration,
+                  result.center,
+                  result.width,
+                  expected.center,
+                  expected.width);
+        }
+      }
+    }
+    printf("%zu bins: %u spectra (%u with a peak), %u mismatches, %u not resolved by the walk, %.2fus per search "
+           "(original: %.2fus)\n",
+           N,
+           iterations,
+           nbPeaks,
+           nbMismatches,
+           nbUnresolved,
+           time / iterations,
+           legacyTime / iterations);
+    return nbMismatches == 0;
+  }
+
+  // Single gaussian peaks anywhere in the ROI, without noise: the error of the location is the one of the interpolation
+  template <size_t N>
+  bool CheckLocation(uint32_t iterations) {
+    std::mt19937 generator {N + 1};
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    double squaredError = 0;
+    double legacySquaredError = 0;
+    uint32_t nbLocated = 0;
+    uint32_t nbMissed = 0;
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+      Case<N> test;
+      const float center = Profile<N>::begin + 2 + uniform(generator) * (Profile<N>::end - Profile<N>::begin - 4);
+      const float width = 0.8f + 2.0f * uniform(generator);
+      for (size_t idx = 0; idx < N; idx++) {
+        const float distance = (idx - center) / width;
+        test.spectrum[idx] = std::exp(-distance * distance);
+      }
+      test.threshold = 0.6f * *std::max_element(test.spectrum.begin(), test.spectrum.end());
+      const Result result = Search(test);
+      const Result expected = LegacySearch(test);
+      if (result.center == 0.0f) {
+        nbMissed++;
+        continue;
+      }
+      // The walk counts a peak twice when it ends right after a step
+      if (expected.center == 0.0f) {
+        continue;
+      }
+      nbLocated++;
+      squaredError += (result.center - center) * (result.center - center);
+      legacySquaredError += (expected.center - center) * (expected.center - center);
+    }
+    const double error = std::sqrt(squaredError / nbLocated);
+    const double legacyError = std::sqrt(legacySquaredError / nbLocated);
+    printf("%zu bins: %u single peaks located, %u missed, RMS error %.4f bins (original: %.4f)\n",
+           N,
+           nbLocated,
+           nbMissed,
+           error,
+           legacyError);
+    return nbMissed == 0 && error < legacyError;
+  }
+}
+
+int main(int argc, char** argv) {
+  const uint32_t iterations = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 20000;
+  const bool success = Check<32>(iterations) & Check<128>(iterations) & CheckLocation<32>(iterations / 10) &
+                       CheckLocation<128>(iterations / 10);
+  return success ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// The firmware logs are not needed on the host
+#define NRF_LOG_INFO(...)
+#define NRF_LOG_WARNING(...)
+#define NRF_LOG_ERROR(...)
@@ -0,0 +1,160 @@
+// Generates synthetic recordings of the heart rate sensor (see doc/PpgRecording.md) with their reference heart rate,
+// used by the tests when no real recordings are available (see traces/README.md).
+//
+// Usage: ppg-synth <scenario> <recording.ppg> <reference.csv>
+//
+// The PPG is a pulse wave (fundamental and second harmonic) following the heart rate of the scenario, on top of a
+// drifting baseline modulated by the respiration, with white noise. The baseline can also jump every 20s (the pressure
+// or the contact of the watch on the wrist changes), with increasing amplitudes. When walking, the accelerometer sees
+// the steps and the swing of the arm, and the PPG gets motion artifacts at the same frequencies. Like on the watch, the
+// accelerometer samples are the latest values read by SystemTask (~10Hz).
+// The generation is deterministic (mt19937 and Box-Muller, no implementation-defined distribution).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include "Recording.h"
+
+namespace {
+  using Recording::Header;
+  using Recording::Record;
+  using Recording::tickRate;
+
+  constexpr double pi = 3.14159265358979323846;
+
+  struct Scenario {
+    const char* name;
+    uint16_t sampleRate;
+    double duration;   // s
+    double startBpm;   // heart rate at the start, linearly changing to endBpm
+    double endBpm;
+    double cadence;    // steps per second, 0 when not walking
+    double artifact;   // amplitude of the motion artifacts, relative to the pulse
+    double noise;      // standard deviation of the PPG noise, relative to the pulse
+    double jump;       // amplitude of the largest jump of the baseline, relative to the pulse (0: none)
+    double stale;      // seconds per minute during which the accelerometer is not read (SystemTask sleeping)
+    uint32_t seed;
+  };
+
+  constexpr Scenario scenarios[] = {
+    {"rest-10", 10, 180, 62, 72, 0, 0, 0.15, 0, 0, 1},
+    {"rest-25", 25, 180, 62, 72, 0, 0, 0.15, 0, 0, 2},
+    {"ramp-10", 10, 240, 70, 150, 0, 0, 0.2, 0, 0, 3},
+    {"ramp-25", 25, 240, 70, 150, 0, 0, 0.2, 0, 0, 4},
+    {"walk-10", 10, 240, 100, 115, 1.8, 1.2, 0.2, 0, 0, 5},
+    {"walk-25", 25, 240, 100, 115, 1.8, 1.2, 0.2, 0, 0, 6},
+    {"contact-10", 10, 400, 75, 75, 0, 0, 0.15, 40, 0, 7},
+    {"contact-25", 25, 400, 75, 75, 0, 0, 0.15, 40, 0, 8},
+    // Heart rate away from the cadence (108 steps per minute)
+    {"brisk-10", 10, 240, 125, 140, 1.8, 1.2, 0.2, 0, 0, 9},
+    {"brisk-25", 25, 240, 125, 140, 1.8, 1.2, 0.2, 0, 0, 10},
+    {"brisk-stale-10", 10, 240, 125, 140, 1.8, 1.2, 0.2, 0, 20, 11},
+    {"brisk-stale-25", 25, 240, 125, 140, 1.8, 1.2, 0.2, 0, 20, 12},
+  };
+
+  class Noise {
+  public:
+    explicit Noise(uint32_t seed) : generator {seed} {
+    }
+
+    // Standard normal distribution
+    double Next() {
+      const double u1 = (static_cast<double>(generator()) + 1.0) / 4294967296.0;
+      const double u2 = static_cast<double>(generator()) / 4294967296.0;
+      return std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * pi * u2);
+    }
+
+  private:
+    std::mt19937 generator;
+  };
+
+  int Generate(const Scenario& scenario, const char* recordingPath, const char* referencePath) {
+    std::ofstream recording(recordingPath, std::ios::binary);
+    std::ofstream reference(referencePath);
+    if (!recording || !reference) {
+      fprintf(stderr, "Cannot create %s or %s\n", recordingPath, referencePath);
+      return 1;
+    }
+
+    Header header {Recording::formatVersion, sizeof(Record), scenario.sampleRate, 0};
+    recording.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Same sampling period as HeartRateTask, rounded to the tick
+    const uint32_t period = (tickRate + scenario.sampleRate / 2) / scenario.sampleRate;
+    const uint32_t motionPeriod = tickRate / 10;
+    // Amplitude of the pulse (ADC counts), with which the original estimation accepts the windows without artifacts
+    const double pulse = 15.0;
+    Noise noise {scenario.seed};
+    double phase = 0;
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t z = -1024;
+    uint32_t nextMotionUpdate = 0;
+    double nextReference = 0;
+
+    for (uint32_t tick = 0; tick < scenario.duration * tickRate; tick += period) {
+      const double time = static_cast<double>(tick) / tickRate;
+      const double bpm = scenario.startBpm + (scenario.endBpm - scenario.startBpm) * time / scenario.duration;
+      phase += 2 * pi * bpm / 60.0 * period / tickRate;
+
+      double ppg = 6000.0 + 10.0 * std::sin(2 * pi * time / 60.0) + 6.0 * std::sin(2 * pi * 0.25 * time);
+      ppg += pulse * (std::sin(phase) + 0.4 * std::sin(2 * phase + 0.8));
+      if (scenario.jump > 0) {
+        // Up and down jumps, from 1/20 of the largest one to the largest one
+        const int jumps = static_cast<int>(time / 20.0);
+        const double amplitude = scenario.jump * pulse * std::min(jumps, 20) / 20.0;
+        ppg += jumps % 2 == 1 ? amplitude : 0.0;
+      }
+
+      const double step = 2 * pi * scenario.cadence * time;
+      if (scenario.cadence > 0) {
+        // Artifacts at the cadence (steps) and at half of it (swing of the arm)
+        ppg += scenario.artifact * pulse * (std::sin(step + 0.3) + 0.5 * std::sin(step / 2));
+      }
+      ppg += scenario.noise * pulse * noise.Next();
+
+      // The accelerometer is read by SystemTask at ~10Hz, the samples use the latest values. When they are too old,
+      // HeartRateTask records the motion as unknown (0)
+      const bool stale = std::fmod(time, 60.0) >= 60.0 - scenario.stale;
+      if (tick >= nextMotionUpdate) {
+        nextMotionUpdate += motionPeriod;
+        const double swing = scenario.cadence > 0 ? 0.35 * std::sin(step / 2) : 0.0;
+        const double impact = scenario.cadence > 0 ? 250.0 * std::sin(step) : 0.0;
+        x = static_cast<int16_t>(std::lround(1024.0 * std::sin(swing) + 10.0 * noise.Next()));
+        y = static_cast<int16_t>(std::lround(10.0 * noise.Next()));
+        z = static_cast<int16_t>(std::lround(-1024.0 * std::cos(swing) - impact + 10.0 * noise.Next()));
+      }
+
+      Record record {static_cast<uint16_t>(tick), static_cast<uint16_t>(std::lround(ppg)), 20, x, y, z};
+      if (stale) {
+        record.x = record.y = record.z = 0;
+      }
+      recording.write(reinterpret_cast<const char*>(&record), sizeof(record));
+
+      if (time >= nextReference) {
+        reference << time << "," << bpm << "\n";
+        nextReference += 1.0;
+      }
+    }
+    return 0;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <scenario> <recording.ppg> <reference.csv>\n", argv[0]);
+    return 1;
+  }
+  for (const auto& scenario : scenarios) {
+    if (strcmp(argv[1], scenario.name) == 0) {
+      return Generate(scenario, argv[2], argv[3]);
+    }
+  }
+  fprintf(stderr, "Unknown scenario: %s\n", argv[1]);
+  return 1;
+}